@@ -99,6 +99,9 @@
                                Argument for specifying sample size is now -n (it was -c)
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE                 /* fopencookie() */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -106,6 +109,31 @@
 #include <ctype.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifndef WIN
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 /* Constants */
 #define BIGX           20.0                           /* max value to represent exp (x) */
@@ -113,6 +141,8 @@
 #define I_SQRT_PI      0.5641895835477562869480795    /* 1 / sqrt (pi) */
 #define Z_MAX          6.0                            /* maximum meaningful z value */
 #define ex(x)          (((x) < -BIGX) ? 0.0 : exp (x))
+#define MAX(a, b)      (((a) > (b)) ? (a) : (b))
+#define MIN(a, b)      (((a) < (b)) ? (a) : (b))
 #define MAX_PROB       0.999999
 #define MIN_PROB       0.000001
 #define PROGRAM_NAME   "MrModeltest"
@@ -125,6 +155,103 @@
 #define NA             -99999
 #define NUM_MODELS     24
 #define NUM_SCORES     175
+#define NUM_BASES      4
+#define NUM_GAMMA_CATS 4                              /* as lscores rates=gamma ncat=4 in PAUP* */
+#define SHAPE_INFINITY 999.999                        /* stored in score[] for a shape reported as 'infinity' */
+#define MIN_SHAPE      0.01
+#define MAX_SHAPE      300.0                          /* an optimum at this bound is reported as infinity */
+#define SHAPE_GRID     256.0                          /* points per unit of the log(shape) lattice */
+#define SHAPE_STEP     (1.0 / SHAPE_GRID)             /* finite difference step for the shape derivatives: one lattice point */
+#define GAMMA_CACHE    512                            /* entries in the discrete gamma rate cache */
+#define SHAPE_MEMO     64                             /* lattice points remembered by an OptimizeShape() */
+#define MIN_BRLEN      1.0e-8
+#define MAX_BRLEN      10.0
+#define MAX_PINV       0.99
+#define LNL_TOLERANCE  1.0e-4                         /* stop optimizing when a round improves lnL less than this */
+#define BRENT_TOL      1.0e-5
+#define BRLEN_TOL      1.0e-6                         /* relative change that ends the Newton-Raphson branch length search */
+#define MAX_ITER       100
+#define SCALE_BITS     256                            /* partials below 2^-SCALE_BITS are scaled up by 2^SCALE_BITS */
+#define SCALE_FACTOR   1.15792089237316195e77         /* 2^256 */
+#define SCALE_LIMIT    (1.0 / SCALE_FACTOR)
+#define LN_SCALE       (SCALE_BITS * 0.69314718055994530942)
+#define CHUNK_SIZE     512                            /* site patterns per work unit (three partial vectors fit in L2) */
+#define CHUNKS_PER_THREAD 8                           /* fewer chunks per thread are run with model-level threads */
+#define JOB_PARTIAL    0
+#define JOB_SUMS       1
+#define JOB_LNL        2
+#define PACK_MAGIC     "MRMT2PK3"                     /* packed alignment image, version 3 */
+#define PACK_SUFFIX    ".pack"
+#define RESULT_MAGIC   "MRMT2RS3"                     /* cached scores; change when the estimates would change */
+#define RESULT_SUFFIX  ".res"
+#define CHECKPOINT_MAGIC "MRMT2CK2"
+#define CHECKPOINT_SUFFIX ".ckpt"
+#define CHECKPOINT_INTERVAL 60                        /* seconds between checkpoints of --checkpoint, --resume */
+#define SCREEN_TOLERANCE 1.0                          /* LNL_TOLERANCE of the screening of the models (--screen) */
+#define BOUND_MARGIN   4.0                            /* stopped models this close to the best are finished (--bound) */
+#define NUM_PASSES     4                              /* passes of increasing precision with --deadline */
+#define PAD8(n)        (((n) + 7) & ~((size_t) 7))
+#define MAX_DISTANCE   MAX_BRLEN                      /* saturated or undefined pairwise distances */
+#define MAX_SITE_STEP  10                             /* largest step of the site ranges printed for charsets */
+#define CRITERION_AIC  1
+#define CRITERION_AICC 2
+#define CRITERION_BIC  3
+#define SELECT_HLRT    0                              /* models printed in a partitioned MrBayes block */
+#define SELECT_AIC     1
+#define SELECT_SCHEME  2
+#define QUEUE_POLL     5                              /* seconds between looks at the claims of other workers (--queue) */
+#define QUEUE_LEASE    600                            /* default seconds before a claim not touched expires */
+#define WATCH_SUFFIX   ".scores"                      /* files picked up by --watch, also with .gz or .zst */
+#define WATCH_INDEX    ".mrmodeltest2.index"          /* files done by --watch, in the directory watched */
+#define COMPRESSED_NONE 0                             /* input found by OpenInput() */
+#define COMPRESSED_GZIP 1
+#define COMPRESSED_ZSTD 2
+#define COMPRESSED_BLOCK 65536                        /* bytes of compressed input read at a time */
+#define NUM_SELECTED   5                              /* models selected: hLRT1-4 and AIC */
+#define NUM_AVERAGED   15                             /* model-averaged estimates of ModelAveraging() */
+#define STORE_MAGIC    "MRMT2CS1"                     /* columnar results store (--store) */
+#define STORE_COLUMNS  (1 + NUM_SELECTED + 3 * NUM_MODELS + NUM_AVERAGED)
+#define STORE_NAME     0                              /* int offsets of the locus names in the text */
+#define STORE_MODEL    1                              /* signed char index of a model, -1 for none */
+#define STORE_FLOAT    2                              /* float, NA for none */
+#define QUERY_EQ       0                              /* comparisons of --where */
+#define QUERY_NE       1
+#define QUERY_LT       2
+#define QUERY_GT       3
+#define QUERY_LE       4
+#define QUERY_GE       5
+#define SUMMARY_MAGIC  "MRMT2SM1"                     /* summary of loci saved for --merge */
+#define SKETCH_ACCURACY 0.01                          /* relative error of the quantiles of the summary */
+#define SKETCH_GAMMA   ((1.0 + SKETCH_ACCURACY) / (1.0 - SKETCH_ACCURACY))
+#define SKETCH_MIN     1e-6                           /* smaller values are counted as 0 */
+#define SKETCH_BUCKETS 1400                           /* up to SKETCH_MIN * SKETCH_GAMMA^1400, about 10^6 */
+#define METRICS_INTERVAL 5                            /* default seconds between rewrites of the metrics (--metrics) */
+#define NUM_METRICS_BUCKETS 10                        /* of the histograms of the stage times, in metricsBucket[] */
+#define NUM_STAGES     3                              /* of --batch, for the metrics */
+#define STAGE_READ     0
+#define STAGE_COMPUTE  1
+#define STAGE_WRITE    2
+#define NUM_ERRORS     3                              /* types of errors of a locus, for the metrics */
+#define ERROR_OPEN     0                              /* the file could not be opened */
+#define ERROR_INCOMPLETE 1                            /* the scores are incomplete or incorrect */
+#define ERROR_FAILED   2                              /* the process failed otherwise */
+#define PROFILE_COUNTERS 4                            /* cycles, instructions, cache misses, branch misses (--profile) */
+#define NUM_PROFILE    6                              /* regions of the numeric kernels profiled */
+#define PROFILE_CHISQUARE 0
+#define PROFILE_NORMALZ 1
+#define PROFILE_AKAIKE 2
+#define PROFILE_PARTIAL 3
+#define PROFILE_SUMS   4
+#define PROFILE_LNL    5
+#define BATCH_QUEUE    4                              /* loci read ahead per process (--batch) */
+#define STREAM_POLL    1                              /* seconds between reads at the end of a file followed (--follow) */
+#define LAZY_AIC_NONE  0                              /* --aic with --lazy */
+#define LAZY_AIC_SCORED 1
+#define LAZY_AIC_ALL   2
+#define PAR_FREQ       0                              /* 0-2: log(piX/piT) for A, C and G */
+#define PAR_RATE       3                              /* 3-7: log of rAC, rAG, rAT, rCG, rCT */
+#define PAR_KAPPA      8                              /* log of rAG = rCT (nst=2) */
+#define PAR_PINV       9
 
 #ifndef WIN
 #define WIN            0
@@ -137,9 +264,314 @@ typedef struct {
     char *name;
 } ModelSt;
 
+/* Input of OpenInput(), decompressed as it is read */
+typedef struct {
+    FILE *fp;                       /* the file as it is */
+    char *name;
+    int kind;                       /* COMPRESSED_NONE, _GZIP or _ZSTD */
+    unsigned char in[COMPRESSED_BLOCK];
+    size_t numIn, pos;              /* bytes in in[] looked at by OpenInput(), and given back */
+    int ended;                      /* at the end of a gzip member or zstd frame */
+    int atEnd;
+#ifdef HAVE_ZLIB
+    z_stream z;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zs;
+    ZSTD_inBuffer zin;
+#endif
+} CompressedSt;
+
+/* Results of a locus of --batch kept for the results store (--store) */
+typedef struct {
+    float lnL[NUM_MODELS];          /* -lnL */
+    float AIC[NUM_MODELS];          /* AIC, or AICc with -n */
+    float weight[NUM_MODELS];       /* Akaike weight */
+    signed char selected[NUM_SELECTED]; /* models selected by the hLRTs 1-4 and the AIC, or -1 */
+    float averaged[NUM_AVERAGED];   /* model-averaged estimates, or NA */
+    double seconds;                 /* from the start of the process to the end of the report */
+} LocusResultSt;
+
+/* Start of a results store, followed by STORE_COLUMNS StoreColumnSt, the
+   columns and the text of the locus names */
+typedef struct {
+    char magic[8];
+    int numLoci;
+    int numColumns;
+    long long textOffset;
+} StoreHeaderSt;
+
+typedef struct {
+    char name[24];
+    int type;                       /* STORE_NAME, STORE_MODEL or STORE_FLOAT */
+    int pad;
+    long long offset;               /* of the numLoci values, from the start of the file */
+} StoreColumnSt;
+
+/* Quantile sketch of the values of a model-averaged estimate over the loci */
+typedef struct {
+    long long count[SKETCH_BUCKETS]; /* values in (SKETCH_MIN * SKETCH_GAMMA^(k-1), SKETCH_MIN * SKETCH_GAMMA^k] */
+    long long numZero;              /* values not above SKETCH_MIN */
+    long long n;
+    double sum, min, max;
+} SketchSt;
+
+/* Summary of the loci of --batch, updated as they are done (--summary) */
+typedef struct {
+    char magic[8];
+    long long numLoci;
+    long long selected[NUM_SELECTED][NUM_MODELS + 1]; /* loci where each model (or none, last) was selected */
+    long long agree[NUM_SELECTED - 1];  /* loci where hLRTk selected the AIC model */
+    long long compared[NUM_SELECTED - 1];
+    long long allAgree, allCompared;    /* the same for all four hLRTs */
+    SketchSt estimate[NUM_AVERAGED];
+} SummarySt;
+
+/* A condition of --where */
+typedef struct {
+    int column;
+    int op;                         /* QUERY_EQ ... QUERY_GE */
+    int other;                      /* column compared with, or -1 for value */
+    double value;
+} QueryConditionSt;
+
+/* A locus of --batch on its way through the stages */
+typedef struct {
+    char *name;
+    float score[176];
+    int numScores;                  /* values read, or -1 if the file could not be opened */
+    pid_t pid;                      /* process selecting the models */
+    int fd;                         /* read end of the pipe of its report */
+    LocusResultSt *result;          /* shared with the process, with --store, --summary or --metrics (else NULL) */
+    double started;                 /* WallSeconds() when the process was started */
+} BatchLocusSt;
+
+/* Counts of --batch for the metrics file (--metrics) */
+typedef struct {
+    double start;
+    long long numLoci;
+    long long numErrors[NUM_ERRORS];
+    long long bucket[NUM_STAGES][NUM_METRICS_BUCKETS]; /* loci at most metricsBucket[i] seconds in the stage */
+    long long count[NUM_STAGES];
+    double sum[NUM_STAGES];
+} MetricsSt;
+
+/* Bounded queue between two stages of --batch */
+typedef struct {
+    BatchLocusSt **item;
+    int size, head, count;
+    int closed;                     /* nothing more will be put */
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty, notFull;
+    double depthSum;                /* sum of the loci found in the queue by each put */
+    long numPuts, numFull;          /* puts, and puts that had to wait */
+} BatchQueueSt;
+
+/* Counters of a thread at the start of a profiled region (--profile) */
+typedef struct {
+    int counters;                   /* YES if value[] was read */
+    double seconds;
+    unsigned long long value[PROFILE_COUNTERS];
+} ProfileSt;
+
+/* What was counted in a profiled region, over all its calls and threads */
+typedef struct {
+    long long calls;
+    long long countedCalls;         /* calls with the counters */
+    long long units;                /* patterns, models or calls done */
+    double seconds;
+    unsigned long long value[PROFILE_COUNTERS];
+} ProfileRegionSt;
+
+/* The counters of a thread: file descriptor of their group, or -1 for none */
+typedef struct {
+    int group;
+} ProfileThreadSt;
+
+/* A scorefile being done by a process of --watch */
+typedef struct {
+    pid_t pid;                  /* 0 for a free process */
+    char *locus;                /* file name */
+    char *key;                  /* line of the file in the index */
+} WatchSt;
+
+/* Settings for each of the 24 models, as in the lscores commands of MrModelblock */
+typedef struct {
+    char *name;
+    int nst;            /* number of substitution types (1, 2 or 6) */
+    int estFreqs;       /* base=est */
+    int useInv;         /* pinv=est */
+    int useGamma;       /* rates=gamma */
+    int scoreIndex;     /* position of the tree number for this model in score[] */
+} ModelSpecSt;
+
+/* Aligned sequences compressed to unique site patterns. Bases are packed as
+   2-bit codes (A=0, C=1, G=2, T=3; four patterns per byte) and ambiguous
+   states and gaps are marked in a bitmap, with their state sets (A=1, C=2,
+   G=4, T=8 and unions) listed per taxon in pattern order. All arrays point
+   into one image that is saved next to the alignment file and memory-mapped
+   by later runs. */
+typedef struct {
+    int numTaxa;
+    int numChars;
+    int numPatterns;
+    char **taxonName;
+    unsigned char **packed;     /* [taxon][pattern / 4] */
+    unsigned char **ambiguous;  /* [taxon][pattern / 8]: bit set for ambiguous states */
+    int *ambigStart;            /* [taxon]: first entry of the taxon in ambigPattern and ambigState */
+    int *ambigPattern;
+    unsigned char *ambigState;
+    unsigned char *constMask;   /* [pattern]: bases shared by all taxa (non-zero for constant sites) */
+    int *weight;                /* [pattern]: number of sites with this pattern */
+    int *sitePattern;           /* [site]: pattern of each site (not kept for partitions) */
+    double freq[NUM_BASES];     /* empirical base frequencies */
+    char *image;
+    size_t imageSize;
+    int mapped;                 /* image is a memory-mapped file */
+} AlignSt;
+
+/* Start of a packed alignment image, followed by the arrays of AlignSt in
+   native byte order, each padded to 8 bytes */
+typedef struct {
+    char magic[8];
+    int numTaxa;
+    int numChars;
+    int numPatterns;
+    int numAmbiguous;
+    double freq[NUM_BASES];
+    long long sourceSize;       /* size and content hash of the alignment file */
+    unsigned long long sourceHash;
+    long long namesSize;
+} PackHeaderSt;
+
+/* Unrooted binary tree. Tips are nodes 0..numTips-1 (in alignment order) and
+   every internal node has three neighbours. The root only orders the traversals. */
+typedef struct {
+    int numTips;
+    int numNodes;
+    int numEdges;
+    int root;
+    int (*nb)[3];       /* neighbours of each node (tips only use slot 0) */
+    int (*edge)[3];     /* edge leading to each neighbour */
+    int (*back)[3];     /* slot of the node in the neighbour list of each neighbour */
+    int *parent;        /* parent of each node when rooted at root (-1 for root) */
+    int *postorder;     /* internal nodes, children before parents, root last */
+    double *length;     /* branch lengths read from the tree file */
+} TreeSt;
+
+/* Entry of a sorted row of the neighbor-joining distance matrix. The distance
+   is rounded down so that it can be used as a lower bound. */
+typedef struct {
+    float d;
+    int id;
+} NJEntrySt;
+
+/* Partition of the alignment in the partitioned mode (-m), with its own
+   compressed patterns and scores as if it had been run on its own */
+typedef struct {
+    char *name;
+    unsigned char *inSet;           /* [site]: YES for the sites of the partition */
+    int numSites;
+    AlignSt *data;
+    float score[176];               /* as in score[] */
+    unsigned char approx[NUM_MODELS];   /* as in modelApprox[] */
+    char modelhLRT[10];
+    char modelAIC[10];
+    unsigned long long hash;        /* of the sorted sites, for the subset cache */
+    int scored;                     /* the scheme criterion has been calculated */
+    float lnL;                      /* -lnL of the best model by the scheme criterion */
+    int K;                          /* and its free parameters, branch lengths included */
+    char modelScheme[10];
+} PartSt;
+
+/* Start of a file of the results cache (-r), followed by the 176 floats of
+   score[] and the NUM_MODELS bytes of modelApprox[] */
+typedef struct {
+    char magic[8];
+    unsigned long long key;
+    int numTaxa;
+    int numPatterns;
+} ResultHeaderSt;
+
+/* State of a model in the checkpoint: the estimates when done, or the values
+   after the last round of optimization */
+typedef struct {
+    unsigned long long key;         /* ResultKey() of the patterns */
+    int model;
+    int done;
+    double lnL;
+    double pi[NUM_BASES];
+    double rate[6];
+    double shape;
+    int shapeInfinite;
+    double pinv;
+    int secondStart;                /* LikeSt secondStart */
+    double *brlen;                  /* [edge] */
+} CheckpointSt;
+
+/* Likelihood calculation for one model */
+typedef struct {
+    AlignSt *data;                  /* patterns the likelihood is calculated for */
+    float *score;                   /* where StoreScores() puts the estimates */
+    ModelSpecSt *spec;
+    double pi[NUM_BASES];
+    double rate[6];                 /* rAC, rAG, rAT, rCG, rCT, rGT (rGT = 1) */
+    double shape;
+    int shapeInfinite;              /* optimum at MAX_SHAPE */
+    double pinv;
+    int numCats;
+    double catRate[NUM_GAMMA_CATS];
+    double *brlen;                  /* [edge] */
+    int eigenValid;                 /* eigensystem matches pi and rate */
+    double eval[NUM_BASES];
+    double evec[NUM_BASES][NUM_BASES];
+    double ivec[NUM_BASES][NUM_BASES];
+    int pmatValid;                  /* pmat matches the eigensystem, rates and branch lengths */
+    double *pmat;                   /* [edge][cat][from][to] */
+    double **partial;               /* [3 * internal node + slot][pattern][cat][base]: subtree seen from that neighbour */
+    int *partialValid;              /* [3 * internal node + slot] */
+    int **scaleCount;               /* [3 * internal node + slot][pattern]: times the partial was scaled by SCALE_FACTOR */
+    int *stack;
+    double *sop;                    /* [pattern][cat][eigenvalue]: sum-of-products terms for one edge */
+    int *sopScale;                  /* [pattern]: scalings of the sum-of-products terms */
+    double lnL;
+    long numEvaluations;
+    long numPartials;               /* partial updates made */
+    long numAvoided;                /* partial updates a full traversal would have made in addition */
+    int record;                     /* entry in checkpoint[], or -1 */
+    double tolerance;               /* OptimizeModel() stops when a round improves lnL less than this */
+    int boundPart;                  /* part of boundLnL[] and entry in boundMinAIC[] (--bound), or -1 */
+    int numRounds;                  /* rounds of optimization made */
+    int pruned;                     /* optimization stopped by the bound */
+    int timedOut;                   /* optimization stopped by the deadline */
+    int secondStart;                /* +I+G not yet optimized from the +I end (OptimizeModel()) */
+    int holdShape;                  /* the shape is kept where it is (OptimizeRounds()) */
+    /* site-level threads, which share the patterns of each job in chunks of CHUNK_SIZE */
+    int numThreads;
+    int numChunks;
+    pthread_t *thread;
+    pthread_mutex_t lock;
+    pthread_cond_t start, finished;
+    int job, generation, nextChunk, numBusy, quit;
+    int jobNode, jobSlot;           /* JOB_PARTIAL */
+    double *jobA, *jobB;            /* JOB_SUMS: partials at both ends of the edge (jobB NULL for a tip) */
+    int jobTip;                     /* taxon at the end of the edge, or -1 */
+    double jobT;                    /* JOB_LNL: edge length */
+    double (*chunkSum)[4];          /* [chunk]: lnL, d1, d2 and scalings of the patterns in the chunk */
+} LikeSt;
+
+/* Likelihoods at the lattice points of the gamma shape visited by an OptimizeShape() */
+typedef struct {
+    int n;
+    double x[SHAPE_MEMO], f[SHAPE_MEMO];
+} ShapeMemoSt;
+
 /* Prototypes */
 static void ReadArgs(int, char**);
 static void RecognizeInputFormat();
+static void SelectModel();
+static void SelecthLRT();
+static void SelectAIC();
 static void ReadPaupScores();
 static void Initialize();
 static void ReadScores();
@@ -162,8 +594,12 @@ static void HLRTAttention(char *first, char *second, char *third, char *fourth);
 static void Output(char *selection, float value);
 static void PrintPaupBlock(int ishLRT);
 static void PrintMbBlock(int ishLRT);
+static void PrintMbLset(int applyto);
 static double LRT(ModelSt *model0, ModelSt *model1);
 static double LRTmix(ModelSt *model0, ModelSt *model1);
+static double NotTested(ModelSt *model0, ModelSt *model1);
+static double LRTProbability(ModelSt *model0, ModelSt *model1, int mixed);
+static int ScanScores(FILE *fp, float *values, int max);
 static void PrintRunSettings();
 static void ModelAveraging();
 static void AverageEstimates (int numModels, int modelIndex[], int estimateIndex[],
@@ -172,11 +608,220 @@ static double FindMinWeightToAverage ();
 static char *CheckNA (double value);
 float ChiSquare (float x, int);
 float Normalz (float);
+static float ChiSquareProbability (float x, int);
+static float NormalzProbability (float);
 float TestEqualBaseFrequencies(ModelSt *, ModelSt *);
 float TestTiequalsTv(ModelSt *, ModelSt *);
 float TestEqualTiAndEqualTvRates(ModelSt *, ModelSt *);
 float TestEqualSiteRates(ModelSt *, ModelSt *);
 float TestInvariableSites(ModelSt *, ModelSt *);
+static void PrintLikelihoodScores();
+static void NativeScores();
+static void LazyScores();
+static void SplitScores();
+static void RunPaup(int *list, int n, int run);
+static void *PaupWorker(void *arg);
+static int PaupJob(int m);
+static int PaupOutputComplete(int m, char *file);
+static void ReadModelScores(int *list, int n);
+static int NumModelScores(int m);
+static char *PaupFileName(char *name, char *suffix, int num);
+static double ProbeTest(ModelSt *model0, ModelSt *model1, int mixed);
+static int IsUnscored(int i);
+static int ProbeHierarchies();
+static void StreamScores();
+static int NumScored();
+static int NumApprox();
+static void QueueWorker();
+static void QueueReduce();
+static void WatchDirectory();
+#if defined(__linux__) && !WIN
+static char *WatchKey(char *file);
+static int WatchIndexed(char *key, int add);
+static void WatchRehash();
+static void ChildEnded(int sig);
+#endif
+#if !WIN
+static int QueueLocus(char *claimed, char *locus);
+static pid_t StartLocus(char *input, char *locus, char *dir);
+static int QueueCount(char *sub);
+static int CompareNames(const void *a, const void *b);
+#endif
+static FILE *OpenInput(FILE *fp, char *name);
+static ssize_t CompressedRead(void *cookie, char *buffer, size_t size);
+static int CompressedClose(void *cookie);
+#if !defined(__GLIBC__) && (defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__))
+static int CompressedReadBSD(void *cookie, char *buffer, int size);
+static int CompressedCloseBSD(void *cookie);
+#endif
+static void BatchScores();
+#if !WIN
+static void *BatchReader(void *arg);
+static void BatchLocus(BatchLocusSt *locus, int fd);
+static void *BatchWriter(void *arg);
+static void WriteAll(int fd, char *buffer, size_t n);
+static void BatchQueueInit(BatchQueueSt *q, int size);
+static void BatchPut(BatchQueueSt *q, BatchLocusSt *locus);
+static BatchLocusSt *BatchGet(BatchQueueSt *q);
+static void BatchClose(BatchQueueSt *q);
+#endif
+static double WallSeconds();
+static int PaupScoresComplete(int numRead);
+#if !WIN
+static void LocusResult(LocusResultSt *result);
+static int ModelNumber(char *name);
+static void StoreAppend(char *name, LocusResultSt *result);
+static int StoreColumn(int c, char *name);
+static void StoreWrite(char *file);
+#endif
+static void QueryStore();
+#if !WIN
+static void *MetricsWriter(void *arg);
+static void WriteMetrics();
+static void MetricsStage(int stage, double seconds);
+static void MetricsLocus(int error);
+#endif
+static void StartProfile();
+static void ProfileBegin(ProfileSt *snapshot);
+static void ProfileEnd(int region, ProfileSt *start, long units);
+#if !WIN
+static void ProfileChild();
+#endif
+static ProfileThreadSt *OpenProfileThread();
+static void EndProfileThread(void *arg);
+static void PrintProfile();
+#if !WIN
+static void SummaryAdd(SummarySt *s, LocusResultSt *result);
+static void SummarySave(SummarySt *s, char *file);
+#endif
+static void SummaryMerge(SummarySt *a, SummarySt *b);
+static void MergeSummaries();
+static void SummaryInit(SummarySt *s);
+static void PrintSummary(SummarySt *s);
+#if !WIN
+static void SketchAdd(SketchSt *sketch, double x);
+#endif
+static void SketchMerge(SketchSt *a, SketchSt *b);
+static double SketchQuantile(SketchSt *sketch, double q);
+#if !WIN
+static int QueryColumns(char *list, char *c);
+static int QueryColumn(char *name);
+static int QueryFindColumn(char *name);
+static void QueryCondition(char *text, QueryConditionSt *condition);
+static int QueryTest(QueryConditionSt *condition, int i);
+static double QueryValue(int c, int i);
+static void QueryPrintValue(int c, int i);
+static void QueryStats(int c, int *matched, int numMatched);
+static int CompareDoubles(const void *a, const void *b);
+#endif
+static void PrepareNative();
+static void RunModels(PartSt **list, int count, int hLRTs);
+static void PartitionedModels();
+static void ReadCharsets(char *name);
+static void AddPartition(char *name, unsigned char *inSet);
+static PartSt *NewSubset(char *name, unsigned char *inSet);
+static void FreeAlignment(AlignSt *data);
+static void SchemeSearch();
+static PartSt *CachedSubset(PartSt *p);
+static PartSt *MergedSubset(PartSt *a, PartSt *b);
+static unsigned long long SiteHash(unsigned char *inSet);
+static void ScoreSubset(PartSt *p);
+static double SchemeValue(double lnL, int K, int N);
+static AlignSt *SubsetAlignment(int *patternWeight, int numSites);
+static void PrintSiteRanges(unsigned char *inSet);
+static void PrintPartitionedMbBlock(PartSt **list, int n, int select);
+static char *ReadFileContents(char *name);
+static void ReadAlignment(char *name);
+static unsigned char StateCode(int c);
+static void AppendStates(char *text, int n, unsigned char *seq, int *len, int max, int matchchar, unsigned char *first, char *taxon, char *name);
+static void ReadNexusMatrix(char *text, char *name, int *numTaxa, int *numChars, char ***taxonNames, unsigned char ***sequences, int **lengths);
+static void ReadPhylip(char *text, char *name, int *numTaxa, int *numChars, char ***taxonNames, unsigned char ***sequences, int **lengths);
+static void ReadFasta(char *text, char *name, int *numTaxa, int *numChars, char ***taxonNames, unsigned char ***sequences, int **lengths);
+static int ComparePatterns(const void *a, const void *b);
+static void CompressPatterns(int numTaxa, int numChars, char **names, unsigned char **seq);
+static AlignSt *PackAlignment(int numTaxa, int numChars, int numPatterns, char **names, unsigned char **state, int *weight, int *sitePattern, unsigned char *constMask, double *freq);
+static size_t PackLayout(PackHeaderSt *h, size_t *offset);
+static AlignSt *AlignmentImage(char *image, size_t size);
+static int MapAlignment(char *name, long long sourceSize, unsigned long long sourceHash);
+static void WriteAlignmentImage(char *name, long long sourceSize, unsigned long long sourceHash);
+static unsigned long long HashFile(char *name);
+static void TipStates(AlignSt *data, int taxon, int start, int end, unsigned char *state);
+static void ReadTree(char *name);
+static int BuildTree(int numTips, int (*edgeNode)[2], double *edgeLength);
+static void NeighborJoiningTree();
+static double *PairwiseDistances();
+static int BitCount(unsigned long long x);
+static int CompareWeights(const void *a, const void *b);
+static int CompareNJEntries(const void *a, const void *b);
+static void SortedRow(NJEntrySt *row, int *len, double *D, int slot, int *idOf, int *liveSlot, int n);
+static void PrintNewick(FILE *fp, int node, int from);
+static void RunTasks();
+static void GetModelState(LikeSt *L, CheckpointSt *c);
+static void SetModelState(LikeSt *L, CheckpointSt *c);
+static void *ModelWorker(void *arg);
+static void ScreenModels(PartSt **list, int count);
+static void CompleteHierarchies(PartSt **list, int count);
+static void KeepNested(PartSt **list, int count);
+static void AllocateModelStates(int numTasks);
+static void DeadlinePasses(PartSt **list, int count);
+static int ModelParameters(ModelSpecSt *spec);
+static double BoundCriterion(int k, int m, double lnL);
+static int BoundExceeded(LikeSt *L);
+static double BoundLnL(int k, int m);
+static int OutsideConfidenceSet(int k, int m);
+static void BoundDone(LikeSt *L, int task);
+static void RecheckBounds(PartSt **list, int count);
+static void PrintBounds(PartSt **list, int count);
+static int IsNested(ModelSpecSt *a, ModelSpecSt *b);
+static unsigned long long HashBytes(unsigned long long hash, void *bytes, size_t n);
+static unsigned long long ResultKey(AlignSt *data);
+static char *ResultFileName(unsigned long long key);
+static int LoadResults(AlignSt *data, float *scores, unsigned char *approx);
+static void SaveResults(AlignSt *data, float *scores, unsigned char *approx);
+static void StartCheckpoints();
+static void StopCheckpoints();
+static int CheckpointRecord(unsigned long long key, int model);
+static int ResumeModel(LikeSt *L);
+static void UpdateCheckpoint(LikeSt *L, int isDone);
+static void *CheckpointWriter(void *arg);
+static void ReadCheckpoint(char *name);
+static LikeSt *AllocateLike(AlignSt *data, int numThreads);
+static void FreeLike(LikeSt *L);
+static void InitializeLike(LikeSt *L, ModelSpecSt *spec);
+static void StartParameters(LikeSt *L, double shape);
+static double OptimizeModel(LikeSt *L);
+static double OptimizeRounds(LikeSt *L);
+static void StoreScores(LikeSt *L);
+static double LnLikelihood(LikeSt *L);
+static void SetupEigen(LikeSt *L);
+static void TransitionMatrices(LikeSt *L, int e);
+static void RunJob(LikeSt *L, int job);
+static void *SiteWorker(void *arg);
+static void WorkChunks(LikeSt *L);
+static void NodePartial(LikeSt *L, int u, int k, int start, int end);
+static void SumOfProducts(LikeSt *L, int start, int end);
+static void ChunkLnL(LikeSt *L, int chunk, int start, int end);
+static double *Partial(LikeSt *L, int u, int k);
+static void InvalidatePartials(LikeSt *L, int u, int k);
+static void EdgeSumOfProducts(LikeSt *L, int u, int k);
+static double EdgeLnL(LikeSt *L, double t, double *d1, double *d2);
+static void OptimizeBranchLengths(LikeSt *L);
+static void OptimizeBranch(LikeSt *L, int u, int k);
+static void EigenSymmetric(double a[NUM_BASES][NUM_BASES], double d[NUM_BASES], double v[NUM_BASES][NUM_BASES]);
+static double GetParameter(LikeSt *L, int par);
+static void SetParameter(LikeSt *L, int par, double x);
+static double BrentOptimize(LikeSt *L, int par, double a, double b);
+static double OptimizeShape(LikeSt *L);
+static double LnLShape(LikeSt *L, double x);
+static double RefineShape(LikeSt *L);
+static double ShapePoint(LikeSt *L, ShapeMemoSt *memo, double x);
+static void ShapeRemember(ShapeMemoSt *memo, double x, double f);
+static void GammaRates(double shape, double *rates);
+static void DiscreteGamma(double shape, int K, double *rates);
+static double LnGamma(double x);
+static double IncompleteGamma(double x, double alpha, double lnGammaAlpha);
+static double PointNormal(double prob);
+static double PointChi2(double prob, double v);
 
 /* Global variables */
 ModelSt *JC, *F81;
@@ -221,6 +866,136 @@ float shape;
 float pinv;
 float theln;
 
+/* Native likelihood calculation (-s) */
+char *alignmentFile = NULL;
+char *treeFile = NULL;
+int useK80Distances = NO;       /* -k */
+char *cacheDir = NULL;          /* -r */
+int checkpointInterval = 0;     /* --checkpoint */
+int resume = NO;                /* --resume */
+char *checkpointFile = NULL;
+CheckpointSt *checkpoint = NULL;
+int numCheckpoints, maxCheckpoints, checkpointChanged, checkpointQuit;
+pthread_t checkpointThread;
+pthread_mutex_t checkpointLock = PTHREAD_MUTEX_INITIALIZER;    /* guards checkpoint[] and the flags */
+pthread_cond_t checkpointWake = PTHREAD_COND_INITIALIZER;
+double screenDelta = 0.0;       /* --screen */
+unsigned char modelApprox[NUM_MODELS];  /* models not optimized to the end (--screen, --bound, --deadline): their -lnL is not a maximum */
+double passTolerance = 0.0;     /* ModelWorker() makes a pass over the models with this tolerance (0 for none) */
+unsigned char *runTask = NULL;  /* [part * NUM_MODELS + model]: models to calculate (NULL for all) */
+CheckpointSt *modelState = NULL;   /* [task]: values of the models after the last pass (done is NA before the first) */
+int useBound = NO;              /* --bound */
+double *boundLnL;               /* [task]: lnL of the models optimized to the end (HUGE_VAL until then), NULL without a bound */
+double *boundMinAIC;            /* [part]: smallest criterion (BoundCriterion()) reached so far by any model */
+int boundScheme = NO;           /* YES while the bound is used for the subsets of the scheme search (-g) */
+int boundRecheck = NO;          /* YES while stopped models are finished (RecheckBounds()) */
+int *taskRounds;                /* [task]: rounds of optimization, negative if stopped by the bound */
+/* models in the order they are calculated with --bound and --deadline: GTR+I+G,
+   which bounds the likelihood of all others and is usually among the best, then by
+   rate heterogeneity and number of parameters */
+int modelOrder[NUM_MODELS] = {23, 3, 11, 7, 15, 19, 2, 10, 6, 14, 18, 22, 1, 9, 5, 13, 17, 21, 0, 8, 4, 12, 16, 20};
+time_t deadline = 0;            /* --deadline: time when the models are no longer optimized (0 for none) */
+int deadlinePassed = NO;
+double passTolerances[NUM_PASSES] = {100.0, 10.0, 1.0, LNL_TOLERANCE};
+int *passesDone = NULL;         /* [task]: passes completed with --deadline */
+char *paupData = NULL;          /* --lazy or --split: NEXUS data file that PAUP* is run on */
+int useLazy = NO;               /* --lazy */
+char *paupCommand = "paup -n";  /* --paup */
+int paupRetries = 2;            /* --retries */
+int paupTreeSaved = NO;
+int *paupList;                  /* models scored by RunPaup() */
+int paupCount, nextPaupJob;
+int *paupStatus;                /* [job]: SUCCESS or FAILURE */
+int lazyAIC = LAZY_AIC_SCORED;  /* --aic */
+int modelScored[NUM_MODELS];    /* models scored by PAUP* with --lazy */
+int modelWanted[NUM_MODELS];    /* models asked for by the hierarchies walked by LazyScores() */
+int numLazyScored;
+int useStream = NO;             /* --stream or --follow */
+char *followFile = NULL;        /* --follow */
+char *queueDir = NULL;          /* --queue or --reduce */
+int queueReduce = NO;           /* --reduce */
+int queueLease = QUEUE_LEASE;   /* --lease */
+char *watchDir = NULL;          /* --watch */
+int useBatch = NO;              /* --batch */
+BatchQueueSt readQueue, writeQueue; /* reader -> compute -> writer */
+int batchDone, batchFailed;
+double batchReadBusy, batchWriteBusy; /* seconds the reader and the writer were busy */
+char *storeFile = NULL;         /* --store */
+LocusResultSt *storedResult;    /* [locus]: results of the loci done, for the store */
+char **storedName;
+int numStored, maxStored;
+char *metricsFile = NULL;       /* --metrics */
+int metricsInterval = METRICS_INTERVAL; /* --metrics-interval */
+MetricsSt metrics;
+double metricsBucket[NUM_METRICS_BUCKETS] = {0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 60};
+pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER;    /* guards metrics and metricsQuit */
+pthread_cond_t metricsWake = PTHREAD_COND_INITIALIZER;
+int metricsQuit;
+int useSummary = NO;            /* --summary */
+int useProfile = NO;            /* --profile */
+int profileCounters;            /* YES if the hardware counters could be read */
+int profileError;               /* errno of the first failure to open them */
+ProfileRegionSt profile[NUM_PROFILE];
+pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;    /* guards profile[] */
+pthread_key_t profileKey;       /* ProfileThreadSt of each thread */
+char *summaryFile = NULL;       /* --summary=F */
+char *mergeFiles = NULL;        /* --merge */
+SummarySt *summary;             /* of the loci of --batch done */
+char *queryFile = NULL;         /* --query */
+char *queryWhere = NULL, *queryShow = NULL, *queryStats = NULL; /* --where, --show, --stats */
+char *storeMap;                 /* the store queried, mapped */
+StoreColumnSt *storeColumns;
+double averaged[NUM_AVERAGED];  /* model-averaged estimates of the last ModelAveraging(), NA for none */
+char *averagedName[NUM_AVERAGED] = {"piA", "piC", "piG", "piT", "TiTv", "rAC", "rAG", "rAT", "rCG", "rCT", "rGT",
+                                    "pinvI", "alphaG", "pinvIG", "alphaIG"};
+FILE *scoreInput;               /* the scorefile on the standard input, decompressed by OpenInput() */
+double inputBytesIn, inputBytesOut, inputSecs; /* compressed and decompressed bytes, and seconds decompressing */
+char **watchIndex;              /* hash table of the files done by --watch */
+int watchIndexSize, numWatchIndex;
+int childPipe[2];               /* written to when a child process ends */
+int probing = NO;               /* the Test functions give the P-values of ProbeTest() */
+int probeMissed;                /* the hierarchy walked needs a model not scored */
+AlignSt *alignment = NULL;
+TreeSt *tree = NULL;
+unsigned char **compressColumns; /* used by ComparePatterns() */
+int compressTaxa;
+long gammaCacheHits, gammaCacheMisses;
+long shapePointsReused;         /* likelihoods of OptimizeShape() not calculated again */
+long partialUpdates, partialUpdatesAvoided;
+int numThreads = 1;             /* -p */
+int modelThreads, siteThreads;
+int nextModel;
+pthread_mutex_t nativeLock = PTHREAD_MUTEX_INITIALIZER;    /* guards nextModel, the gamma cache and the counters */
+char *charsetFile = NULL;       /* -m */
+PartSt **part = NULL;           /* the charsets */
+int numParts = 0;
+PartSt **runPart;               /* partitions calculated by RunModels() */
+int numRunParts;
+int schemeCriterion = NO;       /* -g: CRITERION_AIC, CRITERION_AICC or CRITERION_BIC */
+int useBIC = NO;                /* CalculateAIC() gives the BIC instead */
+PartSt **subsetCache;           /* hash table of the subsets of the scheme search */
+int subsetCacheSize, numCachedSubsets, numSubsetsFound;
+struct {
+    long key;
+    int used;
+    double rate[NUM_GAMMA_CATS];
+} gammaCache[GAMMA_CACHE];
+
+ModelSpecSt modelSpec[NUM_MODELS] = {
+    {"JC",      1, NO,  NO,  NO,    0}, {"JC+I",    1, NO,  YES, NO,    2},
+    {"JC+G",    1, NO,  NO,  YES,   5}, {"JC+I+G",  1, NO,  YES, YES,   8},
+    {"F81",     1, YES, NO,  NO,   12}, {"F81+I",   1, YES, YES, NO,   18},
+    {"F81+G",   1, YES, NO,  YES,  25}, {"F81+I+G", 1, YES, YES, YES,  32},
+    {"K80",     2, NO,  NO,  NO,   40}, {"K80+I",   2, NO,  YES, NO,   43},
+    {"K80+G",   2, NO,  NO,  YES,  47}, {"K80+I+G", 2, NO,  YES, YES,  51},
+    {"HKY",     2, YES, NO,  NO,   56}, {"HKY+I",   2, YES, YES, NO,   63},
+    {"HKY+G",   2, YES, NO,  YES,  71}, {"HKY+I+G", 2, YES, YES, YES,  79},
+    {"SYM",     6, NO,  NO,  NO,   88}, {"SYM+I",   6, NO,  YES, NO,   96},
+    {"SYM+G",   6, NO,  NO,  YES, 105}, {"SYM+I+G", 6, NO,  YES, YES, 114},
+    {"GTR",     6, YES, NO,  NO,  124}, {"GTR+I",   6, YES, YES, NO,  136},
+    {"GTR+G",   6, YES, NO,  YES, 149}, {"GTR+I+G", 6, YES, YES, YES, 162}
+};
+
 /****************************** MAIN ***********************************/
 int main(int argc, char **argv)
 {
@@ -238,7 +1013,35 @@ int main(int argc, char **argv)
     start = clock();
     ReadArgs(argc, argv);
     file_id = isatty(fileno(stdin));
-    if (file_id) {
+    if (watchDir != NULL) {
+        WatchDirectory();
+        return 0;
+    }
+    if (queryFile != NULL) {
+        QueryStore();
+        Free();
+        return 0;
+    }
+    if (mergeFiles != NULL) {
+        MergeSummaries();
+        Free();
+        return 0;
+    }
+    if ((storeFile != NULL || useSummary == YES || metricsFile != NULL) && useBatch == NO) {
+        fprintf(stderr, "\n\n--store, --summary and --metrics are for --batch\n\n");
+        exit(1);
+    }
+    if (queueDir != NULL) {
+        if (queueReduce == YES) {
+            QueueReduce();
+        }
+        else {
+            QueueWorker();
+        }
+        Free();
+        return 0;
+    }
+    if (file_id && alignmentFile == NULL && paupData == NULL && followFile == NULL) {
         fprintf(stderr, "\n\nNo input file\n\n");
         PrintUsage();
         if (WIN == 1) {
@@ -246,10 +1049,78 @@ int main(int argc, char **argv)
         }
         exit(1);
     }
+    if (schemeCriterion != NO && charsetFile == NULL) {
+        fprintf(stderr, "\n\nThe search for a partition scheme (-g) needs charsets (-m)\n\n");
+        exit(1);
+    }
+    if (useBatch == YES && (alignmentFile != NULL || paupData != NULL || useStream == YES)) {
+        fprintf(stderr, "\n\n--batch reads PAUP* scorefiles and cannot be combined with -s, --lazy, --split or --stream\n\n");
+        exit(1);
+    }
+    if (paupData != NULL && (alignmentFile != NULL || charsetFile != NULL)) {
+        fprintf(stderr, "\n\n--lazy and --split run PAUP* for the scores and cannot be combined with -s or -m\n\n");
+        exit(1);
+    }
+    if (useProfile == YES) {
+        StartProfile();
+    }
     PrintTitle(stdout);
     PrintDate(stdout);
-    RecognizeInputFormat();
-    PrintRunSettings();
+    if (charsetFile != NULL) {
+        PartitionedModels();
+    }
+    else if (useStream == YES) {
+        StreamScores();
+    }
+    else if (useBatch == YES) {
+        BatchScores();
+    }
+    else {
+        if (useLazy == YES) {
+            LazyScores();
+        }
+        else if (paupData != NULL) {
+            SplitScores();
+        }
+        else if (alignmentFile != NULL) {
+            NativeScores();
+        }
+        else {
+            RecognizeInputFormat();
+        }
+        PrintRunSettings();
+        SelectModel();
+    }
+    StopCheckpoints();
+    if (useProfile == YES && useBatch == NO) {
+        PrintProfile();
+    }
+    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    Free();
+    printf("\n\n_________________________________________________________________________");
+    printf("\nTime processing: %G seconds", secs);
+    if (inputBytesOut > 0) {
+        printf("\nDecompressed input: %.2f MB from %.2f MB in %G seconds (%.1f MB/s)", inputBytesOut / 1e6, inputBytesIn / 1e6,
+            inputSecs, (inputSecs > 0) ? inputBytesOut / 1e6 / inputSecs : 0.0);
+    }
+    printf("\nIf you need help type '-?' or '-h' in the command line of the program");
+    fprintf(stderr, "\nProgram is done.\n\n");
+
+    return 0;
+}
+
+/******************** SelectModel **************************/
+/* Selects the model by hLRT and AIC from the scores in model[] and prints the results */
+static void SelectModel()
+{
+    SelecthLRT();
+    SelectAIC();
+}
+
+/******************** SelecthLRT **************************/
+static void SelecthLRT()
+{
+    int i;
 
     /* Do hLRTs */
     printf("\n\n\n\n---------------------------------------------------------------");
@@ -257,18 +1128,27 @@ int main(int argc, char **argv)
     printf("\n*         HIERARCHICAL LIKELIHOOD RATIO TESTS (hLRTs)         *");
     printf("\n*                                                             *");
     printf("\n---------------------------------------------------------------\n");
+    if (deadlinePassed == YES) {
+        printf("\n The run was cut short by the deadline (--deadline): ");
+        if (NumApprox() > 0) {
+            printf("the tests of the %d models that did not converge are left out\n", NumApprox());
+        }
+        else {
+            printf("no model converged, the models are selected from their scores as they are\n");
+        }
+    }
 
     if (usehLRT4 == YES) {
         hLRT4();
-        modelhLRT = modelhLRT4;
+        strcpy(modelhLRT, modelhLRT4);
     }
     else if (usehLRT3 == YES) {
         hLRT3();
-        modelhLRT = modelhLRT3;
+        strcpy(modelhLRT, modelhLRT3);
     }
     else if (usehLRT2 == YES) {
         hLRT2();
-        modelhLRT = modelhLRT2;
+        strcpy(modelhLRT, modelhLRT2);
     }
     else {
         hLRT();
@@ -279,11 +1159,16 @@ int main(int argc, char **argv)
         printf("\n\n\n ** Hierarchical Likelihood Ratio Tests (using hLRT4) **\n");
         hLRT4();
     }
+    for (i = 0; i < NUM_MODELS && deadlinePassed == YES; i++) {
+        if (!strcmp(model[i].name, modelhLRT) && IsUnscored(i)) {
+            printf("\n\nWARNING: %s did not converge before the deadline, so the hLRTs are not conclusive", modelhLRT);
+        }
+    }
 
     SetModel(modelhLRT);
 
     if (format == 0) {
-        if (shape > 999) { /* alpha shape = infinity */
+        if (shape >= SHAPE_INFINITY) { /* alpha shape = infinity */
             printf("\n\nWARNING: Although the model %s was initially selected, gamma (G) was removed ", modelhLRT);
             printf("because the estimated shape equals infinity, which implies equal rates among sites.");
             /* removing +G */
@@ -317,8 +1202,16 @@ int main(int argc, char **argv)
             printf("\n hLRT4 model = %s", modelhLRT4);
         }
     }
+}
 
+/******************** SelectAIC **************************/
+static void SelectAIC()
+{
     /* Do AIC */
+    if (useLazy == YES && lazyAIC == LAZY_AIC_NONE) {
+        printf("\n\n\n AIC not calculated (--aic=none)");
+        return;
+    }
     if (useAICc == YES) {
         printf("\n\n\n\n\n---------------------------------------------------------------");
         printf("\n*                                                             *");
@@ -333,6 +1226,12 @@ int main(int argc, char **argv)
         printf("\n*                                                             *");
         printf("\n---------------------------------------------------------------\n");
     }
+    if (useLazy == YES && numLazyScored < NUM_MODELS) {
+        printf("\n Only the %d models scored for the hLRTs are compared (--aic=scored)\n", numLazyScored);
+    }
+    if (NumApprox() > 0) {
+        printf("\n The %d models not optimized to the end (--screen, --bound, --deadline) are not compared\n", NumApprox());
+    }
     CalculateAIC();
     SetModel(modelAIC);
     if (format == 0) {
@@ -348,14 +1247,6 @@ int main(int argc, char **argv)
     }
     AkaikeWeights();
     ModelAveraging();
-    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
-    Free();
-    printf("\n\n_________________________________________________________________________");
-    printf("\nTime processing: %G seconds", secs);
-    printf("\nIf you need help type '-?' or '-h' in the command line of the program");
-    fprintf(stderr, "\nProgram is done.\n\n");
-
-    return 0;
 }
 
 /******************** PrintRunSettings **************************/
@@ -411,7 +1302,7 @@ static void PrintRunSettings()
 static void ReadArgs(int argc, char **argv)
 {
     int i;
-    char flag;
+    char flag, *t;
 
     for (i = 1; i < argc; i++) {
         argv[i]++;
@@ -434,6 +1325,148 @@ static void ReadArgs(int argc, char **argv)
             numTaxa = atoi(argv[i]);
             numBL = 2 * numTaxa - 3;
             break;
+        case 'k':
+            useK80Distances = YES;
+            break;
+        case 'm':
+            charsetFile = argv[i];
+            break;
+        case 'r':
+            cacheDir = argv[i];
+            break;
+        case '-':
+            if (!strcmp(argv[i], "resume")) {
+                resume = YES;
+            }
+            else if (!strcmp(argv[i], "checkpoint")) {
+                checkpointInterval = CHECKPOINT_INTERVAL;
+            }
+            else if (!strncmp(argv[i], "checkpoint=", 11)) {
+                checkpointInterval = atoi(argv[i] + 11);
+            }
+            else if (!strncmp(argv[i], "deadline=", 9)) {
+                deadline = time(NULL) + atoi(argv[i] + 9);
+            }
+            else if (!strncmp(argv[i], "lazy=", 5)) {
+                paupData = argv[i] + 5;
+                useLazy = YES;
+            }
+            else if (!strncmp(argv[i], "split=", 6)) {
+                paupData = argv[i] + 6;
+                useLazy = NO;
+            }
+            else if (!strncmp(argv[i], "queue=", 6)) {
+                queueDir = argv[i] + 6;
+            }
+            else if (!strncmp(argv[i], "reduce=", 7)) {
+                queueDir = argv[i] + 7;
+                queueReduce = YES;
+            }
+            else if (!strcmp(argv[i], "batch")) {
+                useBatch = YES;
+            }
+            else if (!strncmp(argv[i], "store=", 6)) {
+                storeFile = argv[i] + 6;
+            }
+            else if (!strncmp(argv[i], "metrics=", 8)) {
+                metricsFile = argv[i] + 8;
+            }
+            else if (!strncmp(argv[i], "metrics-interval=", 17)) {
+                metricsInterval = MAX(1, atoi(argv[i] + 17));
+            }
+            else if (!strcmp(argv[i], "profile")) {
+                useProfile = YES;
+            }
+            else if (!strcmp(argv[i], "summary")) {
+                useSummary = YES;
+            }
+            else if (!strncmp(argv[i], "summary=", 8)) {
+                useSummary = YES;
+                summaryFile = argv[i] + 8;
+            }
+            else if (!strncmp(argv[i], "merge=", 6)) {
+                mergeFiles = argv[i] + 6;
+            }
+            else if (!strncmp(argv[i], "query=", 6)) {
+                queryFile = argv[i] + 6;
+            }
+            else if (!strncmp(argv[i], "where=", 6)) {
+                queryWhere = argv[i] + 6;
+            }
+            else if (!strncmp(argv[i], "show=", 5)) {
+                queryShow = argv[i] + 5;
+            }
+            else if (!strncmp(argv[i], "stats=", 6)) {
+                queryStats = argv[i] + 6;
+            }
+            else if (!strncmp(argv[i], "watch=", 6)) {
+                watchDir = argv[i] + 6;
+            }
+            else if (!strncmp(argv[i], "lease=", 6)) {
+                queueLease = MAX(1, atoi(argv[i] + 6));
+            }
+            else if (!strcmp(argv[i], "stream")) {
+                useStream = YES;
+            }
+            else if (!strncmp(argv[i], "follow=", 7)) {
+                followFile = argv[i] + 7;
+                useStream = YES;
+            }
+            else if (!strncmp(argv[i], "retries=", 8)) {
+                paupRetries = MAX(0, atoi(argv[i] + 8));
+            }
+            else if (!strncmp(argv[i], "paup=", 5)) {
+                paupCommand = argv[i] + 5;
+            }
+            else if (!strncmp(argv[i], "aic=", 4)) {
+                if (!strcmp(argv[i] + 4, "none")) {
+                    lazyAIC = LAZY_AIC_NONE;
+                }
+                else if (!strcmp(argv[i] + 4, "scored")) {
+                    lazyAIC = LAZY_AIC_SCORED;
+                }
+                else if (!strcmp(argv[i] + 4, "all")) {
+                    lazyAIC = LAZY_AIC_ALL;
+                }
+                else {
+                    fprintf(stderr, "Unknown value for --aic: %s (use none, scored or all)\n", argv[i] + 4);
+                    exit(1);
+                }
+            }
+            else if (!strcmp(argv[i], "bound")) {
+                useBound = YES;
+            }
+            else if (!strncmp(argv[i], "screen=", 7)) {
+                screenDelta = atof(argv[i] + 7);
+                if (screenDelta <= 0) {
+                    fprintf(stderr, "\nError: the AIC difference of --screen must be > 0\n");
+                    exit(1);
+                }
+            }
+            else {
+                fprintf(stderr, "Unknown argument on the command line '--%s'\n", argv[i]);
+                PrintUsage();
+                exit(1);
+            }
+            break;
+        case 'g':
+            for (t = argv[i]; *t != '\0'; t++) {
+                *t = toupper((unsigned char)*t);
+            }
+            if (*argv[i] == '\0' || !strcmp(argv[i], "AIC")) {
+                schemeCriterion = CRITERION_AIC;
+            }
+            else if (!strcmp(argv[i], "AICC")) {
+                schemeCriterion = CRITERION_AICC;
+            }
+            else if (!strcmp(argv[i], "BIC")) {
+                schemeCriterion = CRITERION_BIC;
+            }
+            else {
+                fprintf(stderr, "Unknown criterion for -g: %s (use aic, aicc or bic)\n", argv[i]);
+                exit(1);
+            }
+            break;
         case 'l':
             printf("\n LRT CALCULATOR MODE \n");
             RatioCalc();
@@ -462,6 +1495,15 @@ static void ReadArgs(int argc, char **argv)
         case '4':
             usehLRT4 = YES;
             break;
+        case 'p':
+            numThreads = MAX(1, atoi(argv[i]));
+            break;
+        case 's':
+            alignmentFile = argv[i];
+            break;
+        case 'u':
+            treeFile = argv[i];
+            break;
         case 'v':
             fprintf(stderr, "%s version %s\n", PROGRAM_NAME, VERSION_NUMBER);
             exit(1);
@@ -494,15 +1536,16 @@ static void RecognizeInputFormat()
         fprintf(stderr, "Error opening the input file");
         exit(0);
     }
-    iochar = getc(stdin);
+    scoreInput = OpenInput(stdin, "the standard input");
+    iochar = getc(scoreInput);
     if (iochar == (int)'T') {   /* In the Paup matrix, in the first line there is the word 'Tree'*/
-        ungetc(iochar, stdin);
+        ungetc(iochar, scoreInput);
         printf("\nInput format: Paup matrix file \n");
         format = 0;
         ReadPaupScores();
     }
     else {
-        ungetc(iochar, stdin);
+        ungetc(iochar, scoreInput);
         printf("\nInput format: raw log likelihood scores \n");
         format = 1;
         ReadScores();
@@ -511,63 +1554,87 @@ static void RecognizeInputFormat()
 
 /***************************** ReadPaupScores ********************************/
 static void ReadPaupScores()
+{
+    int i;
+
+    i = ScanScores(scoreInput, score, 176);
+    if (ferror(scoreInput)) {
+        perror ("MrModeltest2");
+        clearerr(scoreInput);
+    }
+    Initialize();
+    if(print_scores == YES) {
+        PrintLikelihoodScores();
+    }
+    if (PaupScoresComplete(i) == NO) {
+        printf("\n\nError: The input file is incomplete or incorrect.\nAre you using the most updated block of PAUP* commands?");
+        printf("\nThis version of MrModeltest2 is not compatible with versions of PAUP* older than v.4.0a155.");
+        printf("\nPlease check the MrModeltest2 and PAUP* web pages.");
+        exit(0);
+    }
+}
+
+/***************************** PaupScoresComplete ********************************/
+/* YES if numRead values were read from a scorefile and every model has a score */
+static int PaupScoresComplete(int numRead)
+{
+    int j;
+
+    for (j = 0; j < NUM_MODELS; j++) {
+        if (model[j].ln == 0 || numRead < NUM_SCORES) {
+            return NO;
+        }
+    }
+
+    return YES;
+}
+
+/***************************** ScanScores ********************************/
+/* Reads the numbers of a PAUP* scorefile into values[] (at most max), skipping
+   the words of the headers, and returns how many were read */
+static int ScanScores(FILE *fp, float *values, int max)
 {
     int iochar;
-    int i, j, k;
+    int i;
     char string [120];
     i = 0;
 
-    while (!feof(stdin)) {
-        iochar = getc(stdin);
+    while (!feof(fp)) {
+        iochar = getc(fp);
         if (isdigit(iochar)) {
-            ungetc(iochar, stdin);
-            if (scanf("%f", &score[i]) != 1) {
+            ungetc(iochar, fp);
+            if (i == max) {
+                fprintf (stderr, "\nError: more than %d values in the scorefile", max);
+                exit (1);
+            }
+            if (fscanf(fp, "%f", &values[i]) != 1) {
                 fprintf (stderr, "\nError: could not read value using scanf()");
                 exit (1);
             }
             if (DEBUGLEVEL >= 2) {
-                fprintf(stdout, "\nINFO:   Storing %f in score[%d]", score[i], i);
+                fprintf(stdout, "\nINFO:   Storing %f in score[%d]", values[i], i);
             }
             i++;
         }
         if (isalpha (iochar)) {
-            ungetc(iochar, stdin);
-            if (scanf("%s", string) != 1) {
+            ungetc(iochar, fp);
+            if (fscanf(fp, "%119s", string) != 1) {
                 fprintf (stderr, "\nError: could not read value using scanf()");
                 exit (1);
             }
             if (DEBUGLEVEL >= 2) {
                 fprintf(stdout, "\nINFO:   Reading string %s", string);
             }
-            if (strcmp(string, "infinity") == 0) {
-                score[i] = 999.999;
+            if (strcmp(string, "infinity") == 0 && i < max) {
+                values[i] = SHAPE_INFINITY;
                 if (DEBUGLEVEL >= 2)
-                fprintf(stdout, "\nINFO:   Storing %f in score[%d]", score[i], i);
+                fprintf(stdout, "\nINFO:   Storing %f in score[%d]", values[i], i);
                 i++;
             }
         }
     }
-    if (ferror(stdin)) {
-        perror ("MrModeltest2");
-        clearerr(stdin);
-    }
-    Initialize();
-    if(print_scores == YES) {
-        printf("\n\n** Log Likelihood scores **");
-        printf("\n%-12.12s\t\t\t+I\t\t+G\t\t+I+G", " ");
-        for(k = 0; k < NUM_MODELS; k += 4) {
-            printf("\n%-10.10s =\t%9.4f\t%9.4f\t%9.4f\t%9.4f", model[k].name, model[k].ln, model[k+1].ln, model[k+2].ln, model[k+3].ln);
-        }
-        printf("\n\n");
-    }
-    for (j = 0; j < NUM_MODELS; j++) {
-        if (model[j].ln == 0 || i < NUM_SCORES) {
-            printf("\n\nError: The input file is incomplete or incorrect.\nAre you using the most updated block of PAUP* commands?");
-            printf("\nThis version of MrModeltest2 is not compatible with versions of PAUP* older than v.4.0a155.");
-            printf("\nPlease check the MrModeltest2 and PAUP* web pages.");
-            exit(0);
-        }
-     }
+
+    return i;
 }
 
 /************** Initialize. **********************/
@@ -689,8 +1756,8 @@ static void ReadScores()
     i = 0;
 
     score[NUM_MODELS-1] = 0;
-    while (!feof(stdin)) {
-        if (scanf("%f", &score[i]) != 1) {
+    while (!feof(scoreInput)) {
+        if (fscanf(scoreInput, "%f", &score[i]) != 1) {
             fprintf (stderr, "\nError: could not read value using scanf()");
             exit (1);
         }
@@ -717,14 +1784,12 @@ static double LRT(ModelSt *model0, ModelSt *model1)
     double prob;
     int df;
 
+    if (IsUnscored(model0 - model) || IsUnscored(model1 - model)) {
+        return NotTested(model0, model1);
+    }
     delta = 2 * (model0->ln - model1->ln);
     df = model1->parameters - model0->parameters;
-    if (delta == 0) {
-        prob = 1.0;
-    }
-    else {
-        prob = ChiSquare(delta, df);
-    }
+    prob = LRTProbability(model0, model1, NO);
     printf("\n   Null model = %-9.9s\t\t  -lnL0 = %.4f", model0->name, model0->ln);
     printf("\n   Alternative model = %-9.9s\t  -lnL1 = %.4f", model1->name, model1->ln);
     printf("\n   2(lnL1-lnL0) = %9.4f\t\t      df = %d ", delta, df);
@@ -748,19 +1813,12 @@ static double LRTmix(ModelSt *model0, ModelSt *model1)
     double delta, prob;
     int df;
 
+    if (IsUnscored(model0 - model) || IsUnscored(model1 - model)) {
+        return NotTested(model0, model1);
+    }
     delta = 2 * (model0->ln - model1->ln);
     df = model1->parameters - model0->parameters;
-    if (delta == 0) {
-        prob = 1.0;
-    }
-    else {
-        if (df == 1) {
-            prob = ChiSquare(delta, df)/2;
-        }
-        else {
-            prob = (ChiSquare(delta, df-1) + ChiSquare(delta, df)) / 2;
-        }
-    }
+    prob = LRTProbability(model0, model1, YES);
     printf("\n   Null model = %-9.9s\t\t  -lnL0 = %.4f", model0->name, model0->ln);
     printf("\n   Alternative model = %-9.9s\t  -lnL1 = %.4f", model1->name, model1->ln);
     printf("\n   2(lnL1-lnL0) = %9.4f\t\t      df = %d ", delta, df);
@@ -778,11 +1836,52 @@ static double LRTmix(ModelSt *model0, ModelSt *model1)
     return prob;
 }
 
+/******************* NotTested ******************************/
+/* A likelihood ratio test left out, as a model of it was not optimized to the
+   end (modelApprox[]): the alternative model is taken (P-value 0) if only the
+   null model was not, otherwise the null model is kept (P-value 1) */
+static double NotTested(ModelSt *model0, ModelSt *model1)
+{
+    int keepNull;
+
+    keepNull = (IsUnscored(model0 - model) && !IsUnscored(model1 - model)) ? NO : YES;
+    printf("\n   Null model = %-9.9s\t\t  -lnL0 = %.4f%s", model0->name, model0->ln, (IsUnscored(model0 - model)) ? "*" : "");
+    printf("\n   Alternative model = %-9.9s\t  -lnL1 = %.4f%s", model1->name, model1->ln, (IsUnscored(model1 - model)) ? "*" : "");
+    printf("\n   Not tested (* not optimized to the end): %s kept", (keepNull == YES) ? model0->name : model1->name);
+
+    return (keepNull == YES) ? 1.0 : 0.0;
+}
+
+/******************* LRTProbability ******************************/
+/* P-value of the likelihood ratio test, with the mixed chi2 if mixed */
+static double LRTProbability(ModelSt *model0, ModelSt *model1, int mixed)
+{
+    double delta;
+    int df;
+
+    delta = 2 * (model0->ln - model1->ln);
+    df = model1->parameters - model0->parameters;
+    if (delta == 0) {
+        return 1.0;
+    }
+    if (mixed == NO) {
+        return ChiSquare(delta, df);
+    }
+    if (df == 1) {
+        return ChiSquare(delta, df)/2;
+    }
+
+    return (ChiSquare(delta, df-1) + ChiSquare(delta, df)) / 2;
+}
+
 /******************* TestEqualBaseFrequencies ****************/
 float TestEqualBaseFrequencies(ModelSt *model0, ModelSt *model1)
 {
     float P;
 
+    if (probing == YES) {
+        return ProbeTest(model0, model1, NO);
+    }
     printf("\n Equal base frequencies");
     P = LRT(model0, model1);
 
@@ -794,6 +1893,9 @@ float TestTiequalsTv(ModelSt *model0, ModelSt *model1)
 {
     float P;
 
+    if (probing == YES) {
+        return ProbeTest(model0, model1, NO);
+    }
     printf("\n Ti=Tv");
     P = LRT(model0, model1);
 
@@ -805,6 +1907,9 @@ float TestEqualTiAndEqualTvRates (ModelSt *model0, ModelSt *model1)
 {
     float P;
 
+    if (probing == YES) {
+        return ProbeTest(model0, model1, NO);
+    }
     printf("\n Unequal Tv and unequal Ti");
     P = LRT(model0, model1);
 
@@ -816,6 +1921,9 @@ float TestEqualSiteRates (ModelSt *model0, ModelSt *model1)
 {
     float P;
 
+    if (probing == YES) {
+        return ProbeTest(model0, model1, mixchi);
+    }
     printf("\n Equal rates among sites");
     if (mixchi) {
         P = LRTmix(model0, model1);
@@ -832,6 +1940,9 @@ float TestInvariableSites (ModelSt *model0, ModelSt *model1)
 {
     float P;
 
+    if (probing == YES) {
+        return ProbeTest(model0, model1, mixchi);
+    }
     printf("\n No Invariable sites");
     if (mixchi) {
         P = LRTmix(model0, model1);
@@ -849,7 +1960,22 @@ ALGORITHM Compute probability of chi square value.
 Adapted from:     Hill, I. D. and Pike, M. C.  Algorithm 299.Collected Algorithms for the CACM 1967 p. 243
 Updated for rounding errors based on remark inACM TOMS June 1985, page 185. Found in Perlman.lib
 */
-float ChiSquare (float x, int df)  /* x: obtained chi-square value,  df: degrees of freedom */
+float ChiSquare (float x, int df)
+{
+    ProfileSt snapshot;
+    float p;
+
+    if (useProfile == NO) {
+        return ChiSquareProbability(x, df);
+    }
+    ProfileBegin(&snapshot);
+    p = ChiSquareProbability(x, df);
+    ProfileEnd(PROFILE_CHISQUARE, &snapshot, 1);
+
+    return p;
+}
+
+static float ChiSquareProbability (float x, int df)  /* x: obtained chi-square value,  df: degrees of freedom */
 {
     float a, y, s;
     float e, c, z;
@@ -903,7 +2029,22 @@ ALGORITHM:    Adapted from a polynomial approximation in:
             This routine has six digit accuracy, so it is only useful for absolute
             z values < 6.  For z values >= to 6.0, Normalz() returns 0.0.
 */
-float Normalz (float z)        /*VAR returns cumulative probability from -oo to z VAR normal z value */
+float Normalz (float z)
+{
+    ProfileSt snapshot;
+    float p;
+
+    if (useProfile == NO) {
+        return NormalzProbability(z);
+    }
+    ProfileBegin(&snapshot);
+    p = NormalzProbability(z);
+    ProfileEnd(PROFILE_NORMALZ, &snapshot, 1);
+
+    return p;
+}
+
+static float NormalzProbability (float z)        /*VAR returns cumulative probability from -oo to z VAR normal z value */
 {
     float y, x, w;
 
@@ -1012,11 +2153,18 @@ void CalculateAIC()
 
     n = sampleSize;
     for (i = 0; i < NUM_MODELS; i++) {
+        if (IsUnscored(i)) {
+            AIC[i] = BIGNUMBER;
+            continue;
+        }
         K = model[i].parameters;
         AIC[i] =  2 * (model[i].ln  +  K);
         if (useAICc == YES) {
             AIC[i] += 2*K*(K+1) / (double) (n-K-1);
         }
+        if (useBIC == YES) {
+            AIC[i] = 2 * model[i].ln + K * log((double) n);
+        }
     }
     smallerAIC = AIC[0];
     for (i = 1; i < NUM_MODELS; i++) {
@@ -1042,7 +2190,11 @@ void AkaikeWeights ()
     float ord[NUM_MODELS];
     float sumExp, temp;
     float cumWeight;
+    ProfileSt snapshot;
 
+    if (useProfile == YES) {
+        ProfileBegin(&snapshot);
+    }
     sumExp = 0;
     for (i = 0; i < NUM_MODELS; i++) {
         deltaAIC[i] = AIC[i] - minAIC;
@@ -1053,6 +2205,9 @@ void AkaikeWeights ()
         ord[i] = AIC[i];
         orderedAIC[i] = i;
     }
+    if (useProfile == YES) {
+        ProfileEnd(PROFILE_AKAIKE, &snapshot, NUM_MODELS);
+    }
     /* Sort by AIC score to print weights in order*/
     sorted = NO;
     pass = 1;
@@ -1082,6 +2237,9 @@ void AkaikeWeights ()
     cumWeight = 0;
     for (i = 0; i < NUM_MODELS; i++) {
         j = orderedAIC[i];
+        if (IsUnscored(j)) {
+            continue;
+        }
         cumWeight += wAIC[j];
         if (wAIC[j] > 0.0001) {
             printf("\n%-10s\t%10.4f\t%2d\t%10.4f\t%9.4f\t%8.4f\t%7.4f", model[j].name, model[j].ln, model[j].parameters, AIC[j], deltaAIC[j], wAIC[j], cumWeight);
@@ -1179,10 +2337,19 @@ void ModelAveraging()
     AverageEstimates (6, malphaG, ealphaG, &ialphaG, &walphaG, minWeightToAverage); /*alpha(G)*/
     AverageEstimates (12, mpinvIG, epinvIG, &ipinvIG, &wpinvIG, minWeightToAverage); /*pinv(IG)*/
     AverageEstimates (12, malphaIG, ealphaIG, &ialphaIG, &walphaIG, minWeightToAverage); /*alpha(IG)*/
+    averaged[0] = wpiA; averaged[1] = wpiC; averaged[2] = wpiG; averaged[3] = wpiT; averaged[4] = wtitv;
+    averaged[5] = wrAC; averaged[6] = wrAG; averaged[7] = wrAT; averaged[8] = wrCG; averaged[9] = wrCT; averaged[10] = wrGT;
+    averaged[11] = wpinvI; averaged[12] = walphaG; averaged[13] = wpinvIG; averaged[14] = walphaIG;
 
     /* print results */
     printf ("\n\n\n\n* MODEL AVERAGING AND PARAMETER IMPORTANCE (using Akaike Weights)");
-    if (averagingConfidenceInterval == 1) {
+    if (averagingConfidenceInterval == 1 && useLazy == YES && numLazyScored < NUM_MODELS) {
+        fprintf (stdout, "\n  Including the %d models scored", numLazyScored);
+    }
+    else if (averagingConfidenceInterval == 1 && NumApprox() > 0) {
+        fprintf (stdout, "\n  Including the %d models optimized to the end", NUM_MODELS - NumApprox());
+    }
+    else if (averagingConfidenceInterval == 1) {
         fprintf (stdout, "\n  Including all %d models", NUM_MODELS);
     }
     else {
@@ -1418,7 +2585,7 @@ static void PrintPaupBlock (int ishLRT)
     }
     /* Rate variation */
     printf("  Rates=");
-    if (shape == 0 || shape > 999) {
+    if (shape == 0 || shape >= SHAPE_INFINITY) {
         printf("equal");
     }
     else {
@@ -1458,7 +2625,20 @@ static void PrintMbBlock (int ishLRT)
         printf("\n[!\nMrBayes settings for the best-fit model (%s) selected by AICc in %s %s\n]", modelAIC, PROGRAM_NAME, VERSION_NUMBER);
     }
     printf("\nBEGIN MRBAYES;\n");
+    PrintMbLset(0);
+    printf("\nEND;");
+    printf("\n\n--");
+}
+
+/********************* PrintMbLset ************************/
+/* Prints the Lset and Prset commands for the selected model, for partition
+   applyto or for all the data if applyto is 0 */
+static void PrintMbLset(int applyto)
+{
     printf("\n\tLset");
+    if (applyto > 0) {
+        printf(" applyto=(%d)", applyto);
+    }
     /* Substitution rates */
     if (rAC == rAG && rAC == rAT && rAC == rCG && rAC == rCT && rAC == rGT && TiTv == 0) {
         printf("  nst=1");
@@ -1472,14 +2652,14 @@ static void PrintMbBlock (int ishLRT)
     /* Rate variation */
     printf("  rates=");
     if (pinv == 0) {
-        if (shape == 0 || shape > 999) {
+        if (shape == 0 || shape >= SHAPE_INFINITY) {
             printf("equal");
         }
         else {
             printf("gamma");
         }
     }
-    else if (shape == 0 || shape > 999) {
+    else if (shape == 0 || shape >= SHAPE_INFINITY) {
         printf("propinv");
     }
     else {
@@ -1487,14 +2667,16 @@ static void PrintMbBlock (int ishLRT)
     }
     printf(";\n");
     /* Base frequencies */
+    printf("\tPrset");
+    if (applyto > 0) {
+        printf(" applyto=(%d)", applyto);
+    }
     if (piA == piC && piA == piG && piA == piT) {
-        printf("\tPrset statefreqpr=fixed(equal);");
+        printf(" statefreqpr=fixed(equal);");
     }
     else {
-        printf("\tPrset statefreqpr=dirichlet(1,1,1,1);");
+        printf(" statefreqpr=dirichlet(1,1,1,1);");
     }
-    printf("\nEND;");
-    printf("\n\n--");
 }
 
 /********************* HLRTAttention ************************/
@@ -1573,7 +2755,7 @@ static void Output(char *selection, float value)
     if (shape == 0) {
         printf("\n     Equal rates for all sites");
     }
-    else if (shape > 999) { /* shape is infinity */
+    else if (shape >= SHAPE_INFINITY) { /* shape is infinity */
         printf("\n     Equal rates for all sites (shape parameter = infinity)");
     }
     else {
@@ -2256,6 +3438,7366 @@ void hLRT4()
 }
 
 
+/********************* PrintLikelihoodScores **********************/
+static void PrintLikelihoodScores()
+{
+    int i, k;
+
+    printf("\n\n** Log Likelihood scores **");
+    printf("\n%-12.12s\t\t\t+I\t\t+G\t\t+I+G", " ");
+    for(k = 0; k < NUM_MODELS; k += 4) {
+        printf("\n%-10.10s =", model[k].name);
+        for (i = k; i < k + 4; i++) {
+            if (modelApprox[i] == YES) {
+                printf("\t%9.4f*", model[i].ln);
+            }
+            else if (IsUnscored(i)) {
+                printf("\t%9s", "-");
+            }
+            else {
+                printf("\t%9.4f", model[i].ln);
+            }
+        }
+    }
+    if (NumApprox() > 0) {
+        printf("\n* not optimized to the end (--screen, --bound, --deadline): not a maximum likelihood score");
+    }
+    printf("\n\n");
+}
+
+/************************* LazyScores ****************************/
+/* Scores the models with PAUP* only as the hLRTs need them (--lazy). The
+   hierarchies are walked without output; the first test of each that has a
+   model not yet scored is given to PAUP*, and the walk is repeated with the new
+   scores until every hierarchy has selected a model. */
+static void LazyScores()
+{
+    int i, n, numRuns, list[NUM_MODELS];
+    char name[FILENAME_MAX];
+
+    printf("\nInput format: likelihood scores calculated by PAUP* as the hLRTs need them");
+    printf("\n Data file: %s", paupData);
+    printf("\n Command: %s\n", paupCommand);
+    for (i = 0; i < NUM_MODELS; i++) {
+        modelScored[i] = NO;
+    }
+    Initialize();
+    numRuns = 0;
+    while (1) {
+        if (ProbeHierarchies() == 0) {
+            break;
+        }
+        for (i = n = 0; i < NUM_MODELS; i++) {
+            if (modelWanted[i] == YES) {
+                list[n++] = i;
+            }
+        }
+        RunPaup(list, n, ++numRuns);
+        ReadModelScores(list, n);
+    }
+    if (lazyAIC == LAZY_AIC_ALL) {
+        for (i = n = 0; i < NUM_MODELS; i++) {
+            if (modelScored[i] == NO) {
+                list[n++] = i;
+            }
+        }
+        if (n > 0) {
+            RunPaup(list, n, ++numRuns);
+            ReadModelScores(list, n);
+        }
+    }
+    for (i = numLazyScored = 0; i < NUM_MODELS; i++) {
+        numLazyScored += modelScored[i];
+    }
+    printf("\n %d of the %d models scored in %d runs of PAUP*\n", numLazyScored, NUM_MODELS, numRuns);
+    remove(PaupFileName(name, ".tre", -1));
+    format = 0;
+    if (print_scores == YES) {
+        PrintLikelihoodScores();
+    }
+}
+
+/************************* SplitScores ****************************/
+/* Scores the 24 models with PAUP* (--split), each in a process of its own and
+   -p processes at a time. The scorefiles are put together in the order of
+   MrModelblock and read as the output of MrModelblock. */
+static void SplitScores()
+{
+    FILE *fp, *out;
+    int i, c, list[NUM_MODELS];
+    char name[FILENAME_MAX];
+
+    printf("\nInput format: likelihood scores calculated by PAUP* in %d processes at a time", MIN(numThreads, NUM_MODELS));
+    printf("\n Data file: %s", paupData);
+    printf("\n Command: %s\n", paupCommand);
+    for (i = 0; i < NUM_MODELS; i++) {
+        list[i] = i;
+    }
+    RunPaup(list, NUM_MODELS, 1);
+
+    PaupFileName(name, ".scores", -1);
+    if ((out = fopen(name, "w")) == NULL) {
+        fprintf(stderr, "\nError: could not write the scores to %s\n", name);
+        exit(1);
+    }
+    for (i = 0; i < NUM_MODELS; i++) {
+        if ((fp = fopen(PaupFileName(name, ".scores", i), "r")) == NULL) {
+            fprintf(stderr, "\nError: could not read %s\n", name);
+            exit(1);
+        }
+        while ((c = getc(fp)) != EOF) {
+            putc(c, out);
+        }
+        fclose(fp);
+        remove(name);
+    }
+    fclose(out);
+    remove(PaupFileName(name, ".tre", -1));
+
+    printf("\n Scores of the %d models in %s\n", NUM_MODELS, PaupFileName(name, ".scores", -1));
+    if ((fp = fopen(name, "r")) == NULL) {
+        fprintf(stderr, "\nError: could not read %s\n", name);
+        exit(1);
+    }
+    i = ScanScores(fp, score, 176);
+    fclose(fp);
+    Initialize();
+    if (i < NUM_SCORES) {
+        printf("\n\nError: The scores put together in %s are incomplete or incorrect.", name);
+        exit(0);
+    }
+    format = 0;
+    if (print_scores == YES) {
+        PrintLikelihoodScores();
+    }
+}
+
+/************************* RunPaup ****************************/
+/* Scores the models in list with PAUP*, each in a process of its own with its
+   own command file, up to -p processes at a time. The first run saves the
+   neighbor-joining tree of MrModelblock, on which all models are then scored.
+   The scorefiles are left for the caller. */
+static void RunPaup(int *list, int n, int run)
+{
+    int i, numWorkers;
+    pthread_t *worker;
+
+    printf("\n Run %d:", run);
+    for (i = 0; i < n; i++) {
+        printf(" %s", modelSpec[list[i]].name);
+    }
+    fflush(stdout);
+    if (paupTreeSaved == NO) {
+        if (PaupJob(-1) == FAILURE) {
+            fprintf(stderr, "\nError: PAUP* could not build the tree\n");
+            exit(1);
+        }
+        paupTreeSaved = YES;
+    }
+
+    paupList = list;
+    paupCount = n;
+    nextPaupJob = 0;
+    paupStatus = (int *) malloc(n * sizeof(int));
+    numWorkers = MIN(numThreads, n);
+    worker = (pthread_t*) malloc(numWorkers * sizeof(pthread_t));
+    for (i = 1; i < numWorkers; i++) {
+        if (pthread_create(&worker[i], NULL, PaupWorker, NULL) != 0) {
+            fprintf(stderr, "\nError: could not start thread\n");
+            exit(1);
+        }
+    }
+    PaupWorker(NULL);
+    for (i = 1; i < numWorkers; i++) {
+        pthread_join(worker[i], NULL);
+    }
+    free(worker);
+    for (i = 0; i < n; i++) {
+        if (paupStatus[i] == FAILURE) {
+            fprintf(stderr, "\nError: PAUP* failed %d times for %s\n", paupRetries + 1, modelSpec[list[i]].name);
+            exit(1);
+        }
+    }
+    free(paupStatus);
+}
+
+/************************* PaupWorker ****************************/
+/* Runs the PAUP* jobs of RunPaup() until none is left */
+static void *PaupWorker(void *arg)
+{
+    int i;
+
+    (void) arg;
+    for (;;) {
+        pthread_mutex_lock(&nativeLock);
+        i = nextPaupJob++;
+        pthread_mutex_unlock(&nativeLock);
+        if (i >= paupCount) {
+            break;
+        }
+        paupStatus[i] = PaupJob(paupList[i]);
+    }
+
+    return NULL;
+}
+
+/************************* PaupJob ****************************/
+/* Writes the command file that scores model m (or builds the tree, m < 0) and
+   runs PAUP* on it, again up to --retries times if it fails or its output is
+   incomplete */
+static int PaupJob(int m)
+{
+    FILE *fp;
+    ModelSpecSt *spec;
+    char *command, commandFile[FILENAME_MAX], outFile[FILENAME_MAX], treeFile[FILENAME_MAX];
+    int attempt, status;
+
+    PaupFileName(commandFile, (m < 0) ? ".paup.nex" : ".nex", m);
+    PaupFileName(treeFile, ".tre", -1);
+    PaupFileName(outFile, (m < 0) ? ".tre" : ".scores", m);
+    if ((fp = fopen(commandFile, "w")) == NULL) {
+        fprintf(stderr, "\nError: could not write the PAUP* commands to %s\n", commandFile);
+        exit(1);
+    }
+    fprintf(fp, "#NEXUS\n[%s: %s]\n\n", PROGRAM_NAME, (m < 0) ? "tree for the likelihood scores" : modelSpec[m].name);
+    fprintf(fp, "BEGIN PAUP;\n");
+    fprintf(fp, "\tSet autoclose=yes warnreset=no warntree=no notifybeep=no;\n");
+    fprintf(fp, "\tExecute '%s';\n", paupData);
+    if (m < 0) {
+        fprintf(fp, "\tDSet distance=JC objective=ME base=equal rates=equal pinv=0\n\tsubst=all negbrlen=setzero;\n");
+        fprintf(fp, "\tNJ showtree=no breakties=random;\n");
+        fprintf(fp, "\tSaveTrees file='%s' brlens=yes replace=yes;\n", treeFile);
+    }
+    else {
+        spec = &modelSpec[m];
+        fprintf(fp, "\tGetTrees file='%s';\n", treeFile);
+        fprintf(fp, "\tSet criterion=like;\n");
+        fprintf(fp, "\t[!** Calculating %s **]\n", spec->name);
+        fprintf(fp, "\tlscores 1/ nst=%d base=%s", spec->nst, (spec->estFreqs == YES) ? "est" : "equal");
+        if (spec->nst == 2) {
+            fprintf(fp, " tratio=est");
+        }
+        else if (spec->nst == 6) {
+            fprintf(fp, " rmat=est rclass=(a b c d e f)");
+        }
+        fprintf(fp, " rates=%s pinv=%s", (spec->useGamma == YES) ? "gamma shape=est" : "equal", (spec->useInv == YES) ? "est" : "0");
+        fprintf(fp, "\n\tscorefile='%s' replace;\n", outFile);
+    }
+    fprintf(fp, "\tQuit;\nEND;\n");
+    fclose(fp);
+
+    command = (char *) malloc(strlen(paupCommand) + strlen(commandFile) + 2);
+    sprintf(command, "%s %s", paupCommand, commandFile);
+    status = FAILURE;
+    for (attempt = 0; attempt <= paupRetries && status == FAILURE; attempt++) {
+        remove(outFile);
+        if (system(command) == 0 && PaupOutputComplete(m, outFile) == YES) {
+            status = SUCCESS;
+        }
+        else if (attempt < paupRetries) {
+            fprintf(stderr, "\nWarning: '%s' failed for %s, running it again\n", command, (m < 0) ? "the tree" : modelSpec[m].name);
+        }
+    }
+    free(command);
+    if (status == SUCCESS) {
+        remove(commandFile);
+    }
+
+    return status;
+}
+
+/************************* PaupOutputComplete ****************************/
+/* YES if PAUP* wrote the tree (m < 0) or all the values of model m to file */
+static int PaupOutputComplete(int m, char *file)
+{
+    FILE *fp;
+    float values[176];
+    int count;
+
+    if ((fp = fopen(file, "r")) == NULL) {
+        return NO;
+    }
+    if (m < 0) {
+        count = (getc(fp) != EOF);
+        fclose(fp);
+        return (count) ? YES : NO;
+    }
+    count = ScanScores(fp, values, 176);
+    fclose(fp);
+
+    return (count == NumModelScores(m) && values[1] != 0) ? YES : NO;
+}
+
+/************************* ReadModelScores ****************************/
+/* Puts the scores of the models in list, from their scorefiles, in their places in score[] */
+static void ReadModelScores(int *list, int n)
+{
+    FILE *fp;
+    float values[176];
+    char name[FILENAME_MAX];
+    int i, k;
+
+    for (i = 0; i < n; i++) {
+        if ((fp = fopen(PaupFileName(name, ".scores", list[i]), "r")) == NULL) {
+            fprintf(stderr, "\nError: could not read %s\n", name);
+            exit(1);
+        }
+        ScanScores(fp, values, 176);
+        fclose(fp);
+        for (k = 0; k < NumModelScores(list[i]); k++) {
+            score[modelSpec[list[i]].scoreIndex + k] = values[k];
+        }
+        modelScored[list[i]] = YES;
+        remove(name);
+    }
+    Initialize();
+}
+
+/************************* NumModelScores ****************************/
+/* Number of values in the scorefile of model m (the tree number, -lnL and the estimates) */
+static int NumModelScores(int m)
+{
+    if (m + 1 < NUM_MODELS) {
+        return modelSpec[m + 1].scoreIndex - modelSpec[m].scoreIndex;
+    }
+
+    return (int) (sizeof(score) / sizeof(score[0])) - modelSpec[m].scoreIndex;
+}
+
+/************************* PaupFileName ****************************/
+/* Puts in name the name of a file of the PAUP* runs: the data file name with
+   suffix appended, and the model number before it for a model (num >= 0) */
+static char *PaupFileName(char *name, char *suffix, int num)
+{
+    if (num >= 0) {
+        snprintf(name, FILENAME_MAX, "%s.paup%d%s", paupData, num + 1, suffix);
+    }
+    else {
+        snprintf(name, FILENAME_MAX, "%s%s", paupData, suffix);
+    }
+
+    return name;
+}
+
+/************************* ProbeHierarchies ****************************/
+/* Walks the hLRT hierarchies that SelecthLRT() prints, without output, and
+   returns the number of models they still need (marked in modelWanted[]) */
+static int ProbeHierarchies()
+{
+    int i, n;
+
+    for (i = 0; i < NUM_MODELS; i++) {
+        modelWanted[i] = NO;
+    }
+    probing = YES;
+    probeMissed = NO;
+    if (usehLRT4 == YES) {
+        hLRT4();
+    }
+    else if (usehLRT3 == YES) {
+        hLRT3();
+    }
+    else if (usehLRT2 == YES) {
+        hLRT2();
+    }
+    else {
+        hLRT();
+        probeMissed = NO;
+        hLRT2();
+        probeMissed = NO;
+        hLRT3();
+        probeMissed = NO;
+        hLRT4();
+    }
+    probing = NO;
+    for (i = n = 0; i < NUM_MODELS; i++) {
+        n += modelWanted[i];
+    }
+
+    return n;
+}
+
+/************************* ProbeTest ****************************/
+/* A test of an hLRT hierarchy walked by LazyScores(): the P-value if both models
+   are scored, otherwise they are asked for. Only the first such test of a
+   hierarchy asks, as the rest of its path depends on the outcome. */
+static double ProbeTest(ModelSt *model0, ModelSt *model1, int mixed)
+{
+    if (probeMissed == YES) {
+        return 1.0;
+    }
+    if (modelScored[model0 - model] == YES && modelScored[model1 - model] == YES) {
+        return LRTProbability(model0, model1, mixed);
+    }
+    if (modelScored[model0 - model] == NO) {
+        modelWanted[model0 - model] = YES;
+    }
+    if (modelScored[model1 - model] == NO) {
+        modelWanted[model1 - model] = YES;
+    }
+    probeMissed = YES;
+
+    return 1.0;
+}
+
+/************************* IsUnscored ****************************/
+/* YES for a model left out by --lazy, or not optimized to the end with -s
+   (modelApprox[]), whose -lnL is not a maximum likelihood score */
+static int IsUnscored(int i)
+{
+    return (useLazy == YES && modelScored[i] == NO) || modelApprox[i] == YES;
+}
+
+/************************* StreamScores ****************************/
+/* Reads a PAUP* scorefile while PAUP* is still writing it (--stream from the
+   standard input, --follow=F from a file that grows). Each model is taken as
+   soon as its line of values is complete, and the hLRTs are printed as soon as
+   the hierarchies have all the models they need. The AIC follows when the 24
+   models are in. */
+static void StreamScores()
+{
+    FILE *fp;
+    char *line, *token;
+    int m, k, size, length, c, hLRTDone, atEnd;
+    float value;
+
+    printf("\nInput format: Paup matrix file, read as it is written (%s)\n", (followFile != NULL) ? followFile : "standard input");
+    fflush(stdout);
+    if (followFile == NULL) {
+        fp = OpenInput(stdin, "the standard input");
+    }
+    else {
+        while ((fp = fopen(followFile, "r")) == NULL) {
+            sleep(STREAM_POLL);
+        }
+    }
+    format = 0;
+    for (m = 0; m < NUM_MODELS; m++) {
+        modelScored[m] = NO;
+    }
+    Initialize();
+    size = 256;
+    line = (char *) malloc(size);
+    length = 0;
+    m = -1;
+    hLRTDone = NO;
+    atEnd = NO;
+    while (m < NUM_MODELS && atEnd == NO) {
+        /* a line, waiting at the end of a growing file for the rest of it */
+        c = getc(fp);
+        if (c == EOF) {
+            if (followFile == NULL || ferror(fp)) {
+                atEnd = YES;
+            }
+            else {
+                clearerr(fp);
+                sleep(STREAM_POLL);
+                continue;
+            }
+        }
+        else if (c != '\n') {
+            if (length + 1 == size) {
+                size *= 2;
+                line = (char *) realloc(line, size);
+            }
+            line[length++] = (char) c;
+            continue;
+        }
+        line[length] = '\0';
+        length = 0;
+        if (!strncmp(line, "Tree", 4)) {
+            m++;
+            continue;
+        }
+        if (m < 0 || m >= NUM_MODELS || modelScored[m] == YES || strspn(line, " \t\r") == strlen(line)) {
+            continue;
+        }
+
+        /* the values of model m, read as by ScanScores() */
+        k = 0;
+        for (token = strtok(line, " \t\r"); token != NULL; token = strtok(NULL, " \t\r")) {
+            if (isdigit((unsigned char) *token)) {
+                value = atof(token);
+            }
+            else if (!strcmp(token, "infinity")) {
+                value = SHAPE_INFINITY;
+            }
+            else {
+                continue;
+            }
+            if (k < NumModelScores(m)) {
+                score[modelSpec[m].scoreIndex + k] = value;
+            }
+            k++;
+        }
+        if (k != NumModelScores(m)) {
+            printf("\n\nError: The scores of %s are incomplete or incorrect.", modelSpec[m].name);
+            exit(0);
+        }
+        model[m].ln = order[m].ln = score[modelSpec[m].scoreIndex + 1];
+        modelScored[m] = YES;
+        if (DEBUGLEVEL >= 1) {
+            fprintf(stderr, "\nINFO:   %s read", modelSpec[m].name);
+        }
+
+        if (hLRTDone == NO && ProbeHierarchies() == 0) {
+            printf("\n hLRTs resolved with %d of the %d models read", NumScored(), NUM_MODELS);
+            PrintRunSettings();
+            SelecthLRT();
+            fflush(stdout);
+            hLRTDone = YES;
+        }
+        if (NumScored() == NUM_MODELS) {
+            break;
+        }
+    }
+    free(line);
+    if (followFile != NULL) {
+        fclose(fp);
+    }
+    if (NumScored() < NUM_MODELS) {
+        printf("\n\nError: The input file is incomplete or incorrect.\nAre you using the most updated block of PAUP* commands?");
+        printf("\nThis version of MrModeltest2 is not compatible with versions of PAUP* older than v.4.0a155.");
+        printf("\nPlease check the MrModeltest2 and PAUP* web pages.");
+        exit(0);
+    }
+    if (print_scores == YES) {
+        PrintLikelihoodScores();
+    }
+    SelectAIC();
+}
+
+/************************* NumScored ****************************/
+static int NumScored()
+{
+    int i, n;
+
+    for (i = n = 0; i < NUM_MODELS; i++) {
+        n += modelScored[i];
+    }
+
+    return n;
+}
+
+/************************* NumApprox ****************************/
+static int NumApprox()
+{
+    int i, n;
+
+    for (i = n = 0; i < NUM_MODELS; i++) {
+        n += modelApprox[i];
+    }
+
+    return n;
+}
+
+/************************* QueueWorker ****************************/
+/* A worker of a queue of loci shared by many processes, also on different
+   nodes, in a directory (--queue=DIR). The loci are PAUP* scorefiles put in
+   DIR/todo. A locus is claimed by renaming it into DIR/claimed, which only one
+   worker can do, and its models are selected in a child process. The report
+   is written to DIR/results/<locus>.out and a row of the models selected to
+   DIR/results/<locus>.row, and the locus is moved to DIR/done (or DIR/failed).
+   The worker touches its claim while it works; a claim not touched for --lease
+   seconds is taken to be left by a worker that died and is put back in
+   DIR/todo. The worker ends when no locus is left in DIR/todo or DIR/claimed. */
+static void QueueWorker()
+{
+#if WIN
+    fprintf(stderr, "\nError: --queue is not available on Windows\n");
+    exit(1);
+#else
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    char todo[FILENAME_MAX], claimed[FILENAME_MAX], name[FILENAME_MAX];
+    int numDone, numFailed, numClaimed, claimedNow;
+    pid_t pid;
+
+    snprintf(name, sizeof(name), "%s/todo", queueDir);
+    if ((dir = opendir(name)) == NULL) {
+        fprintf(stderr, "\nError: could not open the queue directory %s\n", name);
+        exit(1);
+    }
+    closedir(dir);
+    snprintf(name, sizeof(name), "%s/claimed", queueDir);
+    mkdir(name, 0777);
+    snprintf(name, sizeof(name), "%s/done", queueDir);
+    mkdir(name, 0777);
+    snprintf(name, sizeof(name), "%s/failed", queueDir);
+    mkdir(name, 0777);
+    snprintf(name, sizeof(name), "%s/results", queueDir);
+    mkdir(name, 0777);
+
+    pid = getpid();
+    numDone = numFailed = 0;
+    while (1) {
+        /* claim the first locus that no other worker claims first */
+        claimedNow = NO;
+        snprintf(name, sizeof(name), "%s/todo", queueDir);
+        if ((dir = opendir(name)) == NULL) {
+            break;
+        }
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            snprintf(todo, sizeof(todo), "%s/todo/%s", queueDir, entry->d_name);
+            snprintf(claimed, sizeof(claimed), "%s/claimed/%s", queueDir, entry->d_name);
+            if (rename(todo, claimed) == 0) {
+                claimedNow = YES;
+                break;
+            }
+        }
+        closedir(dir);
+        if (claimedNow == YES) {
+            utime(claimed, NULL);
+            if (QueueLocus(claimed, strrchr(claimed, '/') + 1) == SUCCESS) {
+                numDone++;
+            }
+            else {
+                numFailed++;
+            }
+            continue;
+        }
+
+        /* nothing to claim: put back the claims left by dead workers, and
+           wait for the others as long as they may still leave some */
+        numClaimed = 0;
+        snprintf(name, sizeof(name), "%s/claimed", queueDir);
+        if ((dir = opendir(name)) == NULL) {
+            break;
+        }
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            snprintf(claimed, sizeof(claimed), "%s/claimed/%s", queueDir, entry->d_name);
+            if (stat(claimed, &st) != 0) {
+                continue;
+            }
+            numClaimed++;
+            if (time(NULL) - st.st_mtime > queueLease) {
+                snprintf(todo, sizeof(todo), "%s/todo/%s", queueDir, entry->d_name);
+                if (rename(claimed, todo) == 0) {
+                    fprintf(stderr, "\nWorker %d: the claim of %s has expired, queued again", (int) pid, entry->d_name);
+                }
+            }
+        }
+        closedir(dir);
+        if (numClaimed == 0) {
+            break;
+        }
+        sleep(QUEUE_POLL);
+    }
+    printf("\nWorker %d: %d loci done, %d failed\n", (int) pid, numDone, numFailed);
+#endif
+}
+
+#if !WIN
+/************************* QueueLocus ****************************/
+/* Selects the models of a claimed locus in a child process, touching the
+   claim while it runs, and moves the locus to done or failed */
+static int QueueLocus(char *claimed, char *locus)
+{
+    char row[FILENAME_MAX], name[FILENAME_MAX];
+    FILE *fp;
+    pid_t pid;
+    time_t touched;
+    struct timespec delay;
+    int status, result;
+
+    snprintf(row, sizeof(row), "%s/results/%s.row", queueDir, locus);
+    pid = StartLocus(claimed, locus, queueDir);
+
+    /* wait 1 ms, 2 ms, ... up to a second between looks at the child */
+    touched = time(NULL);
+    delay.tv_sec = 0;
+    delay.tv_nsec = 1000000;
+    while ((result = waitpid(pid, &status, WNOHANG)) == 0) {
+        nanosleep(&delay, NULL);
+        if (delay.tv_nsec < 500000000) {
+            delay.tv_nsec *= 2;
+        }
+        if (time(NULL) - touched >= MAX(1, queueLease / 4)) {
+            utime(claimed, NULL);
+            touched = time(NULL);
+        }
+    }
+    if (result == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 && (fp = fopen(row, "r")) != NULL) {
+        fclose(fp);
+        snprintf(name, sizeof(name), "%s/done/%s", queueDir, locus);
+        rename(claimed, name);
+        if (DEBUGLEVEL >= 1) {
+            fprintf(stderr, "\nINFO:   %s done", locus);
+        }
+        return SUCCESS;
+    }
+    snprintf(name, sizeof(name), "%s/failed/%s", queueDir, locus);
+    rename(claimed, name);
+    fprintf(stderr, "\nWorker %d: %s failed (see %s/failed)", (int) getpid(), locus, queueDir);
+
+    return FAILURE;
+}
+
+/************************* StartLocus ****************************/
+/* Starts a child process that selects the models of the scorefile input as a
+   normal run, with the report in dir/results/<locus>.out and a row of the
+   models selected in dir/results/<locus>.row (no row if it fails) */
+static pid_t StartLocus(char *input, char *locus, char *dir)
+{
+    char out[FILENAME_MAX], row[FILENAME_MAX], name[FILENAME_MAX + 8];
+    FILE *fp;
+    pid_t pid;
+
+    snprintf(out, sizeof(out), "%s/results/%s.out", dir, locus);
+    snprintf(row, sizeof(row), "%s/results/%s.row", dir, locus);
+    remove(row);
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) < 0) {
+        fprintf(stderr, "\nError: could not start a process for %s\n", locus);
+        exit(1);
+    }
+    if (pid > 0) {
+        return pid;
+    }
+
+    snprintf(name, sizeof(name), "%s.tmp", out);
+    if (freopen(input, "r", stdin) == NULL || freopen(name, "w", stdout) == NULL) {
+        _exit(1);
+    }
+    PrintTitle(stdout);
+    PrintDate(stdout);
+    RecognizeInputFormat();
+    PrintRunSettings();
+    SelectModel();
+    fclose(stdout);
+    rename(name, out);
+    snprintf(name, sizeof(name), "%s.tmp", row);
+    if ((fp = fopen(name, "w")) == NULL) {
+        _exit(1);
+    }
+    fprintf(fp, "%s\t%s\t%s\t%s\t%s\t%s\t%.4f\n", locus, modelhLRT,
+        (*modelhLRT2 != '\0') ? modelhLRT2 : "-", (*modelhLRT3 != '\0') ? modelhLRT3 : "-",
+        (*modelhLRT4 != '\0') ? modelhLRT4 : "-", modelAIC, minAIC);
+    fclose(fp);
+    rename(name, row);
+    _exit(0);
+}
+#endif
+
+/************************* WatchDirectory ****************************/
+/* Selects the models of each PAUP* scorefile (*.scores, *.scores.gz or
+   *.scores.zst) in a directory as soon as it is complete, i.e. closed by the
+   program writing it or moved into the directory (--watch=DIR), in up to -p
+   processes at a time. A row of the models
+   selected is printed for each file, the report is written to DIR/results,
+   and the file is added to the index DIR/.mrmodeltest2.index, so that it is
+   not done again when the watch is started again. The files already in the
+   directory and not in the index are done first. */
+static void WatchDirectory()
+{
+#if WIN
+    fprintf(stderr, "\nError: --watch is not available on Windows\n");
+    exit(1);
+#elif !defined(__linux__)
+    fprintf(stderr, "\nError: --watch is only available on Linux\n");
+    exit(1);
+#else
+    union {
+        struct inotify_event event;
+        char bytes[16384];
+    } buffer;
+    struct inotify_event *event;
+    struct pollfd wait[2];
+    struct sigaction action;
+    DIR *dir;
+    struct dirent *entry;
+    FILE *fp, *index;
+    WatchSt *running;
+    char **pending, *key, name[FILENAME_MAX], line[1024];
+    int i, fd, numPending, maxPending, firstPending, status;
+    ssize_t length;
+    pid_t pid;
+
+    snprintf(name, sizeof(name), "%s/results", watchDir);
+    mkdir(name, 0777);
+    if ((fd = inotify_init()) < 0 || inotify_add_watch(fd, watchDir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "\nError: could not watch the directory %s\n", watchDir);
+        exit(1);
+    }
+
+    /* the files done before */
+    watchIndexSize = 1024;
+    watchIndex = (char **) calloc(watchIndexSize, sizeof(char *));
+    numWatchIndex = 0;
+    snprintf(name, sizeof(name), "%s/%s", watchDir, WATCH_INDEX);
+    if ((fp = fopen(name, "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            line[strcspn(line, "\n")] = '\0';
+            WatchIndexed(line, YES);
+        }
+        fclose(fp);
+    }
+    if ((index = fopen(name, "a")) == NULL) {
+        fprintf(stderr, "\nError: could not write the index %s\n", name);
+        exit(1);
+    }
+
+    /* a child that ends wakes up poll() through a pipe */
+    if (pipe(childPipe) != 0 || fcntl(childPipe[0], F_SETFL, O_NONBLOCK) != 0) {
+        fprintf(stderr, "\nError: could not create a pipe\n");
+        exit(1);
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = ChildEnded;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &action, NULL);
+    wait[0].fd = fd;
+    wait[0].events = POLLIN;
+    wait[1].fd = childPipe[0];
+    wait[1].events = POLLIN;
+
+    maxPending = 1024;
+    pending = (char **) malloc(maxPending * sizeof(char *));
+    numPending = firstPending = 0;
+    running = (WatchSt *) calloc(numThreads, sizeof(WatchSt));
+    if ((dir = opendir(watchDir)) != NULL) {
+        while ((entry = readdir(dir)) != NULL) {
+            if ((key = WatchKey(entry->d_name)) != NULL) {
+                if (numPending == maxPending) {
+                    maxPending *= 2;
+                    pending = (char **) realloc(pending, maxPending * sizeof(char *));
+                }
+                pending[numPending++] = key;
+            }
+        }
+        closedir(dir);
+    }
+    fprintf(stderr, "\nWatching %s (%d files done before, %d to do)\n", watchDir, numWatchIndex - numPending, numPending);
+
+    while (1) {
+        /* start the files waiting, as far as there are free processes */
+        for (i = 0; i < numThreads && firstPending < numPending; i++) {
+            if (running[i].pid != 0) {
+                continue;
+            }
+            running[i].key = pending[firstPending++];
+            running[i].locus = strndup(running[i].key, strcspn(running[i].key, "\t"));
+            snprintf(name, sizeof(name), "%s/%s", watchDir, running[i].locus);
+            running[i].pid = StartLocus(name, running[i].locus, watchDir);
+        }
+        if (firstPending == numPending) {
+            numPending = firstPending = 0;
+        }
+
+        if (poll(wait, 2, -1) < 0) {
+            continue;
+        }
+
+        /* files written or moved into the directory */
+        if (wait[0].revents & POLLIN) {
+            length = read(fd, buffer.bytes, sizeof(buffer.bytes));
+            for (i = 0; i < length; i += sizeof(struct inotify_event) + event->len) {
+                event = (struct inotify_event *) (buffer.bytes + i);
+                if (event->len > 0 && !(event->mask & IN_ISDIR) && (key = WatchKey(event->name)) != NULL) {
+                    if (numPending == maxPending) {
+                        maxPending *= 2;
+                        pending = (char **) realloc(pending, maxPending * sizeof(char *));
+                    }
+                    pending[numPending++] = key;
+                }
+            }
+        }
+
+        /* processes that have ended */
+        if (wait[1].revents & POLLIN) {
+            while (read(childPipe[0], line, sizeof(line)) > 0) {
+                ;
+            }
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                for (i = 0; i < numThreads && running[i].pid != pid; i++) {
+                    ;
+                }
+                if (i == numThreads) {
+                    continue;
+                }
+                snprintf(name, sizeof(name), "%s/results/%s.row", watchDir, running[i].locus);
+                if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && (fp = fopen(name, "r")) != NULL) {
+                    if (fgets(line, sizeof(line), fp) != NULL) {
+                        fputs(line, stdout);
+                        fflush(stdout);
+                    }
+                    fclose(fp);
+                }
+                else {
+                    fprintf(stderr, "\n%s could not be read, see %s/results/%s.out.tmp\n", running[i].locus, watchDir, running[i].locus);
+                }
+                fprintf(index, "%s\n", running[i].key);
+                fflush(index);
+                free(running[i].locus);
+                free(running[i].key);
+                running[i].pid = 0;
+            }
+        }
+    }
+#endif
+}
+
+#if defined(__linux__) && !WIN
+/************************* WatchKey ****************************/
+/* For a scorefile of the watched directory not done before, a new string with
+   the key of the file in the index (name, size and time of change), after
+   noting it as done; NULL for other files */
+static char *WatchKey(char *file)
+{
+    char key[FILENAME_MAX + 64], name[FILENAME_MAX];
+    char *suffix[3] = {WATCH_SUFFIX, WATCH_SUFFIX ".gz", WATCH_SUFFIX ".zst"};
+    struct stat st;
+    size_t n;
+    int i;
+
+    n = strlen(file);
+    for (i = 0; i < 3; i++) {
+        if (n > strlen(suffix[i]) && strcmp(file + n - strlen(suffix[i]), suffix[i]) == 0) {
+            break;
+        }
+    }
+    if (i == 3) {
+        return NULL;
+    }
+    snprintf(name, sizeof(name), "%s/%s", watchDir, file);
+    if (stat(name, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    snprintf(key, sizeof(key), "%s\t%lld\t%lld", file, (long long) st.st_size, (long long) st.st_mtime);
+    if (WatchIndexed(key, YES) == YES) {
+        return NULL;
+    }
+
+    return strdup(key);
+}
+
+/************************* WatchIndexed ****************************/
+/* YES if key is in the index of files done; with add, it is added if not */
+static int WatchIndexed(char *key, int add)
+{
+    unsigned long long h;
+    int i;
+
+    h = HashBytes(14695981039346656037ULL, key, strlen(key));
+    for (i = h % watchIndexSize; watchIndex[i] != NULL; i = (i + 1) % watchIndexSize) {
+        if (!strcmp(watchIndex[i], key)) {
+            return YES;
+        }
+    }
+    if (add == NO) {
+        return NO;
+    }
+    watchIndex[i] = strdup(key);
+    numWatchIndex++;
+    if (2 * numWatchIndex > watchIndexSize) {
+        WatchRehash();
+    }
+
+    return NO;
+}
+
+/************************* WatchRehash ****************************/
+/* Doubles the size of the hash table of the index */
+static void WatchRehash()
+{
+    char **old;
+    int i, oldSize;
+
+    old = watchIndex;
+    oldSize = watchIndexSize;
+    watchIndexSize *= 2;
+    watchIndex = (char **) calloc(watchIndexSize, sizeof(char *));
+    numWatchIndex = 0;
+    for (i = 0; i < oldSize; i++) {
+        if (old[i] != NULL) {
+            WatchIndexed(old[i], YES);
+            free(old[i]);
+        }
+    }
+    free(old);
+}
+
+/************************* ChildEnded ****************************/
+/* SIGCHLD handler: wakes up the poll() of WatchDirectory() */
+static void ChildEnded(int sig)
+{
+    char c;
+
+    (void) sig;
+    c = 0;
+    if (write(childPipe[1], &c, 1) < 0) {
+        return;
+    }
+}
+#endif
+
+/************************* QueueReduce ****************************/
+/* Prints the rows of the loci done in the queue directory as one table,
+   in the order of the locus names (--reduce=DIR) */
+static void QueueReduce()
+{
+#if WIN
+    fprintf(stderr, "\nError: --reduce is not available on Windows\n");
+    exit(1);
+#else
+    DIR *dir;
+    struct dirent *entry;
+    FILE *fp;
+    char **names, name[FILENAME_MAX], line[1024];
+    int i, n, max, len, numFailed, numLeft;
+
+    snprintf(name, sizeof(name), "%s/results", queueDir);
+    if ((dir = opendir(name)) == NULL) {
+        fprintf(stderr, "\nError: could not open %s\n", name);
+        exit(1);
+    }
+    n = 0;
+    max = 1024;
+    names = (char **) malloc(max * sizeof(char *));
+    while ((entry = readdir(dir)) != NULL) {
+        len = strlen(entry->d_name);
+        if (len > 4 && !strcmp(entry->d_name + len - 4, ".row")) {
+            if (n == max) {
+                max *= 2;
+                names = (char **) realloc(names, max * sizeof(char *));
+            }
+            names[n++] = strdup(entry->d_name);
+        }
+    }
+    closedir(dir);
+    qsort(names, n, sizeof(char *), CompareNames);
+
+    printf("Locus\thLRT1\thLRT2\thLRT3\thLRT4\tAIC model\tAIC\n");
+    for (i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "%s/results/%s", queueDir, names[i]);
+        if ((fp = fopen(name, "r")) != NULL) {
+            if (fgets(line, sizeof(line), fp) != NULL) {
+                fputs(line, stdout);
+            }
+            fclose(fp);
+        }
+        free(names[i]);
+    }
+    free(names);
+    numFailed = QueueCount("failed");
+    numLeft = QueueCount("todo") + QueueCount("claimed");
+    fprintf(stderr, "\n%d loci in the table, %d failed, %d not done\n", n, numFailed, numLeft);
+#endif
+}
+
+#if !WIN
+/************************* QueueCount ****************************/
+/* Number of loci in a subdirectory of the queue directory */
+static int QueueCount(char *sub)
+{
+    DIR *dir;
+    struct dirent *entry;
+    char name[FILENAME_MAX];
+    int n;
+
+    snprintf(name, sizeof(name), "%s/%s", queueDir, sub);
+    if ((dir = opendir(name)) == NULL) {
+        return 0;
+    }
+    n = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            n++;
+        }
+    }
+    closedir(dir);
+
+    return n;
+}
+
+/************************* CompareNames ****************************/
+static int CompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+#endif
+
+/************************* BatchScores ****************************/
+/* Selects the models of many PAUP* scorefiles, named one per line on the
+   standard input (--batch), in a pipeline of three stages that overlap: a
+   thread reads and tokenizes the files ahead, -p child processes select the
+   models of the loci read, and a thread writes their reports to the standard
+   output in the order of the names. The stages are joined by bounded queues,
+   so a slow stage holds back the others instead of filling the memory. How
+   busy each stage was is printed at the end to the standard error. */
+static void BatchScores()
+{
+#if WIN
+    fprintf(stderr, "\nError: --batch is not available on Windows\n");
+    exit(1);
+#else
+    pthread_t reader, writer, metricsThread;
+    BatchLocusSt *locus;
+    struct rusage usage;
+    double start, wall, computeBusy;
+    int fd[2];
+
+    printf("\nInput format: Paup matrix files named on the standard input, %d processes at a time\n", numThreads);
+    fflush(stdout);
+    BatchQueueInit(&readQueue, BATCH_QUEUE * numThreads);
+    BatchQueueInit(&writeQueue, numThreads);
+    if (useSummary == YES) {
+        summary = (SummarySt *) malloc(sizeof(SummarySt));
+        SummaryInit(summary);
+    }
+    start = WallSeconds();
+    metrics.start = start;
+    metricsQuit = NO;
+    if (pthread_create(&reader, NULL, BatchReader, NULL) != 0 || pthread_create(&writer, NULL, BatchWriter, NULL) != 0
+        || (metricsFile != NULL && pthread_create(&metricsThread, NULL, MetricsWriter, NULL) != 0)) {
+        fprintf(stderr, "\nError: could not start thread\n");
+        exit(1);
+    }
+
+    /* the compute stage: a process for each locus read, as many at a time as
+       the queue to the writer holds */
+    while ((locus = BatchGet(&readQueue)) != NULL) {
+        if (locus->numScores >= 0) {
+            if (storeFile != NULL || useSummary == YES || metricsFile != NULL) {
+                locus->result = (LocusResultSt *) mmap(NULL, sizeof(LocusResultSt), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+                if (locus->result == MAP_FAILED) {
+                    fprintf(stderr, "\nError: could not map memory for %s\n", locus->name);
+                    exit(1);
+                }
+            }
+            if (pipe(fd) != 0) {
+                fprintf(stderr, "\nError: could not create a pipe\n");
+                exit(1);
+            }
+            fflush(stderr);
+            locus->started = WallSeconds();
+            if ((locus->pid = fork()) < 0) {
+                fprintf(stderr, "\nError: could not start a process for %s\n", locus->name);
+                exit(1);
+            }
+            if (locus->pid == 0) {
+                close(fd[0]);
+                BatchLocus(locus, fd[1]);
+            }
+            close(fd[1]);
+            locus->fd = fd[0];
+        }
+        BatchPut(&writeQueue, locus);
+    }
+    BatchClose(&writeQueue);
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    if (metricsFile != NULL) {
+        pthread_mutex_lock(&metricsLock);
+        metricsQuit = YES;
+        pthread_cond_signal(&metricsWake);
+        pthread_mutex_unlock(&metricsLock);
+        pthread_join(metricsThread, NULL);
+    }
+    if (storeFile != NULL) {
+        StoreWrite(storeFile);
+    }
+    if (useSummary == YES) {
+        if (summaryFile != NULL) {
+            SummarySave(summary, summaryFile);
+        }
+        PrintSummary(summary);
+        free(summary);
+    }
+
+    wall = MAX(WallSeconds() - start, 1e-9);
+    getrusage(RUSAGE_CHILDREN, &usage);
+    computeBusy = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    fprintf(stderr, "\n%d loci in %.2f seconds (%.1f per second), %d failed", batchDone + batchFailed, wall,
+        (batchDone + batchFailed) / wall, batchFailed);
+    fprintf(stderr, "\n Stage     Busy");
+    fprintf(stderr, "\n Reader  %5.1f%%", 100.0 * batchReadBusy / wall);
+    fprintf(stderr, "\n Compute %5.1f%%  (CPU time of %d processes)", 100.0 * computeBusy / (wall * numThreads), numThreads);
+    fprintf(stderr, "\n Writer  %5.1f%%", 100.0 * batchWriteBusy / wall);
+    fprintf(stderr, "\n Queue             Mean loci   Full");
+    fprintf(stderr, "\n Reader->Compute  %5.1f of %-3d %5.1f%%", readQueue.depthSum / MAX(1, readQueue.numPuts), readQueue.size,
+        100.0 * readQueue.numFull / MAX(1, readQueue.numPuts));
+    fprintf(stderr, "\n Compute->Writer  %5.1f of %-3d %5.1f%%\n", writeQueue.depthSum / MAX(1, writeQueue.numPuts), writeQueue.size,
+        100.0 * writeQueue.numFull / MAX(1, writeQueue.numPuts));
+#endif
+}
+
+#if !WIN
+/************************* BatchReader ****************************/
+/* First stage of --batch: reads the names on the standard input and the
+   scores of each file, which it queues for the compute stage */
+static void *BatchReader(void *arg)
+{
+    BatchLocusSt *locus;
+    FILE *fp;
+    char line[FILENAME_MAX];
+    double start;
+
+    (void) arg;
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        start = WallSeconds();
+        line[strcspn(line, "\r\n")] = '\0';
+        if (*line == '\0') {
+            continue;
+        }
+        locus = (BatchLocusSt *) calloc(1, sizeof(BatchLocusSt));
+        locus->name = strdup(line);
+        if ((fp = fopen(line, "rb")) == NULL) {
+            locus->numScores = -1;
+        }
+        else {
+            fp = OpenInput(fp, locus->name);
+            locus->numScores = ScanScores(fp, locus->score, 176);
+            fclose(fp);
+        }
+        batchReadBusy += WallSeconds() - start;
+        MetricsStage(STAGE_READ, WallSeconds() - start);
+        BatchPut(&readQueue, locus);
+    }
+    BatchClose(&readQueue);
+
+    return NULL;
+}
+
+/************************* BatchLocus ****************************/
+/* The child process of a locus of --batch: selects the models as a normal run
+   would, with the report written to fd */
+static void BatchLocus(BatchLocusSt *locus, int fd)
+{
+    int i;
+
+    if (dup2(fd, fileno(stdout)) < 0) {
+        _exit(1);
+    }
+    close(fd);
+    printf("\n\n_________________________________________________________________________");
+    printf("\nLocus: %s\n", locus->name);
+    if (useProfile == YES) {
+        ProfileChild();
+    }
+    for (i = 0; i < 176; i++) {
+        score[i] = locus->score[i];
+    }
+    format = 0;
+    Initialize();
+    if (print_scores == YES) {
+        PrintLikelihoodScores();
+    }
+    if (PaupScoresComplete(locus->numScores) == NO) {
+        printf("\n\nError: The input file is incomplete or incorrect.\n");
+        fflush(stdout);
+        _exit(2);
+    }
+    PrintRunSettings();
+    SelectModel();
+    if (useProfile == YES) {
+        PrintProfile();
+    }
+    fflush(stdout);
+    if (locus->result != NULL) {
+        LocusResult(locus->result);
+        locus->result->seconds = WallSeconds() - locus->started;
+    }
+    _exit(0);
+}
+
+/************************* BatchWriter ****************************/
+/* Last stage of --batch: copies the reports of the loci to the standard
+   output, in the order they were read, as their processes write them */
+static void *BatchWriter(void *arg)
+{
+    BatchLocusSt *locus;
+    char buffer[65536];
+    ssize_t n;
+    int status;
+    double start, written;
+
+    (void) arg;
+    while ((locus = BatchGet(&writeQueue)) != NULL) {
+        if (locus->numScores < 0) {
+            n = snprintf(buffer, sizeof(buffer), "\n\n_________________________________________________________________________\nLocus: %s\n\nError: could not open the file\n", locus->name);
+            WriteAll(fileno(stdout), buffer, MIN(n, (ssize_t) sizeof(buffer) - 1));
+            batchFailed++;
+            MetricsLocus(ERROR_OPEN);
+        }
+        else {
+            written = 0.0;
+            while ((n = read(locus->fd, buffer, sizeof(buffer))) > 0) {
+                start = WallSeconds();
+                WriteAll(fileno(stdout), buffer, n);
+                written += WallSeconds() - start;
+            }
+            batchWriteBusy += written;
+            MetricsStage(STAGE_WRITE, written);
+            close(locus->fd);
+            if (waitpid(locus->pid, &status, 0) != locus->pid || !WIFEXITED(status)) {
+                status = -1;
+            }
+            else {
+                status = WEXITSTATUS(status);
+            }
+            MetricsLocus((status == 0) ? -1 : (status == 2) ? ERROR_INCOMPLETE : ERROR_FAILED);
+            if (status == 0) {
+                batchDone++;
+                MetricsStage(STAGE_COMPUTE, (locus->result != NULL) ? locus->result->seconds : 0.0);
+                if (storeFile != NULL) {
+                    StoreAppend(locus->name, locus->result);
+                }
+                if (useSummary == YES) {
+                    SummaryAdd(summary, locus->result);
+                }
+            }
+            else {
+                batchFailed++;
+            }
+            if (locus->result != NULL) {
+                munmap(locus->result, sizeof(LocusResultSt));
+            }
+        }
+        free(locus->name);
+        free(locus);
+    }
+
+    return NULL;
+}
+
+/************************* WriteAll ****************************/
+/* Writes n bytes to fd, however many write() takes */
+static void WriteAll(int fd, char *buffer, size_t n)
+{
+    ssize_t done;
+
+    while (n > 0) {
+        if ((done = write(fd, buffer, n)) < 0) {
+            fprintf(stderr, "\nError: could not write the output\n");
+            exit(1);
+        }
+        buffer += done;
+        n -= done;
+    }
+}
+
+/************************* BatchQueueInit ****************************/
+static void BatchQueueInit(BatchQueueSt *q, int size)
+{
+    q->item = (BatchLocusSt **) malloc(size * sizeof(BatchLocusSt *));
+    q->size = size;
+    q->head = q->count = 0;
+    q->closed = NO;
+    q->depthSum = 0.0;
+    q->numPuts = q->numFull = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->notEmpty, NULL);
+    pthread_cond_init(&q->notFull, NULL);
+}
+
+/************************* BatchPut ****************************/
+/* Puts a locus at the end of a queue, waiting while it is full */
+static void BatchPut(BatchQueueSt *q, BatchLocusSt *locus)
+{
+    pthread_mutex_lock(&q->lock);
+    q->depthSum += q->count;
+    q->numPuts++;
+    if (q->count == q->size) {
+        q->numFull++;
+    }
+    while (q->count == q->size) {
+        pthread_cond_wait(&q->notFull, &q->lock);
+    }
+    q->item[(q->head + q->count) % q->size] = locus;
+    q->count++;
+    pthread_cond_signal(&q->notEmpty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/************************* BatchGet ****************************/
+/* Takes the first locus of a queue, waiting while it is empty; NULL when it
+   is empty and closed */
+static BatchLocusSt *BatchGet(BatchQueueSt *q)
+{
+    BatchLocusSt *locus;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && q->closed == NO) {
+        pthread_cond_wait(&q->notEmpty, &q->lock);
+    }
+    locus = NULL;
+    if (q->count > 0) {
+        locus = q->item[q->head];
+        q->head = (q->head + 1) % q->size;
+        q->count--;
+        pthread_cond_signal(&q->notFull);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return locus;
+}
+
+/************************* BatchClose ****************************/
+/* Tells the stage that takes from a queue that nothing more will come */
+static void BatchClose(BatchQueueSt *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = YES;
+    pthread_cond_broadcast(&q->notEmpty);
+    pthread_mutex_unlock(&q->lock);
+}
+#endif
+
+/************************* WallSeconds ****************************/
+/* Seconds of wall-clock time from an arbitrary start */
+static double WallSeconds()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+#if !WIN
+/************************* LocusResult ****************************/
+/* Copies the results of the models selected into result (--store) */
+static void LocusResult(LocusResultSt *result)
+{
+    int i;
+
+    for (i = 0; i < NUM_MODELS; i++) {
+        result->lnL[i] = model[i].ln;
+        result->AIC[i] = AIC[i];
+        result->weight[i] = wAIC[i];
+    }
+    result->selected[0] = ModelNumber(modelhLRT);
+    result->selected[1] = ModelNumber(modelhLRT2);
+    result->selected[2] = ModelNumber(modelhLRT3);
+    result->selected[3] = ModelNumber(modelhLRT4);
+    result->selected[4] = ModelNumber(modelAIC);
+    for (i = 0; i < NUM_AVERAGED; i++) {
+        result->averaged[i] = averaged[i];
+    }
+}
+
+/************************* ModelNumber ****************************/
+/* Index of the model named name in modelSpec[], or -1 */
+static int ModelNumber(char *name)
+{
+    int i;
+
+    for (i = 0; i < NUM_MODELS; i++) {
+        if (!strcmp(modelSpec[i].name, name)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/************************* StoreAppend ****************************/
+/* Keeps the results of a locus done by --batch for the results store */
+static void StoreAppend(char *name, LocusResultSt *result)
+{
+    if (numStored == maxStored) {
+        maxStored = (maxStored == 0) ? 1024 : 2 * maxStored;
+        storedResult = (LocusResultSt *) realloc(storedResult, maxStored * sizeof(LocusResultSt));
+        storedName = (char **) realloc(storedName, maxStored * sizeof(char *));
+    }
+    storedResult[numStored] = *result;
+    storedName[numStored] = strdup(name);
+    numStored++;
+}
+
+/************************* StoreColumn ****************************/
+/* Name and type of column c of the results store: the locus name, the
+   models selected by the hLRTs and the AIC, -lnL, AIC and Akaike weight of
+   each model, and the model-averaged estimates */
+static int StoreColumn(int c, char *name)
+{
+    char *selectedName[NUM_SELECTED] = {"hLRT1", "hLRT2", "hLRT3", "hLRT4", "AIC"};
+
+    if (c == 0) {
+        strcpy(name, "name");
+        return STORE_NAME;
+    }
+    c--;
+    if (c < NUM_SELECTED) {
+        strcpy(name, selectedName[c]);
+        return STORE_MODEL;
+    }
+    c -= NUM_SELECTED;
+    if (c < 3 * NUM_MODELS) {
+        sprintf(name, "%s.%s", (c < NUM_MODELS) ? "lnL" : (c < 2 * NUM_MODELS) ? "AIC" : "w", modelSpec[c % NUM_MODELS].name);
+        return STORE_FLOAT;
+    }
+    strcpy(name, averagedName[c - 3 * NUM_MODELS]);
+
+    return STORE_FLOAT;
+}
+
+/************************* StoreWrite ****************************/
+/* Writes the results of the loci done by --batch to a columnar file
+   (--store=F): a header, the names and offsets of the columns, and then each
+   column as one array with a value for each locus, so that a query reads only
+   the columns it needs */
+static void StoreWrite(char *file)
+{
+    StoreHeaderSt header;
+    StoreColumnSt column[STORE_COLUMNS];
+    LocusResultSt *r;
+    FILE *fp;
+    char tmpName[FILENAME_MAX + 8];
+    float *values;
+    int *textOffsets;
+    int c, i, k, type, numText;
+    long long offset;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, 8);
+    header.numLoci = numStored;
+    header.numColumns = STORE_COLUMNS;
+    offset = PAD8(sizeof(header) + sizeof(column));
+    memset(column, 0, sizeof(column));
+    for (c = 0; c < STORE_COLUMNS; c++) {
+        column[c].type = StoreColumn(c, column[c].name);
+        column[c].offset = offset;
+        offset += PAD8((size_t) numStored * ((column[c].type == STORE_MODEL) ? 1 : 4));
+    }
+    header.textOffset = offset;
+
+    snprintf(tmpName, sizeof(tmpName), "%s.tmp", file);
+    if ((fp = fopen(tmpName, "wb")) == NULL) {
+        fprintf(stderr, "\nError: could not write the results store %s\n", file);
+        exit(1);
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(column, sizeof(column), 1, fp);
+    values = (float *) calloc(numStored + 2, sizeof(float));
+    textOffsets = (int *) values;
+    for (c = 0; c < STORE_COLUMNS; c++) {
+        fseek(fp, column[c].offset, SEEK_SET);
+        type = column[c].type;
+        k = c - 1 - NUM_SELECTED;
+        for (i = numText = 0; i < numStored; i++) {
+            r = &storedResult[i];
+            if (type == STORE_NAME) {
+                textOffsets[i] = numText;
+                numText += strlen(storedName[i]) + 1;
+            }
+            else if (type == STORE_MODEL) {
+                ((signed char *) values)[i] = r->selected[c - 1];
+            }
+            else if (k < NUM_MODELS) {
+                values[i] = r->lnL[k];
+            }
+            else if (k < 2 * NUM_MODELS) {
+                values[i] = r->AIC[k - NUM_MODELS];
+            }
+            else if (k < 3 * NUM_MODELS) {
+                values[i] = r->weight[k - 2 * NUM_MODELS];
+            }
+            else {
+                values[i] = r->averaged[k - 3 * NUM_MODELS];
+            }
+        }
+        fwrite(values, (type == STORE_MODEL) ? 1 : 4, numStored, fp);
+    }
+    fseek(fp, header.textOffset, SEEK_SET);
+    for (i = 0; i < numStored; i++) {
+        fwrite(storedName[i], 1, strlen(storedName[i]) + 1, fp);
+        free(storedName[i]);
+    }
+    free(values);
+    free(storedName);
+    free(storedResult);
+    if (fclose(fp) != 0 || rename(tmpName, file) != 0) {
+        fprintf(stderr, "\nError: could not write the results store %s\n", file);
+        exit(1);
+    }
+    fprintf(stderr, "\nResults of %d loci stored in %s (%d columns)\n", numStored, file, STORE_COLUMNS);
+}
+
+/************************* SummaryAdd ****************************/
+/* Adds the results of a locus to the summary of the loci of --batch */
+static void SummaryAdd(SummarySt *s, LocusResultSt *result)
+{
+    int i, m, all, numCompared;
+
+    s->numLoci++;
+    for (i = 0; i < NUM_SELECTED; i++) {
+        m = result->selected[i];
+        s->selected[i][(m < 0) ? NUM_MODELS : m]++;
+    }
+    all = YES;
+    numCompared = 0;
+    for (i = 0; i < NUM_SELECTED - 1; i++) {
+        if (result->selected[i] < 0 || result->selected[NUM_SELECTED - 1] < 0) {
+            continue;
+        }
+        numCompared++;
+        s->compared[i]++;
+        if (result->selected[i] == result->selected[NUM_SELECTED - 1]) {
+            s->agree[i]++;
+        }
+        else {
+            all = NO;
+        }
+    }
+    if (numCompared == NUM_SELECTED - 1) {
+        s->allCompared++;
+        s->allAgree += all;
+    }
+    for (i = 0; i < NUM_AVERAGED; i++) {
+        if (result->averaged[i] != NA) {
+            SketchAdd(&s->estimate[i], result->averaged[i]);
+        }
+    }
+}
+#endif
+
+/************************* SummaryMerge ****************************/
+/* Adds the summary b, of other loci, to a */
+static void SummaryMerge(SummarySt *a, SummarySt *b)
+{
+    int i, j;
+
+    a->numLoci += b->numLoci;
+    for (i = 0; i < NUM_SELECTED; i++) {
+        for (j = 0; j <= NUM_MODELS; j++) {
+            a->selected[i][j] += b->selected[i][j];
+        }
+    }
+    for (i = 0; i < NUM_SELECTED - 1; i++) {
+        a->agree[i] += b->agree[i];
+        a->compared[i] += b->compared[i];
+    }
+    a->allAgree += b->allAgree;
+    a->allCompared += b->allCompared;
+    for (i = 0; i < NUM_AVERAGED; i++) {
+        SketchMerge(&a->estimate[i], &b->estimate[i]);
+    }
+}
+
+#if !WIN
+/************************* SummarySave ****************************/
+/* Writes a summary to a file, to be merged with those of other runs (--merge) */
+static void SummarySave(SummarySt *s, char *file)
+{
+    FILE *fp;
+
+    memcpy(s->magic, SUMMARY_MAGIC, 8);
+    if ((fp = fopen(file, "wb")) == NULL || fwrite(s, sizeof(SummarySt), 1, fp) != 1 || fclose(fp) != 0) {
+        fprintf(stderr, "\nError: could not write the summary %s\n", file);
+        exit(1);
+    }
+}
+#endif
+
+/************************* MergeSummaries ****************************/
+/* Prints the summary of the loci of several runs, from the files of their
+   summaries (--merge=F,F...) */
+static void MergeSummaries()
+{
+    SummarySt *total, *part;
+    FILE *fp;
+    char *list, *file;
+
+    total = (SummarySt *) calloc(1, sizeof(SummarySt));
+    part = (SummarySt *) malloc(sizeof(SummarySt));
+    SummaryInit(total);
+    list = strdup(mergeFiles);
+    for (file = strtok(list, ","); file != NULL; file = strtok(NULL, ",")) {
+        if ((fp = fopen(file, "rb")) == NULL || fread(part, sizeof(SummarySt), 1, fp) != 1 || memcmp(part->magic, SUMMARY_MAGIC, 8) != 0) {
+            fprintf(stderr, "\nError: %s is not a summary of this version of %s\n", file, PROGRAM_NAME);
+            exit(1);
+        }
+        fclose(fp);
+        SummaryMerge(total, part);
+    }
+    free(list);
+    PrintSummary(total);
+    free(part);
+    free(total);
+}
+
+/************************* SummaryInit ****************************/
+static void SummaryInit(SummarySt *s)
+{
+    int i;
+
+    memset(s, 0, sizeof(SummarySt));
+    for (i = 0; i < NUM_AVERAGED; i++) {
+        s->estimate[i].min = HUGE_VAL;
+        s->estimate[i].max = -HUGE_VAL;
+    }
+}
+
+/************************* PrintSummary ****************************/
+/* Prints how often each model was selected, how often the hLRTs agree with
+   the AIC, and the distribution of the model-averaged estimates over the loci */
+static void PrintSummary(SummarySt *s)
+{
+    double q[5] = {0.05, 0.25, 0.5, 0.75, 0.95};
+    SketchSt *e;
+    int i, j;
+
+    printf("\n\n\n\n\n---------------------------------------------------------------");
+    printf("\n*                                                             *");
+    printf("\n*                    SUMMARY OF THE LOCI                      *");
+    printf("\n*                                                             *");
+    printf("\n---------------------------------------------------------------\n");
+    printf("\n %lld loci\n", s->numLoci);
+
+    printf("\n ** Models selected **\n");
+    printf("\nModel\t\thLRT1\thLRT2\thLRT3\thLRT4\tAIC");
+    for (j = 0; j <= NUM_MODELS; j++) {
+        for (i = 0; i < NUM_SELECTED && s->selected[i][j] == 0; i++) {
+            ;
+        }
+        if (i == NUM_SELECTED) {
+            continue;
+        }
+        printf("\n%-10s", (j < NUM_MODELS) ? modelSpec[j].name : "-");
+        for (i = 0; i < NUM_SELECTED; i++) {
+            printf("\t%lld", s->selected[i][j]);
+        }
+    }
+
+    printf("\n\n ** Agreement with the AIC model **\n");
+    for (i = 0; i < NUM_SELECTED - 1; i++) {
+        if (s->compared[i] > 0) {
+            printf("\n hLRT%d\t\t%lld of %lld loci (%.1f%%)", i + 1, s->agree[i], s->compared[i], 100.0 * s->agree[i] / s->compared[i]);
+        }
+    }
+    if (s->allCompared > 0) {
+        printf("\n All hLRTs\t%lld of %lld loci (%.1f%%)", s->allAgree, s->allCompared, 100.0 * s->allAgree / s->allCompared);
+    }
+
+    printf("\n\n ** Model-averaged estimates (quantiles within %.0f%%) **\n", 100.0 * SKETCH_ACCURACY);
+    printf("\nParameter\tn\tmean\tmin\t5%%\t25%%\tmedian\t75%%\t95%%\tmax");
+    for (i = 0; i < NUM_AVERAGED; i++) {
+        e = &s->estimate[i];
+        if (e->n == 0) {
+            printf("\n%-10s\t0", averagedName[i]);
+            continue;
+        }
+        printf("\n%-10s\t%lld\t%.4f\t%.4f", averagedName[i], e->n, e->sum / e->n, e->min);
+        for (j = 0; j < 5; j++) {
+            printf("\t%.4f", SketchQuantile(e, q[j]));
+        }
+        printf("\t%.4f", e->max);
+    }
+    printf("\n");
+}
+
+#if !WIN
+/************************* SketchAdd ****************************/
+/* Adds x to a quantile sketch: the counts of values in buckets of
+   logarithmically increasing width, so that any quantile is known to within
+   SKETCH_ACCURACY of its value, and sketches of different loci are merged by
+   adding the counts */
+static void SketchAdd(SketchSt *sketch, double x)
+{
+    int k;
+
+    sketch->n++;
+    sketch->sum += x;
+    sketch->min = MIN(sketch->min, x);
+    sketch->max = MAX(sketch->max, x);
+    if (x <= SKETCH_MIN) {
+        sketch->numZero++;
+        return;
+    }
+    k = (int) ceil(log(x / SKETCH_MIN) / log(SKETCH_GAMMA));
+    sketch->count[MIN(MAX(k, 0), SKETCH_BUCKETS - 1)]++;
+}
+#endif
+
+/************************* SketchMerge ****************************/
+static void SketchMerge(SketchSt *a, SketchSt *b)
+{
+    int k;
+
+    for (k = 0; k < SKETCH_BUCKETS; k++) {
+        a->count[k] += b->count[k];
+    }
+    a->numZero += b->numZero;
+    a->n += b->n;
+    a->sum += b->sum;
+    a->min = MIN(a->min, b->min);
+    a->max = MAX(a->max, b->max);
+}
+
+/************************* SketchQuantile ****************************/
+/* The q quantile of the values of a sketch */
+static double SketchQuantile(SketchSt *sketch, double q)
+{
+    long long rank, seen;
+    double x;
+    int k;
+
+    rank = (long long) (q * (sketch->n - 1));
+    seen = sketch->numZero;
+    if (rank < seen) {
+        return sketch->min;
+    }
+    for (k = 0; k < SKETCH_BUCKETS; k++) {
+        seen += sketch->count[k];
+        if (rank < seen) {
+            break;
+        }
+    }
+    /* the middle of the bucket, in relative terms */
+    x = SKETCH_MIN * 2.0 * pow(SKETCH_GAMMA, k) / (SKETCH_GAMMA + 1.0);
+
+    return MIN(MAX(x, sketch->min), sketch->max);
+}
+
+#if !WIN
+/************************* MetricsWriter ****************************/
+/* Thread that rewrites the metrics file of --batch (--metrics=F) every
+   --metrics-interval seconds, and once more when the batch ends, in the text
+   format of Prometheus, so that a long run can be followed as it goes */
+static void *MetricsWriter(void *arg)
+{
+    struct timespec wake;
+    int quit;
+
+    (void) arg;
+    pthread_mutex_lock(&metricsLock);
+    do {
+        wake.tv_sec = time(NULL) + metricsInterval;
+        wake.tv_nsec = 0;
+        while (metricsQuit == NO && pthread_cond_timedwait(&metricsWake, &metricsLock, &wake) == 0)
+            ;
+        quit = metricsQuit;
+        pthread_mutex_unlock(&metricsLock);
+        WriteMetrics();
+        pthread_mutex_lock(&metricsLock);
+    } while (quit == NO);
+    pthread_mutex_unlock(&metricsLock);
+
+    return NULL;
+}
+
+/************************* WriteMetrics ****************************/
+/* Writes the metrics of the batch to a new file that then replaces the last */
+static void WriteMetrics()
+{
+    char *stageName[NUM_STAGES] = {"read", "compute", "write"};
+    char *errorName[NUM_ERRORS] = {"open", "incomplete", "failed"};
+    char tmpName[FILENAME_MAX + 8];
+    struct rusage self, children;
+    FILE *fp;
+    long long rssScale;
+    double uptime;
+    int i, k, readDepth, writeDepth;
+
+    snprintf(tmpName, sizeof(tmpName), "%s.tmp", metricsFile);
+    if ((fp = fopen(tmpName, "w")) == NULL) {
+        fprintf(stderr, "\nWarning: could not write the metrics %s\n", metricsFile);
+        return;
+    }
+    pthread_mutex_lock(&readQueue.lock);
+    readDepth = readQueue.count;
+    pthread_mutex_unlock(&readQueue.lock);
+    pthread_mutex_lock(&writeQueue.lock);
+    writeDepth = writeQueue.count;
+    pthread_mutex_unlock(&writeQueue.lock);
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+#ifdef __APPLE__
+    rssScale = 1;                   /* ru_maxrss in bytes */
+#else
+    rssScale = 1024;                /* in kilobytes */
+#endif
+
+    pthread_mutex_lock(&metricsLock);
+    uptime = WallSeconds() - metrics.start;
+    fprintf(fp, "# HELP mrmodeltest2_loci_total Loci done (models selected).\n");
+    fprintf(fp, "# TYPE mrmodeltest2_loci_total counter\n");
+    fprintf(fp, "mrmodeltest2_loci_total %lld\n", metrics.numLoci);
+    fprintf(fp, "# HELP mrmodeltest2_errors_total Loci that failed, by the type of error.\n");
+    fprintf(fp, "# TYPE mrmodeltest2_errors_total counter\n");
+    for (i = 0; i < NUM_ERRORS; i++) {
+        fprintf(fp, "mrmodeltest2_errors_total{type=\"%s\"} %lld\n", errorName[i], metrics.numErrors[i]);
+    }
+    fprintf(fp, "# HELP mrmodeltest2_loci_per_second Loci done or failed per second since the start.\n");
+    fprintf(fp, "# TYPE mrmodeltest2_loci_per_second gauge\n");
+    fprintf(fp, "mrmodeltest2_loci_per_second %.3f\n", (uptime > 0) ? (metrics.numLoci + metrics.numErrors[0] + metrics.numErrors[1] + metrics.numErrors[2]) / uptime : 0.0);
+    fprintf(fp, "# HELP mrmodeltest2_stage_seconds Seconds a locus spent in each stage.\n");
+    fprintf(fp, "# TYPE mrmodeltest2_stage_seconds histogram\n");
+    for (k = 0; k < NUM_STAGES; k++) {
+        for (i = 0; i < NUM_METRICS_BUCKETS; i++) {
+            fprintf(fp, "mrmodeltest2_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %lld\n", stageName[k], metricsBucket[i], metrics.bucket[k][i]);
+        }
+        fprintf(fp, "mrmodeltest2_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lld\n", stageName[k], metrics.count[k]);
+        fprintf(fp, "mrmodeltest2_stage_seconds_sum{stage=\"%s\"} %.6f\n", stageName[k], metrics.sum[k]);
+        fprintf(fp, "mrmodeltest2_stage_seconds_count{stage=\"%s\"} %lld\n", stageName[k], metrics.count[k]);
+    }
+    pthread_mutex_unlock(&metricsLock);
+    fprintf(fp, "# HELP mrmodeltest2_queue_depth Loci waiting between two stages.\n");
+    fprintf(fp, "# TYPE mrmodeltest2_queue_depth gauge\n");
+    fprintf(fp, "mrmodeltest2_queue_depth{queue=\"read\"} %d\n", readDepth);
+    fprintf(fp, "mrmodeltest2_queue_depth{queue=\"write\"} %d\n", writeDepth);
+    fprintf(fp, "# HELP mrmodeltest2_peak_rss_bytes Largest resident memory of the program and of a locus process.\n");
+    fprintf(fp, "# TYPE mrmodeltest2_peak_rss_bytes gauge\n");
+    fprintf(fp, "mrmodeltest2_peak_rss_bytes{process=\"main\"} %lld\n", (long long) self.ru_maxrss * rssScale);
+    fprintf(fp, "mrmodeltest2_peak_rss_bytes{process=\"locus\"} %lld\n", (long long) children.ru_maxrss * rssScale);
+    fprintf(fp, "# HELP mrmodeltest2_uptime_seconds Seconds since the batch started.\n");
+    fprintf(fp, "# TYPE mrmodeltest2_uptime_seconds gauge\n");
+    fprintf(fp, "mrmodeltest2_uptime_seconds %.3f\n", uptime);
+    if (fclose(fp) != 0 || rename(tmpName, metricsFile) != 0) {
+        fprintf(stderr, "\nWarning: could not write the metrics %s\n", metricsFile);
+    }
+}
+
+/************************* MetricsStage ****************************/
+/* Counts seconds spent by a locus in a stage of --batch */
+static void MetricsStage(int stage, double seconds)
+{
+    int i;
+
+    if (metricsFile == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&metricsLock);
+    for (i = 0; i < NUM_METRICS_BUCKETS; i++) {
+        if (seconds <= metricsBucket[i]) {
+            metrics.bucket[stage][i]++;
+        }
+    }
+    metrics.count[stage]++;
+    metrics.sum[stage] += seconds;
+    pthread_mutex_unlock(&metricsLock);
+}
+
+/************************* MetricsLocus ****************************/
+/* Counts a locus of --batch done, or failed with an error of type error (or -1) */
+static void MetricsLocus(int error)
+{
+    if (metricsFile == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&metricsLock);
+    if (error < 0) {
+        metrics.numLoci++;
+    }
+    else {
+        metrics.numErrors[error]++;
+    }
+    pthread_mutex_unlock(&metricsLock);
+}
+#endif
+
+/************************* StartProfile ****************************/
+/* Sets up the profile of the numeric kernels (--profile): hardware counters
+   of the calling thread where the system gives them (Linux perf events),
+   otherwise only the times */
+static void StartProfile()
+{
+    ProfileSt snapshot;
+
+    pthread_key_create(&profileKey, EndProfileThread);
+    memset(profile, 0, sizeof(profile));
+    profileCounters = YES;
+    ProfileBegin(&snapshot);
+    if (snapshot.counters == NO) {
+        profileCounters = NO;
+    }
+}
+
+/************************* ProfileBegin ****************************/
+/* Takes the counters of the calling thread at the start of a region */
+static void ProfileBegin(ProfileSt *snapshot)
+{
+    ProfileThreadSt *t;
+#ifdef __linux__
+    struct {
+        unsigned long long nr;
+        unsigned long long values[PROFILE_COUNTERS];
+    } group;
+#endif
+
+    if ((t = (ProfileThreadSt *) pthread_getspecific(profileKey)) == NULL) {
+        t = OpenProfileThread();
+    }
+    snapshot->counters = NO;
+#ifdef __linux__
+    if (t->group >= 0 && read(t->group, &group, sizeof(group)) == (ssize_t) sizeof(group)) {
+        memcpy(snapshot->value, group.values, sizeof(snapshot->value));
+        snapshot->counters = YES;
+    }
+#endif
+    snapshot->seconds = WallSeconds();
+}
+
+/************************* ProfileEnd ****************************/
+/* Adds what the calling thread counted since ProfileBegin() to a region, for
+   units patterns, models or calls */
+static void ProfileEnd(int region, ProfileSt *start, long units)
+{
+    ProfileSt end;
+    int i;
+
+    ProfileBegin(&end);
+    pthread_mutex_lock(&profileLock);
+    profile[region].calls++;
+    profile[region].units += units;
+    profile[region].seconds += end.seconds - start->seconds;
+    if (start->counters == YES && end.counters == YES) {
+        profile[region].countedCalls++;
+        for (i = 0; i < PROFILE_COUNTERS; i++) {
+            profile[region].value[i] += end.value[i] - start->value[i];
+        }
+    }
+    pthread_mutex_unlock(&profileLock);
+}
+
+#if !WIN
+/************************* ProfileChild ****************************/
+/* Starts the profile again in the process of a locus of --batch, which must
+   not go on with the counters of the thread it was forked from */
+static void ProfileChild()
+{
+    ProfileThreadSt *t;
+
+    if ((t = (ProfileThreadSt *) pthread_getspecific(profileKey)) != NULL) {
+        EndProfileThread(t);
+        pthread_setspecific(profileKey, NULL);
+    }
+    memset(profile, 0, sizeof(profile));
+}
+#endif
+
+/************************* OpenProfileThread ****************************/
+/* Opens the counters of the calling thread: cycles, instructions, cache
+   misses and branch misses in user space, as one group read at once. The
+   thread is given none if the system does not allow them (e.g. in many
+   containers and virtual machines) */
+static ProfileThreadSt *OpenProfileThread()
+{
+    ProfileThreadSt *t;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    unsigned long long config[PROFILE_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                   PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    int i, fd;
+#endif
+
+    t = (ProfileThreadSt *) malloc(sizeof(ProfileThreadSt));
+    t->group = -1;
+#ifdef __linux__
+    for (i = 0; i < PROFILE_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config[i];
+        attr.disabled = (i == 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, (i == 0) ? -1 : t->group, 0);
+        if (fd < 0) {
+            if (profileError == 0) {
+                profileError = errno;
+            }
+            if (t->group >= 0) {
+                close(t->group);    /* closing the leader closes the group */
+                t->group = -1;
+            }
+            break;
+        }
+        if (i == 0) {
+            t->group = fd;
+        }
+    }
+    if (t->group >= 0) {
+        ioctl(t->group, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(t->group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+    pthread_setspecific(profileKey, t);
+
+    return t;
+}
+
+/************************* EndProfileThread ****************************/
+/* Closes the counters of a thread that ends */
+static void EndProfileThread(void *arg)
+{
+    ProfileThreadSt *t;
+
+    t = (ProfileThreadSt *) arg;
+    if (t->group >= 0) {
+        close(t->group);
+    }
+    free(t);
+}
+
+/************************* PrintProfile ****************************/
+/* Prints the profile of the numeric kernels: time, and with the hardware
+   counters the cycles, instructions, cache misses and branch misses per unit
+   (site pattern for the likelihood kernels, model for AkaikeWeights(), call
+   for ChiSquare() and Normalz(), whose calls from ChiSquare() are counted in
+   both) and the instructions per cycle */
+static void PrintProfile()
+{
+    char *regionName[NUM_PROFILE] = {"ChiSquare", "Normalz", "AkaikeWeights", "NodePartial", "SumOfProducts", "ChunkLnL"};
+    char *unitName[NUM_PROFILE] = {"call", "call", "model", "pattern", "pattern", "pattern"};
+    ProfileRegionSt *r;
+    double n;
+    int i;
+
+    printf("\n\n\n ** Profile of the numeric kernels (--profile) **\n");
+    if (profileCounters == NO) {
+        printf("\n Hardware counters are not available here (%s); only the times are given.",
+            (profileError != 0) ? strerror(profileError) : "not Linux");
+        printf("\n They need /proc/sys/kernel/perf_event_paranoid at most 2 and a machine that gives them (many");
+        printf("\n containers and virtual machines do not).\n");
+        printf("\nRegion           Calls         Units      Seconds   ns/unit");
+        for (i = 0; i < NUM_PROFILE; i++) {
+            r = &profile[i];
+            if (r->calls > 0) {
+                printf("\n%-14s %7lld %13lld %-7s %8.4f %9.2f", regionName[i], r->calls, r->units, unitName[i],
+                    r->seconds, 1e9 * r->seconds / MAX(1, r->units));
+            }
+        }
+        printf("\n");
+        return;
+    }
+    printf("\n Per unit: cycles, instructions, cache misses and branch misses\n");
+    printf("\nRegion           Calls         Units      Seconds    Cycles    Instr    IPC  Cache-miss  Branch-miss");
+    for (i = 0; i < NUM_PROFILE; i++) {
+        r = &profile[i];
+        if (r->calls == 0) {
+            continue;
+        }
+        /* the units of the calls counted, if a thread had no counters */
+        n = MAX(1.0, (double) r->units * r->countedCalls / r->calls);
+        printf("\n%-14s %7lld %13lld %-7s %8.4f %9.1f %8.1f %6.2f %11.4f %12.4f", regionName[i], r->calls, r->units, unitName[i],
+            r->seconds, r->value[0] / n, r->value[1] / n, (r->value[0] > 0) ? (double) r->value[1] / r->value[0] : 0.0,
+            r->value[2] / n, r->value[3] / n);
+    }
+    printf("\n");
+}
+
+/************************* QueryStore ****************************/
+/* Queries a results store written by --batch --store=F (--query=F): the loci
+   that meet all the conditions of --where=C,C... (e.g. hLRT1!=AIC or
+   alphaG>1, NA never meets a condition) are listed with the columns of
+   --show=C,C..., and --stats=C,C... summarizes columns over them: how often
+   each model was selected, or the mean and quantiles of the values */
+static void QueryStore()
+{
+#if WIN
+    fprintf(stderr, "\nError: --query is not available on Windows\n");
+    exit(1);
+#else
+    StoreHeaderSt *header;
+    StoreColumnSt *column;
+    QueryConditionSt condition[STORE_COLUMNS];
+    struct stat st;
+    char *map, *list, *token, show[STORE_COLUMNS], stats[STORE_COLUMNS], *text;
+    int fd, c, i, numConditions, numShown, numStats, numMatched, *matched, *textOffsets;
+    double start;
+
+    start = WallSeconds();
+    if ((fd = open(queryFile, O_RDONLY)) < 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(StoreHeaderSt)) {
+        fprintf(stderr, "\nError: could not read the results store %s\n", queryFile);
+        exit(1);
+    }
+    if ((map = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "\nError: could not map the results store %s\n", queryFile);
+        exit(1);
+    }
+    close(fd);
+    header = (StoreHeaderSt *) map;
+    column = (StoreColumnSt *) (map + sizeof(StoreHeaderSt));
+    if (memcmp(header->magic, STORE_MAGIC, 8) != 0 || header->numColumns != STORE_COLUMNS || header->textOffset > st.st_size) {
+        fprintf(stderr, "\nError: %s is not a results store of this version of %s\n", queryFile, PROGRAM_NAME);
+        exit(1);
+    }
+    storeMap = map;
+    storeColumns = column;
+
+    /* the conditions and the columns asked for */
+    numConditions = 0;
+    if (queryWhere != NULL) {
+        list = strdup(queryWhere);
+        for (token = strtok(list, ","); token != NULL; token = strtok(NULL, ",")) {
+            QueryCondition(token, &condition[numConditions++]);
+        }
+        free(list);
+    }
+    numShown = QueryColumns((queryShow == NULL && queryStats == NULL) ? "name" : queryShow, show);
+    numStats = QueryColumns(queryStats, stats);
+
+    /* the loci that meet the conditions */
+    matched = (int *) malloc((header->numLoci + 1) * sizeof(int));
+    numMatched = 0;
+    for (i = 0; i < header->numLoci; i++) {
+        for (c = 0; c < numConditions; c++) {
+            if (QueryTest(&condition[c], i) == NO) {
+                break;
+            }
+        }
+        if (c == numConditions) {
+            matched[numMatched++] = i;
+        }
+    }
+
+    if (numShown > 0) {
+        for (c = 0; c < numShown; c++) {
+            printf("%s%s", (c > 0) ? "\t" : "", column[(int) show[c]].name);
+        }
+        printf("\n");
+        textOffsets = (int *) (map + column[0].offset);
+        text = map + header->textOffset;
+        for (i = 0; i < numMatched; i++) {
+            for (c = 0; c < numShown; c++) {
+                printf("%s", (c > 0) ? "\t" : "");
+                if (column[(int) show[c]].type == STORE_NAME) {
+                    printf("%s", text + textOffsets[matched[i]]);
+                }
+                else {
+                    QueryPrintValue(show[c], matched[i]);
+                }
+            }
+            printf("\n");
+        }
+    }
+    for (c = 0; c < numStats; c++) {
+        QueryStats(stats[c], matched, numMatched);
+    }
+    fprintf(stderr, "\n%d of %d loci match (%.3f seconds)\n", numMatched, header->numLoci, WallSeconds() - start);
+    free(matched);
+    munmap(map, st.st_size);
+#endif
+}
+
+#if !WIN
+/************************* QueryColumns ****************************/
+/* Columns named in the comma-separated list into c[], and how many */
+static int QueryColumns(char *list, char *c)
+{
+    char *copy, *token;
+    int n;
+
+    if (list == NULL) {
+        return 0;
+    }
+    copy = strdup(list);
+    n = 0;
+    for (token = strtok(copy, ","); token != NULL && n < STORE_COLUMNS; token = strtok(NULL, ",")) {
+        c[n++] = QueryColumn(token);
+    }
+    free(copy);
+
+    return n;
+}
+
+/************************* QueryColumn ****************************/
+/* Column of the results store named name, or an error if there is none */
+static int QueryColumn(char *name)
+{
+    int c;
+
+    if ((c = QueryFindColumn(name)) < 0) {
+        fprintf(stderr, "\nError: no column %s in the results store (columns: name, hLRT1-4, AIC, lnL.<model>, AIC.<model>, w.<model>,", name);
+        for (c = 1 + NUM_SELECTED + 3 * NUM_MODELS; c < STORE_COLUMNS; c++) {
+            fprintf(stderr, " %s", storeColumns[c].name);
+        }
+        fprintf(stderr, ")\n");
+        exit(1);
+    }
+
+    return c;
+}
+
+/************************* QueryFindColumn ****************************/
+static int QueryFindColumn(char *name)
+{
+    int c;
+
+    for (c = 0; c < STORE_COLUMNS; c++) {
+        if (!strcmp(storeColumns[c].name, name)) {
+            return c;
+        }
+    }
+
+    return -1;
+}
+
+/************************* QueryCondition ****************************/
+/* Parses a condition column<op>value of --where, where op is one of = != < >
+   <= >= and value a number, a model name or another column */
+static void QueryCondition(char *text, QueryConditionSt *condition)
+{
+    char name[32], *op;
+    size_t n;
+
+    if ((op = strpbrk(text, "<>=!")) == NULL || (n = op - text) == 0 || n >= sizeof(name)) {
+        fprintf(stderr, "\nError: the condition %s is not column<op>value\n", text);
+        exit(1);
+    }
+    strncpy(name, text, n);
+    name[n] = '\0';
+    condition->column = QueryColumn(name);
+    condition->op = (op[1] == '=') ? ((op[0] == '<') ? QUERY_LE : (op[0] == '>') ? QUERY_GE : (op[0] == '!') ? QUERY_NE : QUERY_EQ)
+                  : ((op[0] == '<') ? QUERY_LT : (op[0] == '>') ? QUERY_GT : (op[0] == '=') ? QUERY_EQ : -1);
+    if (condition->op < 0) {
+        fprintf(stderr, "\nError: unknown comparison in %s\n", text);
+        exit(1);
+    }
+    op += (op[1] == '=' && op[0] != '=') ? 2 : 1;
+    if (storeColumns[condition->column].type == STORE_NAME) {
+        fprintf(stderr, "\nError: the locus names cannot be compared (%s)\n", text);
+        exit(1);
+    }
+    condition->other = QueryFindColumn(op);
+    if (condition->other >= 0 && storeColumns[condition->other].type == STORE_NAME) {
+        condition->other = -1;
+    }
+    if (condition->other < 0) {
+        if (storeColumns[condition->column].type == STORE_MODEL) {
+            if ((condition->value = ModelNumber(op)) < 0) {
+                fprintf(stderr, "\nError: unknown model %s in %s\n", op, text);
+                exit(1);
+            }
+        }
+        else {
+            condition->value = atof(op);
+        }
+    }
+}
+
+/************************* QueryTest ****************************/
+/* YES if locus i meets the condition */
+static int QueryTest(QueryConditionSt *condition, int i)
+{
+    double a, b;
+
+    a = QueryValue(condition->column, i);
+    b = (condition->other >= 0) ? QueryValue(condition->other, i) : condition->value;
+    if (a == NA || b == NA) {
+        return NO;
+    }
+    switch (condition->op) {
+    case QUERY_EQ:
+        return (a == b) ? YES : NO;
+    case QUERY_NE:
+        return (a != b) ? YES : NO;
+    case QUERY_LT:
+        return (a < b) ? YES : NO;
+    case QUERY_GT:
+        return (a > b) ? YES : NO;
+    case QUERY_LE:
+        return (a <= b) ? YES : NO;
+    default:
+        return (a >= b) ? YES : NO;
+    }
+}
+
+/************************* QueryValue ****************************/
+/* Value of column c for locus i, NA for none (a model index for the models
+   selected) */
+static double QueryValue(int c, int i)
+{
+    signed char m;
+    float x;
+
+    if (storeColumns[c].type == STORE_MODEL) {
+        m = ((signed char *) (storeMap + storeColumns[c].offset))[i];
+        return (m < 0) ? NA : m;
+    }
+    x = ((float *) (storeMap + storeColumns[c].offset))[i];
+
+    return (x == NA) ? NA : x;
+}
+
+/************************* QueryPrintValue ****************************/
+static void QueryPrintValue(int c, int i)
+{
+    double x;
+
+    x = QueryValue(c, i);
+    if (x == NA) {
+        printf("-");
+    }
+    else if (storeColumns[c].type == STORE_MODEL) {
+        printf("%s", modelSpec[(int) x].name);
+    }
+    else {
+        printf("%.4f", x);
+    }
+}
+
+/************************* QueryStats ****************************/
+/* Prints how often each model was selected in column c over the loci matched,
+   or the mean and quantiles of its values */
+static void QueryStats(int c, int *matched, int numMatched)
+{
+    double *x, sum;
+    int count[NUM_MODELS], i, n, numNA;
+
+    printf("\n%s\n", storeColumns[c].name);
+    if (storeColumns[c].type == STORE_MODEL) {
+        memset(count, 0, sizeof(count));
+        for (i = numNA = 0; i < numMatched; i++) {
+            if ((sum = QueryValue(c, matched[i])) == NA) {
+                numNA++;
+            }
+            else {
+                count[(int) sum]++;
+            }
+        }
+        for (i = 0; i < NUM_MODELS; i++) {
+            if (count[i] > 0) {
+                printf(" %-10s %8d  %6.2f%%\n", modelSpec[i].name, count[i], 100.0 * count[i] / numMatched);
+            }
+        }
+        if (numNA > 0) {
+            printf(" %-10s %8d  %6.2f%%\n", "-", numNA, 100.0 * numNA / numMatched);
+        }
+        return;
+    }
+    x = (double *) malloc((numMatched + 1) * sizeof(double));
+    sum = 0.0;
+    for (i = n = 0; i < numMatched; i++) {
+        if ((x[n] = QueryValue(c, matched[i])) != NA) {
+            sum += x[n++];
+        }
+    }
+    if (n == 0) {
+        printf(" no values\n");
+    }
+    else {
+        qsort(x, n, sizeof(double), CompareDoubles);
+        printf(" n %d  mean %.4f  min %.4f  q25 %.4f  median %.4f  q75 %.4f  max %.4f\n", n, sum / n, x[0],
+            x[(n - 1) / 4], x[(n - 1) / 2], x[3 * (n - 1) / 4], x[n - 1]);
+    }
+    free(x);
+}
+
+/************************* CompareDoubles ****************************/
+static int CompareDoubles(const void *a, const void *b)
+{
+    double x, y;
+
+    x = *(const double *) a;
+    y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+#endif
+
+/************************* NativeScores ****************************/
+/* Calculates the likelihood scores of the 24 models from an alignment and
+   a tree, instead of reading them from PAUP*. The estimates are stored in
+   score[] in the same order as in the PAUP* scorefile. */
+static void NativeScores()
+{
+    PrepareNative();
+    RunModels(NULL, 0, YES);
+    Initialize();
+    if (print_scores == YES) {
+        PrintLikelihoodScores();
+    }
+}
+
+/************************* PrepareNative ****************************/
+/* Reads the alignment and the tree (or builds one) */
+static void PrepareNative()
+{
+    ReadAlignment(alignmentFile);
+    if (treeFile != NULL) {
+        ReadTree(treeFile);
+    }
+    else {
+        NeighborJoiningTree();
+    }
+    printf("\nInput format: alignment (likelihood scores calculated by %s)", PROGRAM_NAME);
+    printf("\n Alignment: %s (%d taxa, %d characters, %d site patterns)", alignmentFile,
+        alignment->numTaxa, alignment->numChars, alignment->numPatterns);
+    if (treeFile != NULL) {
+        printf("\n Tree: %s\n", treeFile);
+    }
+    else {
+        printf("\n Tree: neighbor-joining on %s distances\n", (useK80Distances == YES) ? "K80" : "JC");
+    }
+    if (DEBUGLEVEL >= 2) {
+        fprintf(stderr, "\nINFO:   tree ");
+        PrintNewick(stderr, tree->root, -1);
+        fprintf(stderr, ";");
+    }
+    format = 0;
+    StartCheckpoints();
+}
+
+/************************* RunModels ****************************/
+/* Calculates the 24 models for the alignment, or for each partition in list.
+   With hLRTs, the models the hLRTs test are all optimized to the end. */
+static void RunModels(PartSt **list, int count, int hLRTs)
+{
+    int i, k, m, n, numPatterns, numChunks;
+    unsigned char *approx;
+    PartSt **todo;
+
+    /* data sets calculated before are taken from the results cache */
+    todo = NULL;
+    if (cacheDir != NULL) {
+        if (count == 0) {
+            if (LoadResults(alignment, score, modelApprox) == SUCCESS) {
+                return;
+            }
+        }
+        else {
+            todo = (PartSt**) malloc(count * sizeof(PartSt*));
+            for (i = 0, n = 0; i < count; i++) {
+                if (LoadResults(list[i]->data, list[i]->score, list[i]->approx) == FAILURE) {
+                    todo[n++] = list[i];
+                }
+            }
+            list = todo;
+            count = n;
+            if (count == 0) {
+                free(todo);
+                return;
+            }
+        }
+    }
+    runPart = list;
+    numRunParts = count;
+    /* long alignments are split among threads within each model, short ones
+       are run with one thread per model */
+    numPatterns = alignment->numPatterns;
+    if (count > 0) {
+        for (i = 0, numPatterns = 0; i < count; i++) {
+            numPatterns = MAX(numPatterns, list[i]->data->numPatterns);
+        }
+    }
+    numChunks = (numPatterns + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    siteThreads = MIN(numThreads, MAX(1, numChunks / CHUNKS_PER_THREAD));
+    modelThreads = MIN(MAX(1, count) * NUM_MODELS, MAX(1, numThreads / siteThreads));
+    if (DEBUGLEVEL >= 2) {
+        fprintf(stderr, "\nINFO:   %d model thread(s) with %d site thread(s) each", modelThreads, siteThreads);
+    }
+    if (screenDelta > 0) {
+        ScreenModels(list, count);
+    }
+    if (useBound == YES) {
+        boundLnL = (double*) malloc(MAX(1, count) * NUM_MODELS * sizeof(double));
+        boundMinAIC = (double*) malloc(MAX(1, count) * sizeof(double));
+        taskRounds = (int*) calloc(MAX(1, count) * NUM_MODELS, sizeof(int));
+        for (i = 0; i < MAX(1, count) * NUM_MODELS; i++) {
+            boundLnL[i] = HUGE_VAL;
+        }
+        for (i = 0; i < MAX(1, count); i++) {
+            boundMinAIC[i] = HUGE_VAL;
+        }
+        AllocateModelStates(MAX(1, count) * NUM_MODELS);    /* stopped models may be continued */
+        boundScheme = (hLRTs == NO) ? YES : NO;
+    }
+    if (deadline > 0) {
+        DeadlinePasses(list, count);
+    }
+    else {
+        RunTasks();
+    }
+    if (useBound == YES) {
+        RecheckBounds(list, count);
+        PrintBounds(list, count);
+        free(boundLnL);
+        free(boundMinAIC);
+        boundLnL = boundMinAIC = NULL;
+    }
+    for (k = 0; k < MAX(1, count); k++) {
+        approx = (count > 0) ? list[k]->approx : modelApprox;
+        for (m = n = 0; m < NUM_MODELS; m++) {
+            approx[m] = ((runTask != NULL && runTask[k * NUM_MODELS + m] == NO)
+                || (taskRounds != NULL && taskRounds[k * NUM_MODELS + m] < 0)) ? YES : NO;
+            if (passesDone != NULL && passesDone[k * NUM_MODELS + m] == NUM_PASSES) {
+                n++;
+            }
+        }
+        /* with --deadline the models that did not converge are left out,
+           unless none did, as the selection is then all there is */
+        for (m = 0; m < NUM_MODELS && passesDone != NULL && n > 0; m++) {
+            if (passesDone[k * NUM_MODELS + m] < NUM_PASSES) {
+                approx[m] = YES;
+            }
+        }
+    }
+    free(taskRounds);
+    taskRounds = NULL;
+    free(passesDone);
+    passesDone = NULL;
+    if (hLRTs == YES && (screenDelta > 0 || useBound == YES) && deadline == 0) {
+        CompleteHierarchies(list, count);
+    }
+    KeepNested(list, count);
+    free(runTask);
+    runTask = NULL;
+    if (modelState != NULL) {
+        for (i = 0; i < MAX(1, count) * NUM_MODELS; i++) {
+            free(modelState[i].brlen);
+        }
+        free(modelState);
+        modelState = NULL;
+    }
+    if (cacheDir != NULL && deadlinePassed == NO) {
+        if (count == 0) {
+            SaveResults(alignment, score, modelApprox);
+        }
+        for (i = 0; i < count; i++) {
+            SaveResults(list[i]->data, list[i]->score, list[i]->approx);
+        }
+    }
+    free(todo);
+    if (DEBUGLEVEL >= 2) {
+        fprintf(stderr, "\nINFO:   discrete gamma rates: %ld cached, %ld calculated", gammaCacheHits, gammaCacheMisses);
+        fprintf(stderr, "\nINFO:   shape likelihoods: %ld reused", shapePointsReused);
+        fprintf(stderr, "\nINFO:   partial likelihoods: %ld updated, %ld updates avoided\n", partialUpdates, partialUpdatesAvoided);
+    }
+}
+
+/************************* RunTasks ****************************/
+/* Runs ModelWorker() on modelThreads threads until all models are done */
+static void RunTasks()
+{
+    int i;
+    pthread_t *worker;
+
+    nextModel = 0;
+    worker = (pthread_t*) malloc(modelThreads * sizeof(pthread_t));
+    for (i = 1; i < modelThreads; i++) {
+        if (pthread_create(&worker[i], NULL, ModelWorker, NULL) != 0) {
+            fprintf(stderr, "\nError: could not start thread\n");
+            exit(1);
+        }
+    }
+    ModelWorker(NULL);
+    for (i = 1; i < modelThreads; i++) {
+        pthread_join(worker[i], NULL);
+    }
+    free(worker);
+    fprintf(stderr, "\n");
+}
+
+/************************* AllocateModelStates ****************************/
+static void AllocateModelStates(int numTasks)
+{
+    int i;
+
+    if (modelState != NULL) {
+        return;
+    }
+    modelState = (CheckpointSt*) calloc(numTasks, sizeof(CheckpointSt));
+    for (i = 0; i < numTasks; i++) {
+        modelState[i].done = NA;
+        modelState[i].brlen = (double*) malloc(tree->numEdges * sizeof(double));
+    }
+}
+
+/************************* DeadlinePasses ****************************/
+/* Anytime calculation of the models (--deadline): the models are optimized
+   in passes of decreasing tolerance (passTolerances[]), each continuing from
+   the last, in the order of modelOrder[]. When the deadline passes the
+   models are left as they are, and the selection is made from the scores
+   of the models that converged (RunModels() marks the others in
+   modelApprox[]). The state of each model is printed. */
+static void DeadlinePasses(PartSt **list, int count)
+{
+    int k, m, p, task;
+    float *scores;
+
+    AllocateModelStates(MAX(1, count) * NUM_MODELS);
+    passesDone = (int*) calloc(MAX(1, count) * NUM_MODELS, sizeof(int));
+    for (p = 0; p < NUM_PASSES && deadlinePassed == NO; p++) {
+        fprintf(stderr, "\n** Pass %d of %d (lnL tolerance %g) **", p + 1, NUM_PASSES, passTolerances[p]);
+        passTolerance = passTolerances[p];
+        RunTasks();
+    }
+    passTolerance = 0.0;
+    printf("\n Deadline: %s; passes with lnL tolerance", (deadlinePassed == YES) ? "reached" : "not reached");
+    for (p = 0; p < NUM_PASSES; p++) {
+        printf(" %g", passTolerances[p]);
+    }
+    for (k = 0; k < MAX(1, count); k++) {
+        scores = (count > 0) ? list[k]->score : score;
+        if (count > 0) {
+            printf("\n   %s:", list[k]->name);
+        }
+        for (m = 0; m < NUM_MODELS; m++) {
+            task = k * NUM_MODELS + m;
+            if (runTask != NULL && runTask[task] == NO) {
+                continue;
+            }
+            printf("\n   %-10.10s -lnL = %10.4f  ", modelSpec[m].name, scores[modelSpec[m].scoreIndex + 1]);
+            if (passesDone[task] == NUM_PASSES) {
+                printf("converged");
+            }
+            else if (passesDone[task] > 0) {
+                printf("not converged (lnL tolerance %g reached)", passTolerances[passesDone[task] - 1]);
+            }
+            else if (modelState[task].done != NA) {
+                printf("not converged (first pass not finished)");
+            }
+            else {
+                printf("starting values");
+            }
+        }
+    }
+    printf("\n");
+}
+
+/************************* ScreenModels ****************************/
+/* Screening of the models (--screen): all models are first optimized for
+   a loose tolerance (SCREEN_TOLERANCE), and only those whose AIC is then within screenDelta
+   of the best are marked in runTask[] to be optimized to the end, starting
+   from where the screening left them. The others keep their screened
+   scores, which can only be worse than the optimal ones, and are marked in
+   modelApprox[] by RunModels(). */
+static void ScreenModels(PartSt **list, int count)
+{
+    int k, m, numFull;
+    double aic[NUM_MODELS], best;
+    float *scores;
+
+    AllocateModelStates(MAX(1, count) * NUM_MODELS);
+    fprintf(stderr, "\n** Screening the models **");
+    passTolerance = SCREEN_TOLERANCE;
+    RunTasks();
+    passTolerance = 0.0;
+    runTask = (unsigned char*) malloc(MAX(1, count) * NUM_MODELS);
+    printf("\n Screening: lnL tolerance %.4f, AIC difference %.4f", SCREEN_TOLERANCE, screenDelta);
+    for (k = 0; k < MAX(1, count); k++) {
+        scores = (count > 0) ? list[k]->score : score;
+        best = BIGNUMBER;
+        for (m = 0; m < NUM_MODELS; m++) {
+            aic[m] = 2 * (scores[modelSpec[m].scoreIndex + 1] + ModelParameters(&modelSpec[m]));
+            best = MIN(best, aic[m]);
+        }
+        printf("\n   %s: best screened AIC = %.4f, models not optimized further (screened AIC > %.4f):",
+            (count > 0) ? list[k]->name : "alignment", best, best + screenDelta);
+        for (m = 0, numFull = 0; m < NUM_MODELS; m++) {
+            runTask[k * NUM_MODELS + m] = (aic[m] <= best + screenDelta) ? YES : NO;
+            if (runTask[k * NUM_MODELS + m] == YES) {
+                numFull++;
+            }
+            else {
+                printf(" %s", modelSpec[m].name);
+            }
+        }
+        printf(" (%d of %d models optimized to the end)", numFull, NUM_MODELS);
+    }
+    printf("\n");
+}
+
+/************************* KeepNested ****************************/
+/* Makes each +I+G at least as likely as the +I and +G it nests, which it can
+   fall short of by the tolerance of the optimization: it then takes the
+   estimates of the better of them, with pinv 0 or the shape infinite, which
+   are those of an +I+G. Models not optimized to the end are left alone. */
+static void KeepNested(PartSt **list, int count)
+{
+    int k, m, n, b, i;
+    float *s;
+    unsigned char *approx;
+
+    for (k = 0; k < MAX(1, count); k++) {
+        s = (count > 0) ? list[k]->score : score;
+        approx = (count > 0) ? list[k]->approx : modelApprox;
+        for (m = 3; m < NUM_MODELS; m += 4) {
+            /* values before pinv and the shape: tree, -lnL, frequencies and rates */
+            b = modelSpec[m - 2].scoreIndex - modelSpec[m - 3].scoreIndex;
+            for (n = m - 2; n < m; n++) {
+                if (approx[m] == YES || approx[n] == YES
+                    || s[modelSpec[n].scoreIndex + 1] >= s[modelSpec[m].scoreIndex + 1]) {
+                    continue;
+                }
+                if (DEBUGLEVEL >= 2) {
+                    fprintf(stderr, "\nINFO:   %s -lnL %.6f taken from %s (was %.6f)", modelSpec[m].name,
+                        s[modelSpec[n].scoreIndex + 1], modelSpec[n].name, s[modelSpec[m].scoreIndex + 1]);
+                }
+                for (i = 0; i < b; i++) {
+                    s[modelSpec[m].scoreIndex + i] = s[modelSpec[n].scoreIndex + i];
+                }
+                if (modelSpec[n].useInv == YES) {
+                    s[modelSpec[m].scoreIndex + b] = s[modelSpec[n].scoreIndex + b];
+                    s[modelSpec[m].scoreIndex + b + 1] = SHAPE_INFINITY;
+                }
+                else {
+                    s[modelSpec[m].scoreIndex + b] = 0.0;
+                    s[modelSpec[m].scoreIndex + b + 1] = s[modelSpec[n].scoreIndex + b];
+                }
+            }
+        }
+    }
+}
+
+/************************* CompleteHierarchies ****************************/
+/* Optimizes to the end the models not optimized to the end (modelApprox[])
+   that the hLRT hierarchies test, so that the hLRTs compare only maximum
+   likelihood scores. The hierarchies are walked as with --lazy, taking these
+   models as not scored, until they need no more models. */
+static void CompleteHierarchies(PartSt **list, int count)
+{
+    int k, m, n, numWanted;
+    unsigned char *approx, *completed;
+
+    if (runTask == NULL) {
+        runTask = (unsigned char*) malloc(MAX(1, count) * NUM_MODELS);
+    }
+    completed = (unsigned char*) calloc(MAX(1, count) * NUM_MODELS, 1);
+    do {
+        numWanted = 0;
+        for (k = 0; k < MAX(1, count); k++) {
+            approx = (count > 0) ? list[k]->approx : modelApprox;
+            if (count > 0) {
+                memcpy(score, list[k]->score, sizeof(score));
+            }
+            Initialize();
+            for (m = 0; m < NUM_MODELS; m++) {
+                modelScored[m] = (approx[m] == YES) ? NO : YES;
+            }
+            numWanted += ProbeHierarchies();
+            for (m = 0; m < NUM_MODELS; m++) {
+                runTask[k * NUM_MODELS + m] = modelWanted[m];
+                if (modelWanted[m] == YES) {
+                    approx[m] = NO;
+                    completed[k * NUM_MODELS + m] = YES;
+                }
+            }
+        }
+        if (numWanted > 0) {
+            fprintf(stderr, "\n** Optimizing the models the hLRTs test to the end **");
+            RunTasks();
+        }
+    } while (numWanted > 0);
+    printf("\n hLRTs: models optimized to the end as the hierarchies test them:");
+    for (k = 0; k < MAX(1, count); k++) {
+        if (count > 0) {
+            printf("\n   %s:", list[k]->name);
+        }
+        for (m = n = 0; m < NUM_MODELS; m++) {
+            if (completed[k * NUM_MODELS + m] == YES) {
+                printf(" %s", modelSpec[m].name);
+                n++;
+            }
+        }
+        if (n == 0) {
+            printf(" none");
+        }
+    }
+    printf("\n");
+    free(completed);
+}
+
+/************************* ModelParameters ****************************/
+/* Free parameters of a model, not counting branch lengths (as in Initialize()) */
+static int ModelParameters(ModelSpecSt *spec)
+{
+    return ((spec->nst == 6) ? 5 : spec->nst - 1) + ((spec->estFreqs == YES) ? 3 : 0)
+        + ((spec->useInv == YES) ? 1 : 0) + ((spec->useGamma == YES) ? 1 : 0);
+}
+
+/************************* BoundCriterion ****************************/
+/* The criterion the models of data set k are selected by, for model m with
+   log likelihood lnL (--bound), as CalculateAIC() will calculate it: the AIC,
+   or the AICc with -n (with the sites of each partition, as
+   PartitionedModels()), counting the branch lengths with -t; for the subsets
+   of the scheme search, the criterion of -g counting their branch lengths
+   (ScoreSubset()). It only grows as lnL falls. */
+static double BoundCriterion(int k, int m, double lnL)
+{
+    int K, n, corrected;
+
+    K = ModelParameters(&modelSpec[m]);
+    n = sampleSize;
+    corrected = (sampleSize > 0) ? YES : NO;
+    if (boundScheme == YES) {
+        K += 2 * alignment->numTaxa - 3;
+        n = runPart[k]->numSites;
+        if (schemeCriterion == CRITERION_BIC) {
+            return -2 * lnL + K * log((double) n);
+        }
+        corrected = (schemeCriterion == CRITERION_AICC) ? YES : NO;
+    }
+    else {
+        if (numTaxa > 0) {
+            K += numBL;
+        }
+        if (numRunParts > 0) {
+            n = runPart[k]->numSites;
+        }
+    }
+    if (corrected == YES && n - K - 1 > 0) {
+        return 2 * (K - lnL) + 2 * K * (K + 1) / (double) (n - K - 1);
+    }
+
+    return 2 * (K - lnL);
+}
+
+/************************* BoundExceeded ****************************/
+/* With --bound: YES if the model cannot have the smallest criterion
+   (BoundCriterion()), i.e. if its criterion with the largest likelihood it
+   can have (BoundLnL()) is larger than the criterion some model has already
+   reached. With -w below 1, YES only if the model cannot be in the
+   confidence set of the model averaging (OutsideConfidenceSet()), so that
+   once the set is known all models left stop at once. The criterion the
+   model has reached is recorded as well. */
+static int BoundExceeded(LikeSt *L)
+{
+    int k, m, exceeded;
+
+    k = L->boundPart;
+    m = (int) (L->spec - modelSpec);
+    pthread_mutex_lock(&nativeLock);
+    boundMinAIC[k] = MIN(boundMinAIC[k], BoundCriterion(k, m, L->lnL));
+    if (averagingConfidenceInterval < 1) {
+        exceeded = OutsideConfidenceSet(k, m);
+    }
+    else {
+        exceeded = (BoundCriterion(k, m, BoundLnL(k, m)) > boundMinAIC[k]) ? YES : NO;
+    }
+    pthread_mutex_unlock(&nativeLock);
+
+    return exceeded;
+}
+
+/************************* BoundLnL ****************************/
+/* Largest lnL model m of data set k can have (--bound): the smallest lnL of
+   the models optimized to the end that nest it (IsNested()), itself
+   included, or HUGE_VAL while there are none. Called with nativeLock held. */
+static double BoundLnL(int k, int m)
+{
+    double lnL;
+    int j;
+
+    lnL = HUGE_VAL;
+    for (j = 0; j < NUM_MODELS; j++) {
+        if (IsNested(&modelSpec[m], &modelSpec[j]) == YES) {
+            lnL = MIN(lnL, boundLnL[k * NUM_MODELS + j]);
+        }
+    }
+
+    return lnL;
+}
+
+/************************* OutsideConfidenceSet ****************************/
+/* With --bound and -w below 1: YES if model m of data set k cannot be in the
+   confidence set of the model averaging (FindMinWeightToAverage()), i.e. if
+   the models optimized to the end with a criterion below the smallest m can
+   have already hold more than that share of the Akaike weights, even with
+   every model at its smallest possible criterion. Called with nativeLock held. */
+static int OutsideConfidenceSet(int k, int m)
+{
+    double lowest[NUM_MODELS], least, ahead, total;
+    int j;
+
+    least = HUGE_VAL;
+    for (j = 0; j < NUM_MODELS; j++) {
+        if (BoundLnL(k, j) == HUGE_VAL) {
+            return NO;      /* no bound for model j yet */
+        }
+        lowest[j] = BoundCriterion(k, j, BoundLnL(k, j));
+        least = MIN(least, lowest[j]);
+    }
+    ahead = total = 0.0;
+    for (j = 0; j < NUM_MODELS; j++) {
+        total += exp(-0.5 * (lowest[j] - least));
+        if (boundLnL[k * NUM_MODELS + j] != HUGE_VAL && lowest[j] < lowest[m]) {
+            ahead += exp(-0.5 * (lowest[j] - least));
+        }
+    }
+
+    return (ahead > averagingConfidenceInterval * total) ? YES : NO;
+}
+
+/************************* BoundDone ****************************/
+/* Records a finished model for the bounds (--bound) */
+static void BoundDone(LikeSt *L, int task)
+{
+    BoundExceeded(L);
+    pthread_mutex_lock(&nativeLock);
+    if (L->pruned == NO) {
+        boundLnL[task] = L->lnL;
+    }
+    taskRounds[task] = (L->pruned == YES) ? -1 - L->numRounds : L->numRounds;
+    pthread_mutex_unlock(&nativeLock);
+    if (L->pruned == YES && DEBUGLEVEL >= 2) {
+        fprintf(stderr, "\nINFO:   %s stopped after %d rounds: it cannot have the smallest criterion", L->spec->name, L->numRounds);
+    }
+}
+
+/************************* RecheckBounds ****************************/
+/* With --bound: the models nesting a stopped model may themselves have
+   stopped short of their maximum likelihood, so its bound is not proven.
+   The stopped models whose smallest possible criterion, with the models
+   optimized to the end at last, is within BOUND_MARGIN of the smallest
+   criterion reached are optimized to the end from where they stopped, as
+   CompleteHierarchies() does, and are no longer taken as stopped. */
+static void RecheckBounds(PartSt **list, int count)
+{
+    int k, m, task, numRecheck, *rounds;
+    unsigned char *wanted, *saved;
+
+    if (deadline > 0) {
+        return;     /* the passes are not stopped by the bound */
+    }
+    wanted = (unsigned char*) calloc(MAX(1, count) * NUM_MODELS, 1);
+    rounds = (int*) calloc(MAX(1, count) * NUM_MODELS, sizeof(int));
+    numRecheck = 0;
+    for (k = 0; k < MAX(1, count); k++) {
+        for (m = 0; m < NUM_MODELS; m++) {
+            task = k * NUM_MODELS + m;
+            if ((runTask == NULL || runTask[task] == YES) && taskRounds[task] < 0
+                && BoundCriterion(k, m, BoundLnL(k, m)) <= boundMinAIC[k] + BOUND_MARGIN) {
+                wanted[task] = YES;
+                rounds[task] = -1 - taskRounds[task];
+                numRecheck++;
+            }
+        }
+    }
+    if (numRecheck > 0) {
+        printf("\n Bounds: stopped models within %.1f of the smallest criterion optimized to the end:", BOUND_MARGIN);
+        for (k = 0; k < MAX(1, count); k++) {
+            if (count > 0) {
+                printf("\n   %s:", list[k]->name);
+            }
+            for (m = 0; m < NUM_MODELS; m++) {
+                if (wanted[k * NUM_MODELS + m] == YES) {
+                    printf(" %s", modelSpec[m].name);
+                }
+            }
+        }
+        fprintf(stderr, "\n** Optimizing the stopped models close to the best to the end **");
+        saved = runTask;
+        runTask = wanted;
+        boundRecheck = YES;
+        RunTasks();
+        boundRecheck = NO;
+        runTask = saved;
+        for (task = 0; task < MAX(1, count) * NUM_MODELS; task++) {
+            if (wanted[task] == YES && taskRounds[task] >= 0) {
+                taskRounds[task] += rounds[task];
+            }
+        }
+    }
+    free(rounds);
+    free(wanted);
+}
+
+/************************* PrintBounds ****************************/
+/* Lists the models that were stopped by the bound (--bound), and the rounds
+   of optimization that saved, estimated from the models optimized to the end.
+   The -lnL of a stopped model is lowered to that of the best model nested in
+   it that was optimized to the end, if that is better. It is still not a
+   maximum likelihood score (modelApprox[]). */
+static void PrintBounds(PartSt **list, int count)
+{
+    int k, m, j, task, numFull, numPruned, fullRounds, prunedRounds;
+    float *scores;
+
+    numFull = numPruned = fullRounds = prunedRounds = 0;
+    printf("\n Bounds: no model can have a larger likelihood than a model that nests it");
+    if (averagingConfidenceInterval < 1) {
+        printf("\n   models stopped when they cannot be in the %.2f confidence set of model averaging (-w)", averagingConfidenceInterval);
+    }
+    else {
+        printf("\n   models stopped when they cannot have the smallest %s", (boundScheme == YES)
+            ? ((schemeCriterion == CRITERION_BIC) ? "BIC" : (schemeCriterion == CRITERION_AICC) ? "AICc" : "AIC")
+            : (sampleSize > 0) ? "AICc" : "AIC");
+    }
+    for (k = 0; k < MAX(1, count); k++) {
+        printf("\n   %s: smallest criterion = %.4f, models stopped (rounds made, -lnL):",
+            (count > 0) ? list[k]->name : "alignment", boundMinAIC[k]);
+        for (m = 0; m < NUM_MODELS; m++) {
+            task = k * NUM_MODELS + m;
+            if (runTask != NULL && runTask[task] == NO) {
+                continue;
+            }
+            if (taskRounds[task] < 0) {
+                scores = (count > 0) ? list[k]->score : score;
+                for (j = 0; j < NUM_MODELS; j++) {
+                    if (j != m && boundLnL[k * NUM_MODELS + j] != HUGE_VAL && IsNested(&modelSpec[j], &modelSpec[m])) {
+                        scores[modelSpec[m].scoreIndex + 1] = MIN(scores[modelSpec[m].scoreIndex + 1], scores[modelSpec[j].scoreIndex + 1]);
+                    }
+                }
+                printf(" %s (%d, -lnL <= %.4f)", modelSpec[m].name, -1 - taskRounds[task], scores[modelSpec[m].scoreIndex + 1]);
+                numPruned++;
+                prunedRounds += -1 - taskRounds[task];
+            }
+            else {
+                numFull++;
+                fullRounds += taskRounds[task];
+            }
+        }
+    }
+    printf("\n   %d models optimized to the end in %d rounds, %d stopped after %d rounds",
+        numFull, fullRounds, numPruned, prunedRounds);
+    if (numFull > 0) {
+        printf(" (about %d rounds saved)", MAX(0, numPruned * fullRounds / numFull - prunedRounds));
+    }
+    printf("\n");
+}
+
+/************************* IsNested ****************************/
+/* YES if model a is a special case of model b */
+static int IsNested(ModelSpecSt *a, ModelSpecSt *b)
+{
+    return (a->nst <= b->nst && a->estFreqs <= b->estFreqs && a->useInv <= b->useInv && a->useGamma <= b->useGamma) ? YES : NO;
+}
+
+/************************* ModelWorker ****************************/
+/* Calculates models, taking the next one not yet started until all are done.
+   With partitions the models of all partitions are shared out in turn. */
+static void *ModelWorker(void *arg)
+{
+    int m, k, task;
+    unsigned long long key;
+    AlignSt *data;
+    LikeSt *L;
+
+    (void) arg;
+    L = NULL;
+    key = 0;
+    for (;;) {
+        pthread_mutex_lock(&nativeLock);
+        m = nextModel++;
+        pthread_mutex_unlock(&nativeLock);
+        if (m >= MAX(1, numRunParts) * NUM_MODELS) {
+            break;
+        }
+        if (useBound == YES || deadline > 0) {
+            m = m - m % NUM_MODELS + modelOrder[m % NUM_MODELS];
+        }
+        task = m;
+        if (runTask != NULL && runTask[task] == NO) {
+            continue;
+        }
+        k = m / NUM_MODELS;
+        m = m % NUM_MODELS;
+        data = (numRunParts > 0) ? runPart[k]->data : alignment;
+        if (L == NULL || L->data != data) {
+            if (L != NULL) {
+                FreeLike(L);
+            }
+            L = AllocateLike(data, siteThreads);
+            if (checkpointFile != NULL) {
+                key = ResultKey(data);
+            }
+        }
+        L->score = (numRunParts > 0) ? runPart[k]->score : score;
+        if (numRunParts > 0) {
+            fprintf(stderr, "\n** Partition %s: model %d of %d * Calculating %s **", runPart[k]->name, m + 1, NUM_MODELS, modelSpec[m].name);
+        }
+        else {
+            fprintf(stderr, "\n** Model %d of %d * Calculating %s **", m + 1, NUM_MODELS, modelSpec[m].name);
+        }
+        InitializeLike(L, &modelSpec[m]);
+        if (modelState != NULL && modelState[task].done != NA) {
+            SetModelState(L, &modelState[task]);
+        }
+        if (passTolerance > 0) {
+            L->tolerance = passTolerance;
+            OptimizeModel(L);
+            if (L->numRounds > 0 || modelState[task].done != NA) {
+                GetModelState(L, &modelState[task]);
+                modelState[task].done = NO;
+            }
+            if (deadline > 0 && L->timedOut == NO) {
+                passesDone[task]++;
+            }
+            StoreScores(L);
+            continue;
+        }
+        L->boundPart = (boundLnL != NULL) ? k : -1;
+        if (checkpointFile != NULL) {
+            L->record = CheckpointRecord(key, m);
+            if (ResumeModel(L) == NO) {
+                OptimizeModel(L);
+            }
+            UpdateCheckpoint(L, (L->pruned == YES) ? NO : YES);
+        }
+        else {
+            OptimizeModel(L);
+        }
+        if (boundLnL != NULL) {
+            BoundDone(L, task);
+            if (L->pruned == YES) {
+                GetModelState(L, &modelState[task]);    /* to go on from if the hLRTs test it */
+                modelState[task].done = NO;
+            }
+        }
+        StoreScores(L);
+        if (DEBUGLEVEL >= 2) {
+            fprintf(stderr, "\nINFO:   %s -lnL = %.6f after %ld likelihood evaluations", modelSpec[m].name, -L->lnL, L->numEvaluations);
+        }
+    }
+    if (L != NULL) {
+        FreeLike(L);
+    }
+
+    return NULL;
+}
+
+/************************* HashBytes ****************************/
+/* Adds n bytes to an FNV-1a hash */
+static unsigned long long HashBytes(unsigned long long hash, void *bytes, size_t n)
+{
+    unsigned char *b;
+    size_t i;
+
+    b = (unsigned char*) bytes;
+    for (i = 0; i < n; i++) {
+        hash = (hash ^ b[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/************************* ResultKey ****************************/
+/* Key of the results cache (-r): a hash of everything the scores depend on,
+   i.e. the site patterns and their weights, the tree with its branch lengths
+   and the version of the calculations (RESULT_MAGIC). Taxon names, site order
+   and the file the patterns were read from do not matter. */
+static unsigned long long ResultKey(AlignSt *data)
+{
+    unsigned long long hash;
+    int i, numAmbiguous;
+
+    hash = HashBytes(14695981039346656037ULL, RESULT_MAGIC, 8);
+    hash = HashBytes(hash, &data->numTaxa, sizeof(int));
+    hash = HashBytes(hash, &data->numPatterns, sizeof(int));
+    hash = HashBytes(hash, data->weight, data->numPatterns * sizeof(int));
+    for (i = 0; i < data->numTaxa; i++) {
+        hash = HashBytes(hash, data->packed[i], (data->numPatterns + 3) / 4);
+    }
+    numAmbiguous = data->ambigStart[data->numTaxa];
+    hash = HashBytes(hash, data->ambigStart, (data->numTaxa + 1) * sizeof(int));
+    hash = HashBytes(hash, data->ambigPattern, numAmbiguous * sizeof(int));
+    hash = HashBytes(hash, data->ambigState, numAmbiguous);
+    hash = HashBytes(hash, &tree->numNodes, sizeof(int));
+    for (i = 0; i < tree->numNodes; i++) {
+        hash = HashBytes(hash, tree->nb[i], sizeof(tree->nb[i]));
+    }
+    hash = HashBytes(hash, tree->length, tree->numEdges * sizeof(double));
+    if (screenDelta > 0) {
+        hash = HashBytes(hash, &screenDelta, sizeof(double));    /* some models only screened */
+    }
+    if (useBound == YES) {
+        hash = HashBytes(hash, "bound", 5);     /* some models stopped early */
+    }
+    if (deadline > 0) {
+        hash = HashBytes(hash, "passes", 6);    /* optimized in passes */
+    }
+
+    return hash;
+}
+
+/************************* ResultFileName ****************************/
+static char *ResultFileName(unsigned long long key)
+{
+    char *name;
+
+    name = (char*) malloc(strlen(cacheDir) + 40);
+    sprintf(name, "%s/%016llx%s", cacheDir, key, RESULT_SUFFIX);
+
+    return name;
+}
+
+/************************* LoadResults ****************************/
+/* Reads the scores of data, and which are not optimized to the end, from the
+   results cache. Returns FAILURE if they are not there. */
+static int LoadResults(AlignSt *data, float *scores, unsigned char *approx)
+{
+    FILE *fp;
+    ResultHeaderSt h;
+    unsigned long long key;
+    char *name;
+    int ok;
+
+    key = ResultKey(data);
+    name = ResultFileName(key);
+    ok = NO;
+    if ((fp = fopen(name, "rb")) != NULL) {
+        ok = fread(&h, sizeof(h), 1, fp) == 1 && memcmp(h.magic, RESULT_MAGIC, 8) == 0 && h.key == key
+            && h.numTaxa == data->numTaxa && h.numPatterns == data->numPatterns
+            && fread(scores, sizeof(float), 176, fp) == 176
+            && fread(approx, 1, NUM_MODELS, fp) == NUM_MODELS;
+        fclose(fp);
+    }
+    if (ok == YES) {
+        fprintf(stderr, "\n** Scores of %d site patterns taken from %s **", data->numPatterns, name);
+    }
+    free(name);
+
+    return (ok == YES) ? SUCCESS : FAILURE;
+}
+
+/************************* SaveResults ****************************/
+/* Adds the scores of data to the results cache, creating the directory if
+   needed. The file is written under another name and then renamed, so that
+   runs sharing the cache never read half a file. Failing to write it is not
+   an error. */
+static void SaveResults(AlignSt *data, float *scores, unsigned char *approx)
+{
+    FILE *fp;
+    ResultHeaderSt h;
+    char *name, *tmpName;
+    int ok;
+
+#if !WIN
+    mkdir(cacheDir, 0777);
+#endif
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RESULT_MAGIC, 8);
+    h.key = ResultKey(data);
+    h.numTaxa = data->numTaxa;
+    h.numPatterns = data->numPatterns;
+    name = ResultFileName(h.key);
+    tmpName = (char*) malloc(strlen(name) + 32);
+    sprintf(tmpName, "%s.%ld.tmp", name, (long) getpid());
+    ok = NO;
+    if ((fp = fopen(tmpName, "wb")) != NULL) {
+        ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(scores, sizeof(float), 176, fp) == 176
+            && fwrite(approx, 1, NUM_MODELS, fp) == NUM_MODELS;
+        ok = (fclose(fp) == 0) && ok;
+        if (ok == YES) {
+            remove(name);
+            ok = (rename(tmpName, name) == 0);
+        }
+        if (ok == NO) {
+            remove(tmpName);
+        }
+    }
+    if (ok == NO) {
+        fprintf(stderr, "\nWarning: could not write %s", name);
+    }
+    else if (DEBUGLEVEL >= 2) {
+        fprintf(stderr, "\nINFO:   scores written to %s", name);
+    }
+    free(name);
+    free(tmpName);
+}
+
+/************************* StartCheckpoints ****************************/
+/* Starts the thread that saves the state of the models every
+   checkpointInterval seconds (--checkpoint), after reading the last
+   checkpoint with --resume, which goes on saving them */
+static void StartCheckpoints()
+{
+    if (resume == YES && checkpointInterval <= 0) {
+        checkpointInterval = CHECKPOINT_INTERVAL;
+    }
+    if (checkpointInterval <= 0) {
+        return;
+    }
+    if (screenDelta > 0 || deadline > 0) {
+        /* their passes of loose tolerance are not saved */
+        fprintf(stderr, "\nError: --checkpoint and --resume cannot be used with --screen or --deadline\n");
+        exit(1);
+    }
+    checkpointFile = (char*) malloc(strlen(alignmentFile) + strlen(CHECKPOINT_SUFFIX) + 1);
+    sprintf(checkpointFile, "%s%s", alignmentFile, CHECKPOINT_SUFFIX);
+    if (resume == YES) {
+        ReadCheckpoint(checkpointFile);
+    }
+    checkpointQuit = NO;
+    checkpointChanged = NO;
+    if (pthread_create(&checkpointThread, NULL, CheckpointWriter, NULL) != 0) {
+        fprintf(stderr, "\nError: could not start thread\n");
+        exit(1);
+    }
+}
+
+/************************* StopCheckpoints ****************************/
+/* Stops the checkpoint thread and removes the checkpoint of the finished run */
+static void StopCheckpoints()
+{
+    int i;
+
+    if (checkpointFile == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&checkpointLock);
+    checkpointQuit = YES;
+    pthread_cond_signal(&checkpointWake);
+    pthread_mutex_unlock(&checkpointLock);
+    pthread_join(checkpointThread, NULL);
+    remove(checkpointFile);
+    for (i = 0; i < numCheckpoints; i++) {
+        free(checkpoint[i].brlen);
+    }
+    free(checkpoint);
+    free(checkpointFile);
+    checkpointFile = NULL;
+}
+
+/************************* CheckpointRecord ****************************/
+/* Entry of a model of the patterns with the given key in checkpoint[],
+   added if there is none */
+static int CheckpointRecord(unsigned long long key, int model)
+{
+    int i;
+
+    pthread_mutex_lock(&checkpointLock);
+    for (i = 0; i < numCheckpoints; i++) {
+        if (checkpoint[i].key == key && checkpoint[i].model == model) {
+            break;
+        }
+    }
+    if (i == numCheckpoints) {
+        if (numCheckpoints == maxCheckpoints) {
+            maxCheckpoints = MAX(2 * maxCheckpoints, NUM_MODELS);
+            checkpoint = (CheckpointSt*) realloc(checkpoint, maxCheckpoints * sizeof(CheckpointSt));
+        }
+        memset(&checkpoint[i], 0, sizeof(CheckpointSt));
+        checkpoint[i].key = key;
+        checkpoint[i].model = model;
+        checkpoint[i].done = NA;        /* not started */
+        checkpoint[i].brlen = (double*) calloc(tree->numEdges, sizeof(double));
+        numCheckpoints++;
+    }
+    pthread_mutex_unlock(&checkpointLock);
+
+    return i;
+}
+
+/************************* ResumeModel ****************************/
+/* Takes the values of a model from its checkpoint. Returns YES if the model
+   was done, and NO if it still has to be optimized (from the values of the
+   last round saved, if any). */
+static int ResumeModel(LikeSt *L)
+{
+    CheckpointSt *c;
+    int i, isDone;
+
+    pthread_mutex_lock(&checkpointLock);
+    c = &checkpoint[L->record];
+    isDone = c->done;
+    if (isDone == YES) {
+        L->lnL = c->lnL;
+        for (i = 0; i < NUM_BASES; i++) {
+            L->pi[i] = c->pi[i];
+        }
+        for (i = 0; i < 6; i++) {
+            L->rate[i] = c->rate[i];
+        }
+        L->shape = c->shape;
+        L->shapeInfinite = c->shapeInfinite;
+        L->pinv = c->pinv;
+    }
+    else if (isDone == NO) {
+        SetModelState(L, c);
+    }
+    pthread_mutex_unlock(&checkpointLock);
+    if (isDone == NA) {
+        return NO;
+    }
+    if (isDone == NO) {
+        if (DEBUGLEVEL >= 2) {
+            fprintf(stderr, "\nINFO:   %s continued from the checkpoint at lnL = %.6f", L->spec->name, L->lnL);
+        }
+        return NO;
+    }
+
+    return YES;
+}
+
+/************************* GetModelState ****************************/
+/* Copies the values of the parameters and branch lengths of a model to c */
+static void GetModelState(LikeSt *L, CheckpointSt *c)
+{
+    int i;
+
+    c->lnL = L->lnL;
+    for (i = 0; i < NUM_BASES; i++) {
+        c->pi[i] = L->pi[i];
+    }
+    for (i = 0; i < 6; i++) {
+        c->rate[i] = L->rate[i];
+    }
+    c->shape = L->shape;
+    c->shapeInfinite = L->shapeInfinite;
+    c->pinv = L->pinv;
+    c->secondStart = L->secondStart;
+    for (i = 0; i < tree->numEdges; i++) {
+        c->brlen[i] = L->brlen[i];
+    }
+}
+
+/************************* SetModelState ****************************/
+/* Sets the parameters and branch lengths of a model to the values in c
+   and recalculates the likelihood */
+static void SetModelState(LikeSt *L, CheckpointSt *c)
+{
+    int i;
+
+    for (i = 0; i < NUM_BASES; i++) {
+        L->pi[i] = c->pi[i];
+    }
+    for (i = 0; i < 6; i++) {
+        L->rate[i] = c->rate[i];
+    }
+    L->shape = c->shape;
+    L->shapeInfinite = c->shapeInfinite;
+    L->pinv = c->pinv;
+    L->secondStart = c->secondStart;
+    for (i = 0; i < tree->numEdges; i++) {
+        L->brlen[i] = c->brlen[i];
+    }
+    if (L->spec->useGamma == YES) {
+        GammaRates(L->shape, L->catRate);
+    }
+    L->eigenValid = NO;
+    L->pmatValid = NO;
+    LnLikelihood(L);
+}
+
+/************************* UpdateCheckpoint ****************************/
+/* Copies the values of a model to checkpoint[] for the next checkpoint.
+   Workers only copy; the file is written by CheckpointWriter(). */
+static void UpdateCheckpoint(LikeSt *L, int isDone)
+{
+    pthread_mutex_lock(&checkpointLock);
+    GetModelState(L, &checkpoint[L->record]);
+    checkpoint[L->record].done = isDone;
+    checkpointChanged = YES;
+    pthread_mutex_unlock(&checkpointLock);
+}
+
+/************************* CheckpointWriter ****************************/
+/* Thread that writes checkpoint[] to the checkpoint file every
+   checkpointInterval seconds when it has changed. The entries are copied
+   under the lock and written after it is released, and the file is replaced
+   by renaming, so a run stopped at any moment leaves a whole checkpoint. */
+static void *CheckpointWriter(void *arg)
+{
+    struct timespec wake;
+    char *buffer, *tmpName, *b;
+    size_t size, recordSize;
+    int i, n, ok;
+    FILE *fp;
+
+    (void) arg;
+    recordSize = sizeof(CheckpointSt) + tree->numEdges * sizeof(double);
+    tmpName = (char*) malloc(strlen(checkpointFile) + 5);
+    sprintf(tmpName, "%s.tmp", checkpointFile);
+    pthread_mutex_lock(&checkpointLock);
+    while (checkpointQuit == NO) {
+        wake.tv_sec = time(NULL) + checkpointInterval;
+        wake.tv_nsec = 0;
+        while (checkpointQuit == NO && pthread_cond_timedwait(&checkpointWake, &checkpointLock, &wake) == 0)
+            ;
+        if (checkpointQuit == YES || checkpointChanged == NO) {
+            continue;
+        }
+        n = numCheckpoints;
+        size = 8 + 2 * sizeof(int) + n * recordSize;
+        buffer = (char*) malloc(size);
+        memcpy(buffer, CHECKPOINT_MAGIC, 8);
+        memcpy(buffer + 8, &n, sizeof(int));
+        memcpy(buffer + 8 + sizeof(int), &tree->numEdges, sizeof(int));
+        for (i = 0, b = buffer + 8 + 2 * sizeof(int); i < n; i++, b += recordSize) {
+            memcpy(b, &checkpoint[i], sizeof(CheckpointSt));
+            memcpy(b + sizeof(CheckpointSt), checkpoint[i].brlen, tree->numEdges * sizeof(double));
+        }
+        checkpointChanged = NO;
+        pthread_mutex_unlock(&checkpointLock);
+        ok = NO;
+        if ((fp = fopen(tmpName, "wb")) != NULL) {
+            ok = (fwrite(buffer, 1, size, fp) == size);
+            ok = (fclose(fp) == 0) && ok;
+            if (ok == YES) {
+                remove(checkpointFile);
+                ok = (rename(tmpName, checkpointFile) == 0);
+            }
+            if (ok == NO) {
+                remove(tmpName);
+            }
+        }
+        if (ok == NO) {
+            fprintf(stderr, "\nWarning: could not write the checkpoint %s", checkpointFile);
+        }
+        else if (DEBUGLEVEL >= 2) {
+            fprintf(stderr, "\nINFO:   checkpoint of %d models written to %s", n, checkpointFile);
+        }
+        free(buffer);
+        pthread_mutex_lock(&checkpointLock);
+    }
+    pthread_mutex_unlock(&checkpointLock);
+    free(tmpName);
+
+    return NULL;
+}
+
+/************************* ReadCheckpoint ****************************/
+/* Reads the models of a checkpoint (--resume) into checkpoint[]. Models of
+   other data are kept but never used, since they have other keys. */
+static void ReadCheckpoint(char *name)
+{
+    FILE *fp;
+    CheckpointSt c;
+    char magic[8];
+    int i, n, numEdges, numDone, numStarted;
+
+    if ((fp = fopen(name, "rb")) == NULL) {
+        fprintf(stderr, "\nWarning: no checkpoint %s, starting from the beginning", name);
+        return;
+    }
+    if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, CHECKPOINT_MAGIC, 8) != 0
+        || fread(&n, sizeof(int), 1, fp) != 1 || fread(&numEdges, sizeof(int), 1, fp) != 1) {
+        fprintf(stderr, "\nError: %s is not a checkpoint\n", name);
+        exit(1);
+    }
+    if (numEdges != tree->numEdges) {
+        fprintf(stderr, "\nError: the checkpoint %s is for another tree\n", name);
+        exit(1);
+    }
+    checkpoint = (CheckpointSt*) malloc(MAX(n, 1) * sizeof(CheckpointSt));
+    maxCheckpoints = MAX(n, 1);
+    for (i = 0, numDone = numStarted = 0; i < n; i++) {
+        if (fread(&c, sizeof(CheckpointSt), 1, fp) != 1) {
+            fprintf(stderr, "\nError: the checkpoint %s is incomplete\n", name);
+            exit(1);
+        }
+        c.brlen = (double*) malloc(numEdges * sizeof(double));
+        if (fread(c.brlen, sizeof(double), numEdges, fp) != (size_t) numEdges) {
+            fprintf(stderr, "\nError: the checkpoint %s is incomplete\n", name);
+            exit(1);
+        }
+        checkpoint[i] = c;
+        numDone += (c.done == YES);
+        numStarted += (c.done == NO);
+    }
+    fclose(fp);
+    numCheckpoints = n;
+    fprintf(stderr, "\n** Resuming from %s: %d models done, %d in progress **", name, numDone, numStarted);
+}
+
+/************************* PartitionedModels ****************************/
+/* Selects a model for each charset (-m) as if each had been run on its own,
+   with the models of all partitions calculated on one set of threads, and
+   prints a partitioned MrBayes block with the selected models */
+static void PartitionedModels()
+{
+    int i, userSampleSize;
+
+    if (alignmentFile == NULL) {
+        fprintf(stderr, "\nError: the charsets (-m) need an alignment (-s)\n");
+        exit(1);
+    }
+    PrepareNative();
+    ReadCharsets((*charsetFile != '\0') ? charsetFile : alignmentFile);
+    printf("\n Partitions: %d", numParts);
+    for (i = 0; i < numParts; i++) {
+        printf("\n   %-20.20s %6d sites, %6d site patterns", part[i]->name, part[i]->numSites, part[i]->data->numPatterns);
+    }
+    printf("\n");
+    RunModels(part, numParts, YES);
+    userSampleSize = sampleSize;
+    for (i = 0; i < numParts; i++) {
+        printf("\n\n\n\n===============================================================");
+        printf("\n\n Partition %d of %d: %s (%d sites)", i + 1, numParts, part[i]->name, part[i]->numSites);
+        printf("\n\n===============================================================");
+        memcpy(score, part[i]->score, sizeof(score));
+        memcpy(modelApprox, part[i]->approx, sizeof(modelApprox));
+        Initialize();
+        if (print_scores == YES) {
+            PrintLikelihoodScores();
+        }
+        if (userSampleSize > 0) {
+            sampleSize = part[i]->numSites;    /* AICc with the size of each partition */
+        }
+        PrintRunSettings();
+        SelectModel();
+        strcpy(part[i]->modelhLRT, modelhLRT);
+        strcpy(part[i]->modelAIC, modelAIC);
+    }
+    printf("\n\n\n\n---------------------------------------------------------------");
+    printf("\n*                                                             *");
+    printf("\n*             MODELS SELECTED FOR THE PARTITIONS              *");
+    printf("\n*                                                             *");
+    printf("\n---------------------------------------------------------------\n");
+    printf("\n %-20.20s\t Sites\thLRT      \t%s", "Partition", (useAICc == YES) ? "AICc" : "AIC");
+    for (i = 0; i < numParts; i++) {
+        printf("\n %-20.20s\t%6d\t%-10s\t%s", part[i]->name, part[i]->numSites, part[i]->modelhLRT, part[i]->modelAIC);
+    }
+    PrintPartitionedMbBlock(part, numParts, SELECT_HLRT);
+    PrintPartitionedMbBlock(part, numParts, SELECT_AIC);
+    if (schemeCriterion != NO) {
+        SchemeSearch();
+    }
+}
+
+/************************* PrintPartitionedMbBlock ****************************/
+/* Prints a block of MrBayes commands with the subsets in list and the model
+   selected for each by hLRT, AIC or the scheme search */
+static void PrintPartitionedMbBlock(PartSt **list, int n, int select)
+{
+    int i;
+    char *selected;
+
+    printf("\n\n\nMrBayes Commands Block for the partitioned data:");
+    printf(" If you want to implement the \"best\" model of each partition in MrBayes,");
+    printf(" attach the next block of commands after the data in your NEXUS file:\n");
+    if (select == SELECT_HLRT) {
+        printf("\n[!\nMrBayes settings for the best-fit models selected by hLRT in %s %s\n]", PROGRAM_NAME, VERSION_NUMBER);
+    }
+    else if (select == SELECT_SCHEME) {
+        printf("\n[!\nMrBayes settings for the best partition scheme and models by %s in %s %s\n]",
+            (schemeCriterion == CRITERION_BIC) ? "BIC" : (schemeCriterion == CRITERION_AICC) ? "AICc" : "AIC", PROGRAM_NAME, VERSION_NUMBER);
+    }
+    else if (useAICc == NO) {
+        printf("\n[!\nMrBayes settings for the best-fit models selected by AIC in %s %s\n]", PROGRAM_NAME, VERSION_NUMBER);
+    }
+    else {
+        printf("\n[!\nMrBayes settings for the best-fit models selected by AICc in %s %s\n]", PROGRAM_NAME, VERSION_NUMBER);
+    }
+    printf("\nBEGIN MRBAYES;\n");
+    for (i = 0; i < n; i++) {
+        printf("\n\tCharset %s =", list[i]->name);
+        PrintSiteRanges(list[i]->inSet);
+        printf(";");
+    }
+    printf("\n\tPartition mrmodeltest = %d: ", n);
+    for (i = 0; i < n; i++) {
+        printf("%s%s", list[i]->name, (i < n - 1) ? ", " : ";");
+    }
+    printf("\n\tSet partition = mrmodeltest;\n");
+    for (i = 0; i < n; i++) {
+        memcpy(score, list[i]->score, sizeof(score));
+        selected = (select == SELECT_HLRT) ? list[i]->modelhLRT : (select == SELECT_AIC) ? list[i]->modelAIC : list[i]->modelScheme;
+        SetModel(selected);
+        PrintMbLset(i + 1);
+        printf("\n");
+    }
+    if (n > 1) {
+        printf("\n\tUnlink statefreq=(all) revmat=(all) tratio=(all) shape=(all) pinvar=(all);");
+        printf("\n\tPrset applyto=(all) ratepr=variable;");
+    }
+    printf("\nEND;");
+    printf("\n\n--");
+}
+
+/************************* PrintSiteRanges ****************************/
+/* Prints a set of sites as NEXUS ranges (e.g. 1-300 301-600\3 302-600\3),
+   taking each time the longest run with a step of up to MAX_SITE_STEP */
+static void PrintSiteRanges(unsigned char *inSet)
+{
+    int i, j, n, step, bestStep, bestLast, numChars;
+    unsigned char *left;
+
+    numChars = alignment->numChars;
+    left = (unsigned char*) malloc(numChars);
+    memcpy(left, inSet, numChars);
+    for (i = 0; i < numChars; i++) {
+        if (left[i] != YES) {
+            continue;
+        }
+        bestStep = 1;
+        bestLast = i;
+        for (step = 1; step <= MAX_SITE_STEP; step++) {
+            for (j = i, n = 0; j + step < numChars && left[j+step] == YES; j += step, n++)
+                ;
+            if (n >= 2 && j > bestLast) {
+                bestStep = step;
+                bestLast = j;
+            }
+        }
+        for (j = i; j <= bestLast; j += bestStep) {
+            left[j] = NO;
+        }
+        if (bestLast == i) {
+            printf(" %d", i + 1);
+        }
+        else if (bestStep == 1) {
+            printf(" %d-%d", i + 1, bestLast + 1);
+        }
+        else {
+            printf(" %d-%d\\%d", i + 1, bestLast + 1, bestStep);
+        }
+    }
+    free(left);
+}
+
+/************************* ReadCharsets ****************************/
+/* Reads the charset commands of a NEXUS file (e.g. charset gene1 = 1-456;
+   charset pos3 = 3-.\3;) as the partitions. Sites in no charset are put in
+   one more partition. */
+static void ReadCharsets(char *name)
+{
+    char *text, *upper, *t, *u, *end, *setName;
+    unsigned char *inSet;
+    int i, first, last, step, depth, numChars, *owner;
+
+    numChars = alignment->numChars;
+    text = ReadFileContents(name);
+    for (t = text, depth = 0; *t; t++) {
+        if (*t == '[') {
+            depth++;
+        }
+        if (depth > 0) {
+            if (*t == ']') {
+                depth--;
+            }
+            *t = ' ';
+        }
+    }
+    upper = strdup(text);
+    for (t = upper; *t; t++) {
+        *t = toupper((unsigned char)*t);
+    }
+    owner = (int*) malloc(numChars * sizeof(int));
+    for (i = 0; i < numChars; i++) {
+        owner[i] = -1;
+    }
+    for (t = upper; (t = strstr(t, "CHARSET")) != NULL; ) {
+        if ((t > upper && (isalnum((unsigned char)t[-1]) || t[-1] == '_')) || !isspace((unsigned char)t[7])) {
+            t += 7;
+            continue;
+        }
+        for (u = text + (t - upper) + 7; isspace((unsigned char)*u) || *u == '*'; u++)
+            ;
+        if (*u == '\'') {
+            setName = ++u;
+            while (*u && *u != '\'') {
+                u++;
+            }
+        }
+        else {
+            setName = u;
+            while (*u && !isspace((unsigned char)*u) && *u != '=' && *u != ';') {
+                u++;
+            }
+        }
+        end = u;
+        while (*u && *u != '=' && *u != ';') {
+            u++;
+        }
+        if (*u != '=' || end == setName) {
+            fprintf(stderr, "\nError: could not read a charset command in %s\n", name);
+            exit(1);
+        }
+        *end = '\0';
+        u++;
+        if ((end = strchr(u, ';')) == NULL) {
+            fprintf(stderr, "\nError: charset %s is not ended by ';' in %s\n", setName, name);
+            exit(1);
+        }
+        *end = '\0';
+        inSet = (unsigned char*) calloc(numChars, 1);
+        for (;;) {
+            while (isspace((unsigned char)*u)) {
+                u++;
+            }
+            if (*u == '\0') {
+                break;
+            }
+            if (!isdigit((unsigned char)*u)) {
+                fprintf(stderr, "\nError: could not read the sites of charset %s in %s (only ranges like 1-300 or 2-.\\3 are read)\n", setName, name);
+                exit(1);
+            }
+            first = last = (int) strtol(u, &u, 10);
+            step = 1;
+            while (isspace((unsigned char)*u)) {
+                u++;
+            }
+            if (*u == '-') {
+                for (u++; isspace((unsigned char)*u); u++)
+                    ;
+                if (*u == '.') {
+                    last = numChars;
+                    u++;
+                }
+                else {
+                    last = (int) strtol(u, &u, 10);
+                }
+                while (isspace((unsigned char)*u)) {
+                    u++;
+                }
+                if (*u == '\\') {
+                    step = (int) strtol(u + 1, &u, 10);
+                }
+            }
+            if (first < 1 || last > numChars || first > last || step < 1) {
+                fprintf(stderr, "\nError: charset %s has sites outside 1-%d in %s\n", setName, numChars, name);
+                exit(1);
+            }
+            for (i = first; i <= last; i += step) {
+                if (owner[i-1] >= 0 && owner[i-1] != numParts) {
+                    fprintf(stderr, "\nError: site %d is in both charset %s and charset %s in %s (give the charsets of one partition scheme only)\n",
+                        i, part[owner[i-1]]->name, setName, name);
+                    exit(1);
+                }
+                owner[i-1] = numParts;
+                inSet[i-1] = YES;
+            }
+        }
+        AddPartition(setName, inSet);
+        t = upper + (end - text) + 1;
+    }
+    if (numParts == 0) {
+        fprintf(stderr, "\nError: no charsets found in %s\n", name);
+        exit(1);
+    }
+    inSet = (unsigned char*) calloc(numChars, 1);
+    for (i = first = 0; i < numChars; i++) {
+        if (owner[i] < 0) {
+            inSet[i] = YES;
+            first++;
+        }
+    }
+    if (first > 0) {
+        AddPartition("unassigned", inSet);
+    }
+    else {
+        free(inSet);
+    }
+    free(owner);
+    free(upper);
+    free(text);
+}
+
+/************************* AddPartition ****************************/
+/* Adds a partition with the sites in inSet, which it keeps */
+static void AddPartition(char *name, unsigned char *inSet)
+{
+    part = (PartSt**) realloc(part, (numParts + 1) * sizeof(PartSt*));
+    part[numParts++] = NewSubset(name, inSet);
+}
+
+/************************* NewSubset ****************************/
+/* Sets up a partition or subset with the sites in inSet, which it keeps */
+static PartSt *NewSubset(char *name, unsigned char *inSet)
+{
+    PartSt *p;
+    int i, *patternWeight;
+
+    p = (PartSt*) calloc(1, sizeof(PartSt));
+    p->name = strdup(name);
+    p->hash = SiteHash(inSet);
+    p->inSet = inSet;
+    patternWeight = (int*) calloc(alignment->numPatterns, sizeof(int));
+    for (i = 0; i < alignment->numChars; i++) {
+        if (inSet[i] == YES) {
+            patternWeight[alignment->sitePattern[i]]++;
+            p->numSites++;
+        }
+    }
+    if (p->numSites == 0) {
+        fprintf(stderr, "\nError: charset %s has no sites\n", name);
+        exit(1);
+    }
+    p->data = SubsetAlignment(patternWeight, p->numSites);
+    free(patternWeight);
+
+    return p;
+}
+
+/************************* SchemeSearch ****************************/
+/* Greedy search for the partition scheme with the best AIC, AICc or BIC (-g),
+   as in PartitionFinder (Lanfear et al. 2012). Starting from the charsets,
+   the two subsets whose merging improves the scheme most are merged until no
+   merge improves it. The new merges of each round are calculated together on
+   the model threads, and subsets are cached by their sites so that none is
+   calculated twice. Each subset has its own branch lengths, which are
+   counted as parameters. */
+static void SchemeSearch()
+{
+    PartSt **scheme, **batch, **merged;
+    int i, j, n, K, N, numBatch, bestI, bestJ, step, savedAICc, savedSampleSize;
+    double lnL, value, bestValue, current;
+    char *criterion;
+
+    criterion = (schemeCriterion == CRITERION_BIC) ? "BIC" : (schemeCriterion == CRITERION_AICC) ? "AICc" : "AIC";
+    savedAICc = useAICc;
+    savedSampleSize = sampleSize;
+    subsetCacheSize = 64;
+    subsetCache = (PartSt**) calloc(subsetCacheSize, sizeof(PartSt*));
+    scheme = (PartSt**) malloc(numParts * sizeof(PartSt*));
+    batch = (PartSt**) malloc(numParts * numParts * sizeof(PartSt*));
+    merged = (PartSt**) malloc(numParts * numParts * sizeof(PartSt*));
+    lnL = 0.0;
+    K = N = 0;
+    for (i = 0; i < numParts; i++) {
+        scheme[i] = CachedSubset(part[i]);
+        ScoreSubset(part[i]);
+        lnL += part[i]->lnL;
+        K += part[i]->K;
+        N += part[i]->numSites;
+    }
+    n = numParts;
+    current = SchemeValue(lnL, K, N);
+    printf("\n\n\n\n---------------------------------------------------------------");
+    printf("\n*                                                             *");
+    printf("\n*         GREEDY SEARCH FOR THE BEST PARTITION SCHEME         *");
+    printf("\n*                                                             *");
+    printf("\n---------------------------------------------------------------\n");
+    printf("\n Criterion: %s (the branch lengths of each subset are counted as parameters)", criterion);
+    printf("\n\n Step 0: %d subsets, %s = %.4f", n, criterion, current);
+    for (step = 1; n > 1; step++) {
+        /* calculate the merges not seen before, all at once */
+        numBatch = 0;
+        for (i = 0; i < n; i++) {
+            for (j = i + 1; j < n; j++) {
+                merged[i * numParts + j] = MergedSubset(scheme[i], scheme[j]);
+                if (merged[i * numParts + j]->scored == NO) {
+                    batch[numBatch++] = merged[i * numParts + j];
+                }
+            }
+        }
+        if (numBatch > 0) {
+            RunModels(batch, numBatch, NO);
+            for (i = 0; i < numBatch; i++) {
+                ScoreSubset(batch[i]);
+            }
+        }
+        bestValue = current;
+        bestI = bestJ = -1;
+        for (i = 0; i < n; i++) {
+            for (j = i + 1; j < n; j++) {
+                value = SchemeValue(lnL - scheme[i]->lnL - scheme[j]->lnL + merged[i * numParts + j]->lnL,
+                    K - scheme[i]->K - scheme[j]->K + merged[i * numParts + j]->K, N);
+                if (value < bestValue) {
+                    bestValue = value;
+                    bestI = i;
+                    bestJ = j;
+                }
+            }
+        }
+        if (bestI < 0) {
+            break;
+        }
+        printf("\n Step %d: %s and %s merged, %d subsets, %s = %.4f", step, scheme[bestI]->name, scheme[bestJ]->name, n - 1, criterion, bestValue);
+        lnL += merged[bestI * numParts + bestJ]->lnL - scheme[bestI]->lnL - scheme[bestJ]->lnL;
+        K += merged[bestI * numParts + bestJ]->K - scheme[bestI]->K - scheme[bestJ]->K;
+        scheme[bestI] = merged[bestI * numParts + bestJ];
+        for (j = bestJ; j < n - 1; j++) {
+            scheme[j] = scheme[j+1];
+        }
+        n--;
+        current = bestValue;
+    }
+    printf("\n\n Subsets calculated: %d (merges found in the cache: %d)", numCachedSubsets, numSubsetsFound);
+    printf("\n\n Best scheme: %d subsets, %s = %.4f\n", n, criterion, current);
+    printf("\n %-30.30s\t Sites\t-lnL      \t K\tModel", "Subset");
+    for (i = 0; i < n; i++) {
+        printf("\n %-30.30s\t%6d\t%10.4f\t%2d\t%s", scheme[i]->name, scheme[i]->numSites, scheme[i]->lnL, scheme[i]->K, scheme[i]->modelScheme);
+    }
+    PrintPartitionedMbBlock(scheme, n, SELECT_SCHEME);
+    useAICc = savedAICc;
+    sampleSize = savedSampleSize;
+    free(scheme);
+    free(batch);
+    free(merged);
+}
+
+/************************* CachedSubset ****************************/
+/* Returns the subset in the cache with the same sites as p, adding p if there is none */
+static PartSt *CachedSubset(PartSt *p)
+{
+    PartSt **old;
+    int i, j, oldSize;
+
+    j = (int) (p->hash & (subsetCacheSize - 1));
+    for (; subsetCache[j] != NULL; j = (j + 1) & (subsetCacheSize - 1)) {
+        if (subsetCache[j]->hash == p->hash && memcmp(subsetCache[j]->inSet, p->inSet, alignment->numChars) == 0) {
+            return subsetCache[j];
+        }
+    }
+    subsetCache[j] = p;
+    numCachedSubsets++;
+    if (2 * numCachedSubsets > subsetCacheSize) {
+        old = subsetCache;
+        oldSize = subsetCacheSize;
+        subsetCacheSize *= 2;
+        subsetCache = (PartSt**) calloc(subsetCacheSize, sizeof(PartSt*));
+        for (i = 0; i < oldSize; i++) {
+            if (old[i] != NULL) {
+                for (j = (int) (old[i]->hash & (subsetCacheSize - 1)); subsetCache[j] != NULL; j = (j + 1) & (subsetCacheSize - 1))
+                    ;
+                subsetCache[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    return p;
+}
+
+/************************* MergedSubset ****************************/
+/* The subset with the sites of a and b, from the cache if it has been seen before */
+static PartSt *MergedSubset(PartSt *a, PartSt *b)
+{
+    PartSt key, *p;
+    unsigned char *inSet;
+    char *name;
+    int i;
+
+    inSet = (unsigned char*) malloc(alignment->numChars);
+    for (i = 0; i < alignment->numChars; i++) {
+        inSet[i] = (a->inSet[i] == YES || b->inSet[i] == YES) ? YES : NO;
+    }
+    key.inSet = inSet;
+    key.hash = SiteHash(inSet);
+    p = CachedSubset(&key);
+    if (p != &key) {
+        numSubsetsFound++;
+        free(inSet);
+        return p;
+    }
+    /* not seen before: replace the key in the cache by the new subset */
+    name = (char*) malloc(strlen(a->name) + strlen(b->name) + 2);
+    sprintf(name, "%s_%s", a->name, b->name);
+    p = NewSubset(name, inSet);
+    free(name);
+    for (i = (int) (key.hash & (subsetCacheSize - 1)); subsetCache[i] != &key; i = (i + 1) & (subsetCacheSize - 1))
+        ;
+    subsetCache[i] = p;
+
+    return p;
+}
+
+/************************* SiteHash ****************************/
+/* FNV-1a hash of the sorted sites of a subset */
+static unsigned long long SiteHash(unsigned char *inSet)
+{
+    unsigned long long hash;
+    int i;
+
+    hash = 14695981039346656037ULL;
+    for (i = 0; i < alignment->numChars; i++) {
+        if (inSet[i] == YES) {
+            hash = (hash ^ (unsigned long long) i) * 1099511628211ULL;
+        }
+    }
+
+    return hash;
+}
+
+/************************* ScoreSubset ****************************/
+/* Selects the model of a calculated subset by the scheme criterion with
+   CalculateAIC(), and frees its patterns */
+static void ScoreSubset(PartSt *p)
+{
+    int i;
+
+    memcpy(score, p->score, sizeof(score));
+    memcpy(modelApprox, p->approx, sizeof(modelApprox));
+    Initialize();
+    for (i = 0; i < NUM_MODELS; i++) {
+        model[i].parameters += 2 * alignment->numTaxa - 3;
+        order[i].parameters += 2 * alignment->numTaxa - 3;
+    }
+    sampleSize = p->numSites;
+    useAICc = (schemeCriterion == CRITERION_AICC) ? YES : NO;
+    useBIC = (schemeCriterion == CRITERION_BIC) ? YES : NO;
+    CalculateAIC();
+    useBIC = NO;
+    strcpy(p->modelScheme, modelAIC);
+    for (i = 0; i < NUM_MODELS; i++) {
+        if (!strcmp(model[i].name, modelAIC)) {
+            p->lnL = model[i].ln;
+            p->K = model[i].parameters;
+        }
+    }
+    p->scored = YES;
+    if (p->data != NULL) {
+        FreeAlignment(p->data);
+        p->data = NULL;
+    }
+}
+
+/************************* SchemeValue ****************************/
+/* AIC, AICc or BIC of a scheme from the summed -lnL and parameters of its
+   subsets and the number of sites */
+static double SchemeValue(double lnL, int K, int N)
+{
+    if (schemeCriterion == CRITERION_BIC) {
+        return 2 * lnL + K * log((double) N);
+    }
+    if (schemeCriterion == CRITERION_AICC) {
+        return (N - K - 1 > 0) ? 2 * (lnL + K) + 2.0 * K * (K + 1) / (N - K - 1) : 1.0e300;
+    }
+    return 2 * (lnL + K);
+}
+
+/************************* FreeAlignment ****************************/
+static void FreeAlignment(AlignSt *data)
+{
+    free(data->taxonName);
+    free(data->packed);
+    free(data->ambiguous);
+    if (data->mapped == YES) {
+#if !WIN
+        munmap(data->image, data->imageSize);
+#endif
+    }
+    else {
+        free(data->image);
+    }
+    free(data);
+}
+
+/************************* SubsetAlignment ****************************/
+/* Compressed alignment of the sites given by the number of them with each
+   pattern of the whole alignment */
+static AlignSt *SubsetAlignment(int *patternWeight, int numSites)
+{
+    int i, j, k, n, *index, *weight;
+    unsigned char **state, *constMask, *buffer;
+    double count, freq[NUM_BASES];
+    AlignSt *data;
+
+    index = (int*) malloc(alignment->numPatterns * sizeof(int));
+    for (j = n = 0; j < alignment->numPatterns; j++) {
+        if (patternWeight[j] > 0) {
+            index[n++] = j;
+        }
+    }
+    weight = (int*) malloc(n * sizeof(int));
+    constMask = (unsigned char*) malloc(n);
+    for (j = 0; j < n; j++) {
+        weight[j] = patternWeight[index[j]];
+        constMask[j] = alignment->constMask[index[j]];
+    }
+    /* base frequencies as in CompressPatterns() */
+    for (k = 0; k < NUM_BASES; k++) {
+        freq[k] = 0;
+    }
+    buffer = (unsigned char*) malloc(alignment->numPatterns);
+    state = (unsigned char**) malloc(alignment->numTaxa * sizeof(unsigned char*));
+    for (i = 0; i < alignment->numTaxa; i++) {
+        state[i] = (unsigned char*) malloc(n);
+        TipStates(alignment, i, 0, alignment->numPatterns, buffer);
+        for (j = 0; j < n; j++) {
+            state[i][j] = buffer[index[j]];
+            if (state[i][j] == 15) {
+                continue;
+            }
+            count = (state[i][j] & 1) + ((state[i][j] >> 1) & 1) + ((state[i][j] >> 2) & 1) + ((state[i][j] >> 3) & 1);
+            for (k = 0; k < NUM_BASES; k++) {
+                if (state[i][j] & (1 << k)) {
+                    freq[k] += weight[j] / count;
+                }
+            }
+        }
+    }
+    count = freq[0] + freq[1] + freq[2] + freq[3];
+    for (k = 0; k < NUM_BASES; k++) {
+        freq[k] = count > 0 ? freq[k] / count : 0.25;
+    }
+    data = PackAlignment(alignment->numTaxa, numSites, n, alignment->taxonName, state, weight, NULL, constMask, freq);
+    for (i = 0; i < alignment->numTaxa; i++) {
+        free(state[i]);
+    }
+    free(state); free(buffer); free(weight); free(constMask); free(index);
+
+    return data;
+}
+
+/************************* ReadFileContents ****************************/
+/* Reads a whole file, decompressed if it is compressed, into a null-terminated string */
+static char *ReadFileContents(char *name)
+{
+    FILE *fp, *in;
+    char *buffer;
+    long size, n;
+
+    if ((fp = fopen(name, "rb")) == NULL) {
+        fprintf(stderr, "\nError: could not open file %s\n", name);
+        exit(1);
+    }
+    if ((in = OpenInput(fp, name)) == fp) {
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        buffer = (char*) malloc(size + 1);
+        n = fread(buffer, 1, size, fp);
+    }
+    else {
+        /* the size is not known before the end */
+        size = 4 * COMPRESSED_BLOCK;
+        buffer = (char*) malloc(size + 1);
+        n = 0;
+        while (!feof(in) && !ferror(in)) {
+            if (n == size) {
+                size *= 2;
+                buffer = (char*) realloc(buffer, size + 1);
+            }
+            n += fread(buffer + n, 1, size - n, in);
+        }
+    }
+    buffer[n] = '\0';
+    fclose(in);
+
+    return buffer;
+}
+
+/************************* OpenInput ****************************/
+/* Input that may be compressed: the magic bytes at the start of fp tell gzip
+   or zstd from plain text, and a compressed file is returned as a stream that
+   decompresses a block at a time as it is read. A plain file is returned as
+   it is, rewound, or through a stream that gives back the bytes looked at
+   when fp cannot be rewound (a pipe) */
+static FILE *OpenInput(FILE *fp, char *name)
+{
+    CompressedSt *st;
+    FILE *stream;
+    int kind;
+
+    st = (CompressedSt *) calloc(1, sizeof(CompressedSt));
+    st->fp = fp;
+    st->numIn = fread(st->in, 1, 4, fp);
+    if (st->numIn >= 2 && st->in[0] == 0x1f && st->in[1] == 0x8b) {
+        kind = COMPRESSED_GZIP;
+    }
+    else if (st->numIn == 4 && st->in[0] == 0x28 && st->in[1] == 0xb5 && st->in[2] == 0x2f && st->in[3] == 0xfd) {
+        kind = COMPRESSED_ZSTD;
+    }
+    else {
+        kind = COMPRESSED_NONE;
+    }
+    if (kind == COMPRESSED_NONE && fseek(fp, 0, SEEK_SET) == 0) {
+        free(st);
+        return fp;
+    }
+    clearerr(fp);
+    st->kind = kind;
+    st->name = name;
+    if (kind == COMPRESSED_GZIP) {
+#ifdef HAVE_ZLIB
+        if (inflateInit2(&st->z, 15 + 16) != Z_OK) {
+            fprintf(stderr, "\nError: could not start the decompression of %s\n", name);
+            exit(1);
+        }
+        st->z.next_in = st->in;
+        st->z.avail_in = st->numIn;
+#else
+        fprintf(stderr, "\nError: %s is gzip-compressed, and this mrmodeltest2 is built without zlib\n", name);
+        exit(1);
+#endif
+    }
+    if (kind == COMPRESSED_ZSTD) {
+#ifdef HAVE_ZSTD
+        st->zs = ZSTD_createDStream();
+        ZSTD_initDStream(st->zs);
+        st->zin.src = st->in;
+        st->zin.size = st->numIn;
+        st->zin.pos = 0;
+#else
+        fprintf(stderr, "\nError: %s is zstd-compressed, and this mrmodeltest2 is built without zstd (make ZSTD=1)\n", name);
+        exit(1);
+#endif
+    }
+    inputBytesIn += st->numIn;
+
+#if defined(__GLIBC__)
+    {
+        cookie_io_functions_t io = {CompressedRead, NULL, NULL, CompressedClose};
+        stream = fopencookie(st, "r", io);
+    }
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+    stream = funopen(st, CompressedReadBSD, NULL, NULL, CompressedCloseBSD);
+#else
+    stream = NULL;
+#endif
+    if (stream == NULL) {
+        fprintf(stderr, "\nError: could not read %s as a stream\n", name);
+        exit(1);
+    }
+    setvbuf(stream, NULL, _IOFBF, COMPRESSED_BLOCK);
+
+    return stream;
+}
+
+/************************* CompressedRead ****************************/
+/* Reads up to size bytes of the input of OpenInput() into buffer, decompressing
+   blocks of the file as needed; 0 at the end */
+static ssize_t CompressedRead(void *cookie, char *buffer, size_t size)
+{
+    CompressedSt *st;
+    clock_t start;
+    size_t n;
+
+    st = (CompressedSt *) cookie;
+    start = clock();
+    n = 0;
+    if (st->kind == COMPRESSED_NONE) {
+        /* the bytes looked at by OpenInput(), then the rest of the pipe */
+        if (st->pos < st->numIn) {
+            n = MIN(size, st->numIn - st->pos);
+            memcpy(buffer, st->in + st->pos, n);
+            st->pos += n;
+        }
+        else {
+            n = fread(buffer, 1, size, st->fp);
+        }
+        return n;
+    }
+#ifdef HAVE_ZLIB
+    if (st->kind == COMPRESSED_GZIP) {
+        int result;
+
+        st->z.next_out = (unsigned char *) buffer;
+        st->z.avail_out = size;
+        while (st->z.avail_out == size && st->atEnd == NO) {
+            if (st->z.avail_in == 0) {
+                st->z.next_in = st->in;
+                st->z.avail_in = fread(st->in, 1, COMPRESSED_BLOCK, st->fp);
+                inputBytesIn += st->z.avail_in;
+                if (st->z.avail_in == 0) {
+                    if (st->ended == NO) {
+                        fprintf(stderr, "\nError: %s ends in the middle of the compressed data\n", st->name);
+                        exit(1);
+                    }
+                    st->atEnd = YES;
+                    break;
+                }
+            }
+            if (st->ended == YES) {
+                /* another gzip member follows, as in files joined by cat */
+                inflateReset(&st->z);
+                st->ended = NO;
+            }
+            result = inflate(&st->z, Z_NO_FLUSH);
+            if (result == Z_STREAM_END) {
+                st->ended = YES;
+            }
+            else if (result != Z_OK && result != Z_BUF_ERROR) {
+                fprintf(stderr, "\nError: %s is not valid gzip data (%s)\n", st->name, (st->z.msg != NULL) ? st->z.msg : "corrupt");
+                exit(1);
+            }
+        }
+        n = size - st->z.avail_out;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (st->kind == COMPRESSED_ZSTD) {
+        ZSTD_outBuffer out;
+        size_t result;
+
+        out.dst = buffer;
+        out.size = size;
+        out.pos = 0;
+        while (out.pos == 0 && st->atEnd == NO) {
+            if (st->zin.pos == st->zin.size) {
+                st->zin.size = fread(st->in, 1, COMPRESSED_BLOCK, st->fp);
+                st->zin.pos = 0;
+                inputBytesIn += st->zin.size;
+                if (st->zin.size == 0) {
+                    if (st->ended == NO) {
+                        fprintf(stderr, "\nError: %s ends in the middle of the compressed data\n", st->name);
+                        exit(1);
+                    }
+                    st->atEnd = YES;
+                    break;
+                }
+            }
+            result = ZSTD_decompressStream(st->zs, &out, &st->zin);
+            if (ZSTD_isError(result)) {
+                fprintf(stderr, "\nError: %s is not valid zstd data (%s)\n", st->name, ZSTD_getErrorName(result));
+                exit(1);
+            }
+            st->ended = (result == 0) ? YES : NO;
+        }
+        n = out.pos;
+    }
+#endif
+    inputBytesOut += n;
+    inputSecs += (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    return n;
+}
+
+/************************* CompressedClose ****************************/
+static int CompressedClose(void *cookie)
+{
+    CompressedSt *st;
+
+    st = (CompressedSt *) cookie;
+#ifdef HAVE_ZLIB
+    if (st->kind == COMPRESSED_GZIP) {
+        inflateEnd(&st->z);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (st->kind == COMPRESSED_ZSTD) {
+        ZSTD_freeDStream(st->zs);
+    }
+#endif
+    if (st->fp != stdin) {
+        fclose(st->fp);
+    }
+    free(st);
+
+    return 0;
+}
+
+#if !defined(__GLIBC__) && (defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__))
+/************************* CompressedReadBSD ****************************/
+/* CompressedRead() and CompressedClose() for funopen() */
+static int CompressedReadBSD(void *cookie, char *buffer, int size)
+{
+    return (int) CompressedRead(cookie, buffer, size);
+}
+
+static int CompressedCloseBSD(void *cookie)
+{
+    return CompressedClose(cookie);
+}
+#endif
+
+/************************* ReadAlignment ****************************/
+/* Reads a DNA alignment in NEXUS, PHYLIP or FASTA format. With -r the
+   packed image of the alignment is kept in the cache directory, named by a
+   hash of the contents of the file, and mapped instead of reading the text
+   again when a file with the same contents is read. */
+static void ReadAlignment(char *name)
+{
+    char *text, *s, *packName;
+    char **names;
+    unsigned char **seq;
+    int i, j, ntax, nchar, *len;
+    struct stat source;
+    unsigned long long sourceHash;
+
+    if (stat(name, &source) != 0) {
+        fprintf(stderr, "\nError: could not open %s\n", name);
+        exit(1);
+    }
+    packName = NULL;
+    sourceHash = 0;
+    if (cacheDir != NULL) {
+        sourceHash = HashFile(name);
+        packName = (char*) malloc(strlen(cacheDir) + 40);
+        sprintf(packName, "%s/%016llx%s", cacheDir, sourceHash, PACK_SUFFIX);
+        if (MapAlignment(packName, (long long) source.st_size, sourceHash) == SUCCESS) {
+            if (DEBUGLEVEL >= 2) {
+                fprintf(stderr, "\nINFO:   alignment read from %s", packName);
+            }
+            free(packName);
+            return;
+        }
+    }
+    text = ReadFileContents(name);
+    for (s = text; isspace((unsigned char)*s); s++)
+        ;
+    if (*s == '#') {
+        ReadNexusMatrix(s, name, &ntax, &nchar, &names, &seq, &len);
+    }
+    else if (*s == '>') {
+        ReadFasta(s, name, &ntax, &nchar, &names, &seq, &len);
+    }
+    else {
+        ReadPhylip(s, name, &ntax, &nchar, &names, &seq, &len);
+    }
+    if (ntax < 3) {
+        fprintf(stderr, "\nError: at least 3 taxa are needed in %s\n", name);
+        exit(1);
+    }
+    for (i = 0; i < ntax; i++) {
+        if (names[i] == NULL || len[i] != nchar) {
+            fprintf(stderr, "\nError: taxon %d (%s) has %d characters in %s (expected %d)\n", i + 1,
+                names[i] ? names[i] : "?", len[i], name, nchar);
+            exit(1);
+        }
+        for (j = 0; names[i][j]; j++) {
+            if (names[i][j] == ' ') {
+                names[i][j] = '_';
+            }
+        }
+    }
+    CompressPatterns(ntax, nchar, names, seq);
+    if (packName != NULL) {
+        WriteAlignmentImage(packName, (long long) source.st_size, sourceHash);
+    }
+    for (i = 0; i < ntax; i++) {
+        free(seq[i]);
+        free(names[i]);
+    }
+    free(seq);
+    free(names);
+    free(len);
+    free(text);
+    free(packName);
+}
+
+/************************* StateCode ****************************/
+/* Returns the set of bases for a nucleotide symbol (A=1, C=2, G=4, T=8) or 0 if unknown.
+   Gaps and missing data are treated as any base, as PAUP* does by default. */
+static unsigned char StateCode(int c)
+{
+    switch (toupper(c)) {
+    case 'A': return 1;
+    case 'C': return 2;
+    case 'G': return 4;
+    case 'T': case 'U': return 8;
+    case 'M': return 3;
+    case 'R': return 5;
+    case 'W': return 9;
+    case 'S': return 6;
+    case 'Y': return 10;
+    case 'K': return 12;
+    case 'V': return 7;
+    case 'H': return 11;
+    case 'D': return 13;
+    case 'B': return 14;
+    case 'N': case 'X': case '?': case '-': return 15;
+    default: return 0;
+    }
+}
+
+/************************* AppendStates ****************************/
+/* Appends the nucleotides in text[0..n-1] to the sequence of a taxon */
+static void AppendStates(char *text, int n, unsigned char *seq, int *len, int max, int matchchar, unsigned char *first, char *taxon, char *name)
+{
+    int i;
+
+    for (i = 0; i < n && text[i]; i++) {
+        if (isspace((unsigned char)text[i])) {
+            continue;
+        }
+        if (*len >= max) {
+            (*len)++;
+            continue;
+        }
+        if (matchchar >= 0 && text[i] == matchchar && first != NULL) {
+            seq[*len] = first[*len];
+        }
+        else if ((seq[*len] = StateCode(text[i])) == 0) {
+            fprintf(stderr, "\nError: unknown character '%c' for taxon %s in %s\n", text[i], taxon, name);
+            exit(1);
+        }
+        (*len)++;
+    }
+}
+
+/************************* ReadNexusMatrix ****************************/
+/* Reads the matrix of a NEXUS DATA or CHARACTERS block */
+static void ReadNexusMatrix(char *text, char *name, int *numTaxa, int *numChars, char ***taxonNames, unsigned char ***sequences, int **lengths)
+{
+    char *upper, *t, *u, *end, *tok, **names;
+    unsigned char **seq;
+    int i, depth, ntax, nchar, interleave, taxon, c, *len;
+    int matchchar;
+
+    for (t = text, depth = 0; *t; t++) {
+        if (*t == '[') {
+            depth++;
+        }
+        if (depth > 0) {
+            if (*t == ']') {
+                depth--;
+            }
+            *t = ' ';
+        }
+    }
+    upper = strdup(text);
+    for (t = upper; *t; t++) {
+        *t = toupper((unsigned char)*t);
+    }
+    ntax = nchar = 0;
+    interleave = NO;
+    matchchar = -1;
+    if ((t = strstr(upper, "NTAX")) != NULL && (t = strchr(t, '=')) != NULL) {
+        ntax = atoi(t + 1);
+    }
+    if ((t = strstr(upper, "NCHAR")) != NULL && (t = strchr(t, '=')) != NULL) {
+        nchar = atoi(t + 1);
+    }
+    if ((t = strstr(upper, "FORMAT")) != NULL && (end = strchr(t, ';')) != NULL) {
+        if ((tok = strstr(t, "INTERLEAVE")) != NULL && tok < end) {
+            interleave = YES;
+            for (tok += 10; isspace((unsigned char)*tok); tok++)
+                ;
+            if (*tok == '=') {
+                for (tok++; isspace((unsigned char)*tok); tok++)
+                    ;
+                if (strncmp(tok, "NO", 2) == 0) {
+                    interleave = NO;
+                }
+            }
+        }
+        if ((tok = strstr(t, "MATCHCHAR")) != NULL && tok < end && (tok = strchr(tok, '=')) != NULL) {
+            for (tok++; isspace((unsigned char)*tok); tok++)
+                ;
+            matchchar = text[tok - upper];
+        }
+    }
+    if (ntax <= 0 || nchar <= 0 || (u = strstr(upper, "MATRIX")) == NULL) {
+        fprintf(stderr, "\nError: could not find the dimensions and the matrix in %s\n", name);
+        exit(1);
+    }
+    t = text + (u - upper) + 6;
+    if ((end = strchr(t, ';')) != NULL) {
+        *end = '\0';
+    }
+    free(upper);
+    names = (char**) calloc(ntax, sizeof(char*));
+    seq = (unsigned char**) calloc(ntax, sizeof(unsigned char*));
+    len = (int*) calloc(ntax, sizeof(int));
+    taxon = 0;
+    while (*t) {
+        while (isspace((unsigned char)*t)) {
+            t++;
+        }
+        if (*t == '\0') {
+            break;
+        }
+        tok = t;
+        if (*t == '\'') {
+            for (tok = ++t; *t && *t != '\''; t++)
+                ;
+        }
+        else {
+            while (*t && !isspace((unsigned char)*t)) {
+                t++;
+            }
+        }
+        c = *t;
+        *t = '\0';
+        for (i = 0; i < taxon; i++) {
+            if (strcmp(names[i], tok) == 0) {
+                break;
+            }
+        }
+        if (i == taxon) {
+            if (taxon == ntax) {
+                fprintf(stderr, "\nError: more than %d taxa in the matrix of %s\n", ntax, name);
+                exit(1);
+            }
+            names[taxon] = strdup(tok);
+            seq[taxon] = (unsigned char*) malloc(nchar);
+            taxon++;
+        }
+        if (c) {
+            t++;
+        }
+        /* interleaved sequences end with the line, others when nchar characters are read */
+        if (interleave == YES) {
+            for (u = t; *u && *u != '\n' && *u != '\r'; u++)
+                ;
+        }
+        else {
+            for (u = t, c = len[i]; *u && c < nchar; u++) {
+                if (!isspace((unsigned char)*u)) {
+                    c++;
+                }
+            }
+        }
+        AppendStates(t, u - t, seq[i], &len[i], nchar, matchchar, i > 0 ? seq[0] : NULL, names[i], name);
+        t = u;
+    }
+    *numTaxa = taxon;
+    *numChars = nchar;
+    *taxonNames = names;
+    *sequences = seq;
+    *lengths = len;
+}
+
+/************************* ReadPhylip ****************************/
+/* Reads a sequential or interleaved (relaxed) PHYLIP alignment */
+static void ReadPhylip(char *text, char *name, int *numTaxa, int *numChars, char ***taxonNames, unsigned char ***sequences, int **lengths)
+{
+    char *t, *tok, **line, **names;
+    unsigned char **seq;
+    int i, k, ntax, nchar, numLines, interleaved, *len;
+
+    ntax = (int) strtol(text, &t, 10);
+    nchar = (int) strtol(t, &t, 10);
+    if (ntax <= 0 || nchar <= 0) {
+        fprintf(stderr, "\nError: unrecognized alignment format in %s\n", name);
+        exit(1);
+    }
+    /* split the rest of the file into non-empty lines */
+    line = (char**) malloc((strlen(t) + 1) * sizeof(char*));
+    numLines = 0;
+    for (tok = strtok(t, "\r\n"); tok != NULL; tok = strtok(NULL, "\r\n")) {
+        while (isspace((unsigned char)*tok)) {
+            tok++;
+        }
+        if (*tok) {
+            line[numLines++] = tok;
+        }
+    }
+    names = (char**) calloc(ntax, sizeof(char*));
+    seq = (unsigned char**) calloc(ntax, sizeof(unsigned char*));
+    len = (int*) calloc(ntax, sizeof(int));
+    for (i = 0; i < ntax; i++) {
+        seq[i] = (unsigned char*) malloc(nchar);
+    }
+    /* try interleaved first: names on the first ntax lines, then blocks in the same order */
+    for (interleaved = YES; interleaved >= NO; interleaved--) {
+        for (i = 0; i < ntax; i++) {
+            free(names[i]);
+            names[i] = NULL;
+            len[i] = 0;
+        }
+        i = -1;
+        for (k = 0; k < numLines; k++) {
+            tok = line[k];
+            if (interleaved == YES) {
+                i = k % ntax;
+            }
+            else if (i < 0 || len[i] >= nchar) {
+                i++;
+            }
+            if (i >= ntax) {
+                len[0] = -1;
+                break;
+            }
+            if (names[i] == NULL) {
+                tok += strcspn(tok, " \t");
+                names[i] = (char*) malloc(tok - line[k] + 1);
+                strncpy(names[i], line[k], tok - line[k]);
+                names[i][tok - line[k]] = '\0';
+            }
+            AppendStates(tok, strlen(tok), seq[i], &len[i], nchar, -1, NULL, names[i], name);
+        }
+        for (i = 0; i < ntax && len[i] == nchar; i++)
+            ;
+        if (i == ntax) {
+            break;
+        }
+    }
+    free(line);
+    *numTaxa = ntax;
+    *numChars = nchar;
+    *taxonNames = names;
+    *sequences = seq;
+    *lengths = len;
+}
+
+/************************* ReadFasta ****************************/
+/* Reads aligned sequences in FASTA format */
+static void ReadFasta(char *text, char *name, int *numTaxa, int *numChars, char ***taxonNames, unsigned char ***sequences, int **lengths)
+{
+    char *t, *end, **names;
+    unsigned char **seq;
+    int ntax, maxTaxa, *len;
+
+    maxTaxa = 64;
+    names = (char**) calloc(maxTaxa, sizeof(char*));
+    seq = (unsigned char**) calloc(maxTaxa, sizeof(unsigned char*));
+    len = (int*) calloc(maxTaxa, sizeof(int));
+    ntax = 0;
+    for (t = strchr(text, '>'); t != NULL; t = end) {
+        if (ntax == maxTaxa) {
+            maxTaxa *= 2;
+            names = (char**) realloc(names, maxTaxa * sizeof(char*));
+            seq = (unsigned char**) realloc(seq, maxTaxa * sizeof(unsigned char*));
+            len = (int*) realloc(len, maxTaxa * sizeof(int));
+        }
+        t++;
+        end = t + strcspn(t, " \t\r\n");
+        names[ntax] = (char*) malloc(end - t + 1);
+        strncpy(names[ntax], t, end - t);
+        names[ntax][end - t] = '\0';
+        t = end + strcspn(end, "\n");
+        end = strchr(t, '>');
+        seq[ntax] = (unsigned char*) malloc(end != NULL ? (size_t) (end - t) + 1 : strlen(t) + 1);
+        len[ntax] = 0;
+        AppendStates(t, end != NULL ? end - t : (int) strlen(t), seq[ntax], &len[ntax], BIGNUMBER, -1, NULL, names[ntax], name);
+        ntax++;
+    }
+    *numTaxa = ntax;
+    *numChars = ntax > 0 ? len[0] : 0;
+    *taxonNames = names;
+    *sequences = seq;
+    *lengths = len;
+}
+
+/************************* ComparePatterns ****************************/
+/* qsort() comparison of two alignment columns */
+static int ComparePatterns(const void *a, const void *b)
+{
+    return memcmp(compressColumns[*(const int*)a], compressColumns[*(const int*)b], compressTaxa);
+}
+
+/************************* CompressPatterns ****************************/
+/* Stores the alignment as unique site patterns with their counts */
+static void CompressPatterns(int numTaxa, int numChars, char **names, unsigned char **seq)
+{
+    int i, j, k, n, *index, *weight, *sitePattern;
+    unsigned char **state, *constMask;
+    double count, freq[NUM_BASES];
+    /* sort the columns to find the unique ones */
+    compressTaxa = numTaxa;
+    compressColumns = (unsigned char**) malloc(numChars * sizeof(unsigned char*));
+    index = (int*) malloc(numChars * sizeof(int));
+    for (j = 0; j < numChars; j++) {
+        compressColumns[j] = (unsigned char*) malloc(numTaxa);
+        for (i = 0; i < numTaxa; i++) {
+            compressColumns[j][i] = seq[i][j];
+        }
+        index[j] = j;
+    }
+    qsort(index, numChars, sizeof(int), ComparePatterns);
+    state = (unsigned char**) malloc(numTaxa * sizeof(unsigned char*));
+    for (i = 0; i < numTaxa; i++) {
+        state[i] = (unsigned char*) malloc(numChars);
+    }
+    weight = (int*) calloc(numChars, sizeof(int));
+    sitePattern = (int*) malloc(numChars * sizeof(int));
+    constMask = (unsigned char*) malloc(numChars);
+    n = 0;
+    for (j = 0; j < numChars; j++) {
+        if (j == 0 || ComparePatterns(&index[j-1], &index[j]) != 0) {
+            constMask[n] = 15;
+            for (i = 0; i < numTaxa; i++) {
+                state[i][n] = compressColumns[index[j]][i];
+                constMask[n] &= compressColumns[index[j]][i];
+            }
+            n++;
+        }
+        weight[n-1]++;
+        sitePattern[index[j]] = n - 1;
+    }
+    /* empirical base frequencies, ambiguous states shared among their bases */
+    for (k = 0; k < NUM_BASES; k++) {
+        freq[k] = 0;
+    }
+    for (i = 0; i < numTaxa; i++) {
+        for (j = 0; j < numChars; j++) {
+            if (seq[i][j] == 15) {
+                continue;
+            }
+            count = (seq[i][j] & 1) + ((seq[i][j] >> 1) & 1) + ((seq[i][j] >> 2) & 1) + ((seq[i][j] >> 3) & 1);
+            for (k = 0; k < NUM_BASES; k++) {
+                if (seq[i][j] & (1 << k)) {
+                    freq[k] += 1.0 / count;
+                }
+            }
+        }
+    }
+    count = freq[0] + freq[1] + freq[2] + freq[3];
+    for (k = 0; k < NUM_BASES; k++) {
+        freq[k] = count > 0 ? freq[k] / count : 0.25;
+    }
+    for (j = 0; j < numChars; j++) {
+        free(compressColumns[j]);
+    }
+    free(compressColumns);
+    free(index);
+    alignment = PackAlignment(numTaxa, numChars, n, names, state, weight, sitePattern, constMask, freq);
+    for (i = 0; i < numTaxa; i++) {
+        free(state[i]);
+    }
+    free(state);
+    free(weight);
+    free(sitePattern);
+    free(constMask);
+}
+
+/************************* PackAlignment ****************************/
+/* Builds the packed image of a compressed alignment. The map from sites to
+   patterns (sitePattern) may be NULL. */
+static AlignSt *PackAlignment(int numTaxa, int numChars, int numPatterns, char **names, unsigned char **state, int *weight, int *sitePattern, unsigned char *constMask, double *freq)
+{
+    PackHeaderSt h;
+    size_t size, offset[9], packedBytes, bitmapBytes;
+    int i, p, k, n, code;
+    char *image, *t;
+    unsigned char *packed, *ambiguous;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PACK_MAGIC, 8);
+    h.numTaxa = numTaxa;
+    h.numChars = numChars;
+    h.numPatterns = numPatterns;
+    for (i = 0; i < numTaxa; i++) {
+        h.namesSize += strlen(names[i]) + 1;
+        for (p = 0; p < numPatterns; p++) {
+            if (state[i][p] != 1 && state[i][p] != 2 && state[i][p] != 4 && state[i][p] != 8) {
+                h.numAmbiguous++;
+            }
+        }
+    }
+    for (k = 0; k < NUM_BASES; k++) {
+        h.freq[k] = freq[k];
+    }
+    size = PackLayout(&h, offset);
+    image = (char*) calloc(size, 1);
+    if (image == NULL) {
+        fprintf(stderr, "\nError: not enough memory for the alignment\n");
+        exit(1);
+    }
+    memcpy(image, &h, sizeof(h));
+    for (i = 0, t = image + offset[0]; i < numTaxa; i++) {
+        strcpy(t, names[i]);
+        t += strlen(names[i]) + 1;
+    }
+    memcpy(image + offset[1], weight, numPatterns * sizeof(int));
+    memcpy(image + offset[4], constMask, numPatterns);
+    if (sitePattern != NULL) {
+        memcpy(image + offset[8], sitePattern, numChars * sizeof(int));
+    }
+    packedBytes = (numPatterns + 3) / 4;
+    bitmapBytes = (numPatterns + 7) / 8;
+    n = 0;
+    for (i = 0; i < numTaxa; i++) {
+        ((int*) (image + offset[2]))[i] = n;
+        packed = (unsigned char*) image + offset[6] + i * packedBytes;
+        ambiguous = (unsigned char*) image + offset[7] + i * bitmapBytes;
+        for (p = 0; p < numPatterns; p++) {
+            code = (state[i][p] == 2) ? 1 : (state[i][p] == 4) ? 2 : (state[i][p] == 8) ? 3 : 0;
+            packed[p >> 2] |= code << (2 * (p & 3));
+            if (state[i][p] != 1 && state[i][p] != 2 && state[i][p] != 4 && state[i][p] != 8) {
+                ambiguous[p >> 3] |= 1 << (p & 7);
+                ((int*) (image + offset[3]))[n] = p;
+                ((unsigned char*) image + offset[5])[n] = state[i][p];
+                n++;
+            }
+        }
+    }
+    ((int*) (image + offset[2]))[numTaxa] = n;
+
+    return AlignmentImage(image, size);
+}
+
+/************************* PackLayout ****************************/
+/* Offsets of the arrays in a packed image (names, weight, ambigStart,
+   ambigPattern, constMask, ambigState, packed, ambiguous, sitePattern).
+   Returns the size. */
+static size_t PackLayout(PackHeaderSt *h, size_t *offset)
+{
+    size_t size;
+
+    size = PAD8(sizeof(PackHeaderSt));
+    offset[0] = size;
+    size += PAD8((size_t) h->namesSize);
+    offset[1] = size;
+    size += PAD8(h->numPatterns * sizeof(int));
+    offset[2] = size;
+    size += PAD8((h->numTaxa + 1) * sizeof(int));
+    offset[3] = size;
+    size += PAD8(h->numAmbiguous * sizeof(int));
+    offset[4] = size;
+    size += PAD8((size_t) h->numPatterns);
+    offset[5] = size;
+    size += PAD8((size_t) h->numAmbiguous);
+    offset[6] = size;
+    size += PAD8((size_t) h->numTaxa * ((h->numPatterns + 3) / 4));
+    offset[7] = size;
+    size += PAD8((size_t) h->numTaxa * ((h->numPatterns + 7) / 8));
+    offset[8] = size;
+    size += PAD8(h->numChars * sizeof(int));
+
+    return size;
+}
+
+/************************* AlignmentImage ****************************/
+/* Sets up an alignment with its arrays pointing into a packed image. Returns
+   NULL if the image is not a complete packed alignment. */
+static AlignSt *AlignmentImage(char *image, size_t size)
+{
+    PackHeaderSt h;
+    AlignSt *alignment;
+    size_t offset[9];
+    int i;
+    char *t;
+
+    if (size < sizeof(h)) {
+        return NULL;
+    }
+    memcpy(&h, image, sizeof(h));
+    if (memcmp(h.magic, PACK_MAGIC, 8) != 0 || h.numTaxa < 1 || h.numPatterns < 1 || h.numAmbiguous < 0 || PackLayout(&h, offset) != size) {
+        return NULL;
+    }
+    alignment = (AlignSt*) calloc(1, sizeof(AlignSt));
+    alignment->numTaxa = h.numTaxa;
+    alignment->numChars = h.numChars;
+    alignment->numPatterns = h.numPatterns;
+    for (i = 0; i < NUM_BASES; i++) {
+        alignment->freq[i] = h.freq[i];
+    }
+    alignment->image = image;
+    alignment->imageSize = size;
+    alignment->weight = (int*) (image + offset[1]);
+    alignment->ambigStart = (int*) (image + offset[2]);
+    alignment->ambigPattern = (int*) (image + offset[3]);
+    alignment->constMask = (unsigned char*) image + offset[4];
+    alignment->ambigState = (unsigned char*) image + offset[5];
+    alignment->sitePattern = (int*) (image + offset[8]);
+    alignment->taxonName = (char**) malloc(h.numTaxa * sizeof(char*));
+    alignment->packed = (unsigned char**) malloc(h.numTaxa * sizeof(unsigned char*));
+    alignment->ambiguous = (unsigned char**) malloc(h.numTaxa * sizeof(unsigned char*));
+    for (i = 0, t = image + offset[0]; i < h.numTaxa; i++) {
+        alignment->taxonName[i] = t;
+        t += strlen(t) + 1;
+        alignment->packed[i] = (unsigned char*) image + offset[6] + i * (size_t) ((h.numPatterns + 3) / 4);
+        alignment->ambiguous[i] = (unsigned char*) image + offset[7] + i * (size_t) ((h.numPatterns + 7) / 8);
+    }
+
+    return alignment;
+}
+
+/************************* MapAlignment ****************************/
+/* Maps a packed image written for an alignment file of the size and content
+   hash given. Returns FAILURE if there is none or it belongs to another file. */
+static int MapAlignment(char *name, long long sourceSize, unsigned long long sourceHash)
+{
+    FILE *fp;
+    PackHeaderSt h;
+    struct stat st;
+    char *image;
+
+    if (stat(name, &st) != 0 || (fp = fopen(name, "rb")) == NULL) {
+        return FAILURE;
+    }
+    if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, PACK_MAGIC, 8) != 0
+        || h.sourceSize != sourceSize || h.sourceHash != sourceHash) {
+        fclose(fp);
+        return FAILURE;
+    }
+#if WIN
+    image = (char*) malloc(st.st_size);
+    rewind(fp);
+    if (image == NULL || fread(image, 1, st.st_size, fp) != (size_t) st.st_size) {
+        free(image);
+        fclose(fp);
+        return FAILURE;
+    }
+#else
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+    if (image == MAP_FAILED) {
+        fclose(fp);
+        return FAILURE;
+    }
+#endif
+    fclose(fp);
+    if ((alignment = AlignmentImage(image, st.st_size)) == NULL) {
+#if !WIN
+        munmap(image, st.st_size);
+#endif
+        return FAILURE;
+    }
+    alignment->mapped = YES;
+
+    return SUCCESS;
+}
+
+/************************* WriteAlignmentImage ****************************/
+/* Saves the packed image of the alignment in the cache directory for later
+   runs. Failing to do so (e.g. in a read-only directory) is not an error. */
+static void WriteAlignmentImage(char *name, long long sourceSize, unsigned long long sourceHash)
+{
+    FILE *fp;
+    PackHeaderSt *h;
+    char *tmpName;
+    int ok;
+
+#if !WIN
+    mkdir(cacheDir, 0777);
+#endif
+    h = (PackHeaderSt*) alignment->image;
+    h->sourceSize = sourceSize;
+    h->sourceHash = sourceHash;
+    tmpName = (char*) malloc(strlen(name) + 5);
+    sprintf(tmpName, "%s.tmp", name);
+    if ((fp = fopen(tmpName, "wb")) == NULL) {
+        free(tmpName);
+        return;
+    }
+    ok = (fwrite(alignment->image, 1, alignment->imageSize, fp) == alignment->imageSize);
+    ok = (fclose(fp) == 0) && ok;
+    if (ok) {
+        remove(name);
+        ok = (rename(tmpName, name) == 0);
+    }
+    if (ok == NO) {
+        remove(tmpName);
+    }
+    else if (DEBUGLEVEL >= 2) {
+        fprintf(stderr, "\nINFO:   packed alignment written to %s", name);
+    }
+    free(tmpName);
+}
+
+/************************* HashFile ****************************/
+/* Hash of the bytes of a file, as they are on disk */
+static unsigned long long HashFile(char *name)
+{
+    FILE *fp;
+    unsigned long long hash;
+    char buffer[65536];
+    size_t n;
+
+    if ((fp = fopen(name, "rb")) == NULL) {
+        fprintf(stderr, "\nError: could not open %s\n", name);
+        exit(1);
+    }
+    hash = HashBytes(14695981039346656037ULL, PACK_MAGIC, 8);
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        hash = HashBytes(hash, buffer, n);
+    }
+    fclose(fp);
+
+    return hash;
+}
+
+/************************* TipStates ****************************/
+/* State sets (A=1, C=2, G=4, T=8) of a taxon for patterns start to end-1 */
+static void TipStates(AlignSt *data, int taxon, int start, int end, unsigned char *state)
+{
+    int p, lo, hi, mid;
+    unsigned char *packed;
+
+    packed = data->packed[taxon];
+    for (p = start; p < end; p++) {
+        state[p - start] = 1 << ((packed[p >> 2] >> (2 * (p & 3))) & 3);
+    }
+    /* first ambiguous entry of the taxon at or after start */
+    lo = data->ambigStart[taxon];
+    hi = data->ambigStart[taxon + 1];
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (data->ambigPattern[mid] < start) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    for (; lo < data->ambigStart[taxon + 1] && data->ambigPattern[lo] < end; lo++) {
+        state[data->ambigPattern[lo] - start] = data->ambigState[lo];
+    }
+}
+
+/************************* ReadTree ****************************/
+/* Reads the first tree in a Newick or NEXUS tree file. Taxa are matched by
+   name (or through a NEXUS translate table) to those in the alignment.
+   A rooted tree is unrooted, and polytomies are resolved with zero-length branches. */
+static void ReadTree(char *name)
+{
+    char *text, *t, *upper, *u, *end, *label, **key, **value, **tipLabel;
+    int i, j, k, x, n, depth, numKeys, numTmp, maxTmp, tmpRoot, a, b, slots, left, cur, w;
+    int *tmpParent, *firstChild, *nextSibling, *lastChild, *numChildren, *tmpTaxon, *stack, *att;
+    double *tmpLength, *attLength;
+    int numTips, numNodes, numEdges;
+    int (*edgeNode)[2];
+    double *edgeLength;
+
+    text = ReadFileContents(name);
+    numTips = alignment->numTaxa;
+    key = value = NULL;
+    numKeys = 0;
+    for (t = text; isspace((unsigned char)*t); t++)
+        ;
+    if (*t == '#') {
+        /* NEXUS: remove comments, read the translate table and find the first tree */
+        for (u = t, depth = 0; *u; u++) {
+            if (*u == '[') {
+                depth++;
+            }
+            if (depth > 0) {
+                if (*u == ']') {
+                    depth--;
+                }
+                *u = ' ';
+            }
+        }
+        upper = strdup(t);
+        for (u = upper; *u; u++) {
+            *u = toupper((unsigned char)*u);
+        }
+        key = (char**) calloc(numTips, sizeof(char*));
+        value = (char**) calloc(numTips, sizeof(char*));
+        if ((u = strstr(upper, "TRANSLATE")) != NULL) {
+            u = t + (u - upper) + 9;
+            end = strchr(u, ';');
+            while (u < end && numKeys < numTips) {
+                u += strspn(u, " \t\r\n,");
+                if (u >= end) {
+                    break;
+                }
+                key[numKeys] = u;
+                u += strcspn(u, " \t\r\n");
+                *u++ = '\0';
+                u += strspn(u, " \t\r\n");
+                if (*u == '\'') {
+                    value[numKeys] = ++u;
+                    u += strcspn(u, "'");
+                }
+                else {
+                    value[numKeys] = u;
+                    u += strcspn(u, " \t\r\n,;");
+                }
+                if (*u == ';') {
+                    end = u;
+                }
+                *u++ = '\0';
+                numKeys++;
+            }
+        }
+        for (u = upper; (u = strstr(u, "TREE")) != NULL; u++) {
+            if ((u == upper || isspace((unsigned char)u[-1]) || u[-1] == ';') && isspace((unsigned char)u[4])) {
+                break;
+            }
+        }
+        if (u == NULL || (u = strchr(u, '=')) == NULL) {
+            fprintf(stderr, "\nError: could not find a tree in %s\n", name);
+            exit(1);
+        }
+        t = t + (u - upper) + 1;
+        free(upper);
+    }
+    if ((t = strchr(t, '(')) == NULL) {
+        fprintf(stderr, "\nError: could not find a tree in %s\n", name);
+        exit(1);
+    }
+    /* parse the Newick string into a rooted tree of any degree */
+    maxTmp = strlen(t) + 1;
+    tmpParent = (int*) malloc(maxTmp * sizeof(int));
+    firstChild = (int*) malloc(maxTmp * sizeof(int));
+    nextSibling = (int*) malloc(maxTmp * sizeof(int));
+    lastChild = (int*) malloc(maxTmp * sizeof(int));
+    numChildren = (int*) calloc(maxTmp, sizeof(int));
+    tmpTaxon = (int*) malloc(maxTmp * sizeof(int));
+    tmpLength = (double*) malloc(maxTmp * sizeof(double));
+    tipLabel = (char**) calloc(maxTmp, sizeof(char*));
+    tmpRoot = 0;
+    numTmp = 1;
+    tmpParent[0] = firstChild[0] = nextSibling[0] = -1;
+    tmpLength[0] = -1;
+    cur = 0;
+    while (*t && *t != ';') {
+        if (*t == '(' || *t == ',') {
+            /* new child of the current node (or of its parent for a sibling) */
+            x = numTmp++;
+            a = (*t == '(') ? cur : tmpParent[cur];
+            if (a < 0) {
+                fprintf(stderr, "\nError: unbalanced parentheses in the tree in %s\n", name);
+                exit(1);
+            }
+            tmpParent[x] = a;
+            firstChild[x] = nextSibling[x] = -1;
+            tmpLength[x] = -1;
+            if (numChildren[a]++ == 0) {
+                firstChild[a] = x;
+            }
+            else {
+                nextSibling[lastChild[a]] = x;
+            }
+            lastChild[a] = x;
+            cur = x;
+            t++;
+        }
+        else if (*t == ')') {
+            cur = tmpParent[cur];
+            if (cur < 0) {
+                fprintf(stderr, "\nError: unbalanced parentheses in the tree in %s\n", name);
+                exit(1);
+            }
+            t++;
+        }
+        else if (*t == ':') {
+            tmpLength[cur] = strtod(t + 1, &t);
+        }
+        else if (isspace((unsigned char)*t)) {
+            t++;
+        }
+        else {
+            if (*t == '\'') {
+                label = ++t;
+                t += strcspn(t, "'");
+            }
+            else {
+                label = t;
+                t += strcspn(t, "():,; \t\r\n");
+            }
+            n = t - label;
+            if (*t == '\'') {
+                t++;
+            }
+            if (numChildren[cur] == 0) {
+                tipLabel[cur] = (char*) malloc(n + 1);
+                strncpy(tipLabel[cur], label, n);
+                tipLabel[cur][n] = '\0';
+            }
+        }
+    }
+    if (cur != 0) {
+        fprintf(stderr, "\nError: unbalanced parentheses in the tree in %s\n", name);
+        exit(1);
+    }
+    /* match the tips to the taxa in the alignment */
+    for (x = 0, n = 0; x < numTmp; x++) {
+        tmpTaxon[x] = -1;
+        if (numChildren[x] > 0) {
+            continue;
+        }
+        label = tipLabel[x];
+        for (i = 0; label != NULL && i < numKeys; i++) {
+            if (strcmp(key[i], label) == 0) {
+                label = value[i];
+                break;
+            }
+        }
+        for (j = 0; label != NULL && label[j]; j++) {
+            if (label[j] == ' ') {
+                label[j] = '_';
+            }
+        }
+        for (i = 0; label != NULL && i < numTips; i++) {
+            if (strcmp(alignment->taxonName[i], label) == 0) {
+                break;
+            }
+        }
+        if (label == NULL || i == numTips) {
+            fprintf(stderr, "\nError: taxon %s in the tree is not in the alignment\n", label ? label : "(unnamed)");
+            exit(1);
+        }
+        for (j = 0; j < x; j++) {
+            if (tmpTaxon[j] == i) {
+                fprintf(stderr, "\nError: taxon %s is twice in the tree\n", label);
+                exit(1);
+            }
+        }
+        tmpTaxon[x] = i;
+        n++;
+    }
+    if (n != numTips) {
+        fprintf(stderr, "\nError: the tree has %d taxa, the alignment %d\n", n, numTips);
+        exit(1);
+    }
+    /* unroot a bifurcating root: its internal child becomes the root */
+    while (numChildren[tmpRoot] == 1) {
+        tmpRoot = firstChild[tmpRoot];
+    }
+    if (numChildren[tmpRoot] == 2) {
+        a = firstChild[tmpRoot];
+        b = nextSibling[a];
+        if (numChildren[b] == 0) {
+            a = b;
+            b = firstChild[tmpRoot];
+        }
+        tmpLength[a] = (tmpLength[a] < 0 && tmpLength[b] < 0) ? -1 : MAX(tmpLength[a], 0) + MAX(tmpLength[b], 0);
+        nextSibling[lastChild[b]] = a;
+        nextSibling[a] = -1;
+        lastChild[b] = a;
+        numChildren[b]++;
+        tmpParent[a] = b;
+        tmpRoot = b;
+    }
+    /* build the unrooted binary tree in preorder: att[x] is the node x hangs from */
+    numNodes = 2 * numTips - 2;
+    numEdges = 2 * numTips - 3;
+    edgeNode = malloc(numEdges * sizeof(*edgeNode));
+    edgeLength = (double*) malloc(numEdges * sizeof(double));
+    att = (int*) malloc(maxTmp * sizeof(int));
+    attLength = (double*) malloc(maxTmp * sizeof(double));
+    stack = (int*) malloc(maxTmp * sizeof(int));
+    k = 0;          /* edges */
+    w = numTips;    /* next internal node */
+    att[tmpRoot] = -1;
+    attLength[tmpRoot] = 0;
+    stack[0] = tmpRoot;
+    depth = 1;
+    while (depth > 0) {
+        x = stack[--depth];
+        if (numChildren[x] == 1) {
+            /* node of degree two: skip it */
+            a = firstChild[x];
+            att[a] = att[x];
+            attLength[a] = attLength[x] + MAX(tmpLength[a], 0);
+            stack[depth++] = a;
+            continue;
+        }
+        if (numChildren[x] == 0) {
+            cur = tmpTaxon[x];
+        }
+        else {
+            cur = w++;
+        }
+        if (att[x] >= 0) {
+            if (k == numEdges) {
+                break;
+            }
+            edgeNode[k][0] = att[x];
+            edgeNode[k][1] = cur;
+            edgeLength[k++] = attLength[x];
+        }
+        slots = (att[x] >= 0) ? 2 : 3;
+        left = numChildren[x];
+        for (a = firstChild[x]; a >= 0; a = nextSibling[a], left--) {
+            if (left > slots && slots == 1) {
+                /* polytomy: continue on a new node joined by a zero-length branch */
+                if (k == numEdges) {
+                    break;
+                }
+                edgeNode[k][0] = cur;
+                edgeNode[k][1] = w;
+                edgeLength[k++] = 0;
+                cur = w++;
+                slots = 2;
+            }
+            att[a] = cur;
+            attLength[a] = tmpLength[a];
+            stack[depth++] = a;
+            slots--;
+        }
+    }
+    if (k != numEdges || w != numNodes) {
+        fprintf(stderr, "\nError: could not read the tree in %s as an unrooted tree of %d taxa\n", name, numTips);
+        exit(1);
+    }
+    if (BuildTree(numTips, edgeNode, edgeLength) == FAILURE) {
+        fprintf(stderr, "\nError: could not read the tree in %s as an unrooted binary tree\n", name);
+        exit(1);
+    }
+    for (i = 0; i < numTmp; i++) {
+        free(tipLabel[i]);
+    }
+    free(tipLabel); free(tmpParent); free(firstChild); free(nextSibling); free(lastChild);
+    free(numChildren); free(tmpTaxon); free(tmpLength); free(att); free(attLength); free(stack);
+    free(edgeNode); free(key); free(value); free(text);
+}
+
+/************************* BuildTree ****************************/
+/* Sets up tree from its 2*numTips-3 edges, given as pairs of nodes (tips
+   0..numTips-1, internal nodes numTips..2*numTips-3) with their lengths.
+   Returns FAILURE if the edges do not form an unrooted binary tree. */
+static int BuildTree(int numTips, int (*edgeNode)[2], double *edgeLength)
+{
+    int i, j, k, a, b, x, n, depth, numNodes, numEdges, *deg, *stack;
+
+    numNodes = 2 * numTips - 2;
+    numEdges = 2 * numTips - 3;
+    tree = (TreeSt*) calloc(1, sizeof(TreeSt));
+    tree->numTips = numTips;
+    tree->numNodes = numNodes;
+    tree->numEdges = numEdges;
+    tree->root = numTips;
+    tree->nb = malloc(numNodes * sizeof(*tree->nb));
+    tree->edge = malloc(numNodes * sizeof(*tree->edge));
+    tree->back = malloc(numNodes * sizeof(*tree->back));
+    tree->parent = (int*) malloc(numNodes * sizeof(int));
+    tree->postorder = (int*) malloc(numNodes * sizeof(int));
+    tree->length = edgeLength;
+    deg = (int*) calloc(numNodes, sizeof(int));
+    stack = (int*) malloc(numNodes * sizeof(int));
+    for (i = 0; i < numEdges; i++) {
+        for (j = 0; j < 2; j++) {
+            a = edgeNode[i][j];
+            b = edgeNode[i][1-j];
+            if (deg[a] == 3 || (a < numTips && deg[a] == 1)) {
+                free(deg);
+                free(stack);
+                return FAILURE;
+            }
+            tree->nb[a][deg[a]] = b;
+            tree->edge[a][deg[a]++] = i;
+        }
+    }
+    for (i = 0; i < numTips; i++) {
+        tree->nb[i][1] = tree->nb[i][2] = tree->edge[i][1] = tree->edge[i][2] = -1;
+        tree->back[i][1] = tree->back[i][2] = -1;
+    }
+    for (a = 0; a < numNodes; a++) {
+        for (j = 0; j < 3 && tree->nb[a][j] >= 0; j++) {
+            b = tree->nb[a][j];
+            for (k = 0; tree->nb[b][k] != a; k++)
+                ;
+            tree->back[a][j] = k;
+        }
+    }
+    /* internal nodes in postorder: reverse of a preorder from the root */
+    tree->parent[tree->root] = -1;
+    stack[0] = tree->root;
+    depth = 1;
+    n = 0;
+    while (depth > 0) {
+        x = stack[--depth];
+        tree->postorder[n++] = x;
+        for (j = 0; j < 3; j++) {
+            a = tree->nb[x][j];
+            if (a != tree->parent[x] && a >= numTips) {
+                tree->parent[a] = x;
+                stack[depth++] = a;
+            }
+            else if (a != tree->parent[x]) {
+                tree->parent[a] = x;
+            }
+        }
+    }
+    for (i = 0; i < n / 2; i++) {
+        x = tree->postorder[i];
+        tree->postorder[i] = tree->postorder[n-1-i];
+        tree->postorder[n-1-i] = x;
+    }
+    free(deg);
+    free(stack);
+
+    return SUCCESS;
+}
+
+/************************* NeighborJoiningTree ****************************/
+/* Builds the tree when no tree file is given, as the NJ command after
+   DSet distance=JC in MrModelblock (negative branch lengths set to zero).
+   The pair to join is found as in RapidNJ (Simonsen et al. 2008): each row
+   of the distance matrix is kept sorted, and a row is only scanned while
+   d(i,j) - u(i) - max u can still beat the best Q value found so far. */
+static void NeighborJoiningTree()
+{
+    int n, i, a, b, c, id, slot, live, numJoins, numDead, bestA, bestB, *idOf, *slotOf, *alive, *liveSlot, *len, (*edgeNode)[2], numEdges;
+    double *D, *r, *u, *edgeLength, uMax, q, qMin, dab, la, lb, dkc;
+    NJEntrySt **S, *e;
+
+    n = alignment->numTaxa;
+    D = PairwiseDistances();
+    edgeNode = malloc((2 * n - 3) * sizeof(*edgeNode));
+    edgeLength = (double*) malloc((2 * n - 3) * sizeof(double));
+    idOf = (int*) malloc(n * sizeof(int));
+    liveSlot = (int*) malloc(n * sizeof(int));
+    slotOf = (int*) malloc((2 * n - 2) * sizeof(int));
+    alive = (int*) calloc(2 * n - 2, sizeof(int));
+    len = (int*) malloc(n * sizeof(int));
+    r = (double*) calloc(n, sizeof(double));
+    u = (double*) malloc(n * sizeof(double));
+    S = (NJEntrySt**) malloc(n * sizeof(NJEntrySt*));
+    for (a = 0; a < n; a++) {
+        idOf[a] = slotOf[a] = a;
+        alive[a] = liveSlot[a] = YES;
+        for (b = 0; b < n; b++) {
+            r[a] += D[a * n + b];
+        }
+    }
+    for (a = 0; a < n; a++) {
+        S[a] = (NJEntrySt*) malloc(n * sizeof(NJEntrySt));
+        if (S[a] == NULL) {
+            fprintf(stderr, "\nError: not enough memory for the neighbor-joining tree\n");
+            exit(1);
+        }
+        SortedRow(S[a], &len[a], D, a, idOf, liveSlot, n);
+    }
+    numEdges = numJoins = numDead = 0;
+    for (live = n; live > 3; live--) {
+        uMax = -1.0e300;
+        for (a = 0; a < n; a++) {
+            if (liveSlot[a] == YES) {
+                u[a] = r[a] / (live - 2);
+                uMax = MAX(uMax, u[a]);
+            }
+        }
+        qMin = 1.0e300;
+        bestA = bestB = -1;
+        for (a = 0; a < n; a++) {
+            if (liveSlot[a] == NO) {
+                continue;
+            }
+            for (i = 0; i < len[a]; i++) {
+                e = &S[a][i];
+                if (e->d - u[a] - uMax > qMin) {
+                    break;
+                }
+                if (alive[e->id] == NO) {
+                    continue;
+                }
+                b = slotOf[e->id];
+                q = D[a * n + b] - u[a] - u[b];
+                if (q < qMin) {
+                    qMin = q;
+                    bestA = MIN(a, b);
+                    bestB = MAX(a, b);
+                }
+            }
+        }
+        /* join the nodes in slots bestA and bestB into a new node in slot bestA */
+        a = bestA;
+        b = bestB;
+        id = n + numJoins++;
+        dab = D[a * n + b];
+        la = MAX(0.0, 0.5 * dab + 0.5 * (u[a] - u[b]));
+        lb = MAX(0.0, dab - (0.5 * dab + 0.5 * (u[a] - u[b])));
+        edgeNode[numEdges][0] = id;
+        edgeNode[numEdges][1] = idOf[a];
+        edgeLength[numEdges++] = la;
+        edgeNode[numEdges][0] = id;
+        edgeNode[numEdges][1] = idOf[b];
+        edgeLength[numEdges++] = lb;
+        alive[idOf[a]] = alive[idOf[b]] = NO;
+        liveSlot[b] = NO;
+        r[a] = 0.0;
+        for (c = 0; c < n; c++) {
+            if (liveSlot[c] == NO || c == a) {
+                continue;
+            }
+            dkc = 0.5 * (D[a * n + c] + D[b * n + c] - dab);
+            r[c] += dkc - D[a * n + c] - D[b * n + c];
+            r[a] += dkc;
+            D[a * n + c] = D[c * n + a] = dkc;
+        }
+        idOf[a] = id;
+        slotOf[id] = a;
+        alive[id] = YES;
+        SortedRow(S[a], &len[a], D, a, idOf, liveSlot, n);
+        /* drop the entries of joined nodes once they make up half the rows */
+        numDead += 2;
+        if (numDead > live) {
+            for (slot = 0; slot < n; slot++) {
+                if (liveSlot[slot] == YES) {
+                    for (i = c = 0; i < len[slot]; i++) {
+                        if (alive[S[slot][i].id] == YES) {
+                            S[slot][c++] = S[slot][i];
+                        }
+                    }
+                    len[slot] = c;
+                }
+            }
+            numDead = 0;
+        }
+    }
+    /* the last three nodes meet at the final internal node */
+    for (a = 0; liveSlot[a] == NO; a++)
+        ;
+    for (b = a + 1; liveSlot[b] == NO; b++)
+        ;
+    for (c = b + 1; liveSlot[c] == NO; c++)
+        ;
+    id = n + numJoins;
+    edgeNode[numEdges][0] = id;
+    edgeNode[numEdges][1] = idOf[a];
+    edgeLength[numEdges++] = MAX(0.0, 0.5 * (D[a * n + b] + D[a * n + c] - D[b * n + c]));
+    edgeNode[numEdges][0] = id;
+    edgeNode[numEdges][1] = idOf[b];
+    edgeLength[numEdges++] = MAX(0.0, 0.5 * (D[a * n + b] + D[b * n + c] - D[a * n + c]));
+    edgeNode[numEdges][0] = id;
+    edgeNode[numEdges][1] = idOf[c];
+    edgeLength[numEdges++] = MAX(0.0, 0.5 * (D[a * n + c] + D[b * n + c] - D[a * n + b]));
+    if (BuildTree(n, edgeNode, edgeLength) == FAILURE) {
+        fprintf(stderr, "\nError: could not build the neighbor-joining tree\n");
+        exit(1);
+    }
+    for (a = 0; a < n; a++) {
+        free(S[a]);
+    }
+    free(S); free(D); free(r); free(u); free(len); free(idOf); free(slotOf); free(alive); free(liveSlot); free(edgeNode);
+}
+
+/************************* SortedRow ****************************/
+/* Row of the distance matrix for the node in a slot, sorted by distance */
+static void SortedRow(NJEntrySt *row, int *len, double *D, int slot, int *idOf, int *liveSlot, int n)
+{
+    int c, k;
+    float d;
+
+    k = 0;
+    for (c = 0; c < n; c++) {
+        if (liveSlot[c] == YES && c != slot) {
+            d = (float) D[slot * n + c];
+            if (d > D[slot * n + c]) {
+                d = nextafterf(d, -1.0e30f);
+            }
+            row[k].d = d;
+            row[k++].id = idOf[c];
+        }
+    }
+    qsort(row, k, sizeof(NJEntrySt), CompareNJEntries);
+    *len = k;
+}
+
+/************************* CompareNJEntries ****************************/
+static int CompareNJEntries(const void *a, const void *b)
+{
+    const NJEntrySt *x = a, *y = b;
+
+    if (x->d != y->d) {
+        return (x->d < y->d) ? -1 : 1;
+    }
+    return x->id - y->id;
+}
+
+/************************* PairwiseDistances ****************************/
+/* JC (or K80, -k) distances between all taxa, ignoring ambiguous sites in
+   each pair. The packed 2-bit codes are regrouped so that each 64-bit word
+   holds 32 patterns of the same weight, and differences are counted a word
+   at a time: with A=0, C=1, G=2, T=3 the exclusive or of two codes is 2 for
+   a transition and odd for a transversion. */
+static double *PairwiseDistances()
+{
+    int n, i, j, p, w, g, q, numWords, *order;
+    unsigned long long **code, **valid, x, v, lo, hi;
+    long *wordWeight, numSites, numTs, numTv;
+    unsigned char *state;
+    double *D, P, Q, arg1, arg2;
+
+    n = alignment->numTaxa;
+    order = (int*) malloc(alignment->numPatterns * sizeof(int));
+    for (p = 0; p < alignment->numPatterns; p++) {
+        order[p] = p;
+    }
+    qsort(order, alignment->numPatterns, sizeof(int), CompareWeights);
+    /* one run of words for each weight */
+    numWords = 0;
+    for (p = 0; p < alignment->numPatterns; p = g) {
+        for (g = p; g < alignment->numPatterns && alignment->weight[order[g]] == alignment->weight[order[p]]; g++)
+            ;
+        numWords += (g - p + 31) / 32;
+    }
+    wordWeight = (long*) malloc(numWords * sizeof(long));
+    code = (unsigned long long**) malloc(n * sizeof(unsigned long long*));
+    valid = (unsigned long long**) malloc(n * sizeof(unsigned long long*));
+    state = (unsigned char*) malloc(alignment->numPatterns);
+    D = (double*) calloc((size_t) n * n, sizeof(double));
+    if (D == NULL) {
+        fprintf(stderr, "\nError: not enough memory for the distance matrix\n");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        code[i] = (unsigned long long*) calloc(numWords, sizeof(unsigned long long));
+        valid[i] = (unsigned long long*) calloc(numWords, sizeof(unsigned long long));
+        TipStates(alignment, i, 0, alignment->numPatterns, state);
+        w = -1;
+        q = 32;
+        for (p = 0; p < alignment->numPatterns; p++) {
+            if (q == 32 || (p > 0 && alignment->weight[order[p]] != alignment->weight[order[p-1]])) {
+                w++;
+                q = 0;
+                wordWeight[w] = alignment->weight[order[p]];
+            }
+            g = state[order[p]];
+            if (g == 1 || g == 2 || g == 4 || g == 8) {
+                code[i][w] |= (unsigned long long) ((g == 2) ? 1 : (g == 4) ? 2 : (g == 8) ? 3 : 0) << (2 * q);
+                valid[i][w] |= 1ULL << (2 * q);
+            }
+            q++;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        for (j = i + 1; j < n; j++) {
+            numSites = numTs = numTv = 0;
+            for (w = 0; w < numWords; w++) {
+                v = valid[i][w] & valid[j][w];
+                x = code[i][w] ^ code[j][w];
+                lo = x & v;
+                hi = (x >> 1) & v;
+                numSites += wordWeight[w] * BitCount(v);
+                numTs += wordWeight[w] * BitCount(hi & ~lo);
+                numTv += wordWeight[w] * BitCount(lo);
+            }
+            P = (numSites > 0) ? (double) numTs / numSites : 0.0;
+            Q = (numSites > 0) ? (double) numTv / numSites : 0.0;
+            if (useK80Distances == YES) {
+                arg1 = 1.0 - 2.0 * P - Q;
+                arg2 = 1.0 - 2.0 * Q;
+                D[i * n + j] = (arg1 > 0 && arg2 > 0) ? -0.5 * log(arg1) - 0.25 * log(arg2) : MAX_DISTANCE;
+            }
+            else {
+                arg1 = 1.0 - 4.0 / 3.0 * (P + Q);
+                D[i * n + j] = (arg1 > 0) ? -0.75 * log(arg1) : MAX_DISTANCE;
+            }
+            if (numSites == 0) {
+                D[i * n + j] = MAX_DISTANCE;
+            }
+            D[i * n + j] = MIN(D[i * n + j], MAX_DISTANCE);
+            D[j * n + i] = D[i * n + j];
+        }
+        free(code[i]);
+        free(valid[i]);
+    }
+    free(code); free(valid); free(wordWeight); free(state); free(order);
+
+    return D;
+}
+
+/************************* BitCount ****************************/
+static int BitCount(unsigned long long x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+    return (int) ((x * 0x0101010101010101ULL) >> 56);
+}
+
+/************************* CompareWeights ****************************/
+static int CompareWeights(const void *a, const void *b)
+{
+    int x = alignment->weight[*(const int*)a], y = alignment->weight[*(const int*)b];
+
+    if (x != y) {
+        return x - y;
+    }
+    return *(const int*)a - *(const int*)b;
+}
+
+/************************* PrintNewick ****************************/
+/* Writes the subtree at node, seen from its neighbour from, with branch lengths */
+static void PrintNewick(FILE *fp, int node, int from)
+{
+    int j, first;
+
+    if (node < tree->numTips) {
+        fprintf(fp, "%s", alignment->taxonName[node]);
+        return;
+    }
+    fprintf(fp, "(");
+    first = YES;
+    for (j = 0; j < 3; j++) {
+        if (tree->nb[node][j] == from) {
+            continue;
+        }
+        if (first == NO) {
+            fprintf(fp, ",");
+        }
+        PrintNewick(fp, tree->nb[node][j], node);
+        fprintf(fp, ":%.6f", tree->length[tree->edge[node][j]]);
+        first = NO;
+    }
+    fprintf(fp, ")");
+}
+
+/************************* AllocateLike ****************************/
+static LikeSt *AllocateLike(AlignSt *data, int numThreads)
+{
+    LikeSt *L;
+    int i, numInternal;
+
+    L = (LikeSt*) calloc(1, sizeof(LikeSt));
+    L->data = data;
+    L->record = -1;
+    L->numChunks = (L->data->numPatterns + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    L->chunkSum = malloc(L->numChunks * sizeof(*L->chunkSum));
+    L->numThreads = numThreads;
+    if (numThreads > 1) {
+        pthread_mutex_init(&L->lock, NULL);
+        pthread_cond_init(&L->start, NULL);
+        pthread_cond_init(&L->finished, NULL);
+        L->thread = (pthread_t*) malloc(numThreads * sizeof(pthread_t));
+        for (i = 1; i < numThreads; i++) {
+            if (pthread_create(&L->thread[i], NULL, SiteWorker, L) != 0) {
+                fprintf(stderr, "\nError: could not start thread\n");
+                exit(1);
+            }
+        }
+    }
+    numInternal = tree->numNodes - tree->numTips;
+    L->brlen = (double*) calloc(tree->numEdges, sizeof(double));
+    L->pmat = (double*) calloc(tree->numEdges * NUM_GAMMA_CATS * NUM_BASES * NUM_BASES, sizeof(double));
+    L->partial = (double**) calloc(3 * numInternal, sizeof(double*));
+    L->partialValid = (int*) calloc(3 * numInternal, sizeof(int));
+    L->stack = (int*) malloc((6 * numInternal + 4) * sizeof(int));
+    L->sop = (double*) malloc(L->data->numPatterns * NUM_GAMMA_CATS * NUM_BASES * sizeof(double));
+    L->sopScale = (int*) malloc(L->data->numPatterns * sizeof(int));
+    L->scaleCount = (int**) calloc(3 * numInternal, sizeof(int*));
+    if (L->sop == NULL || L->sopScale == NULL) {
+        fprintf(stderr, "\nError: not enough memory for the likelihood calculations\n");
+        exit(1);
+    }
+    for (i = 0; i < 3 * numInternal; i++) {
+        L->partial[i] = (double*) calloc(L->data->numPatterns * NUM_GAMMA_CATS * NUM_BASES, sizeof(double));
+        L->scaleCount[i] = (int*) calloc(L->data->numPatterns, sizeof(int));
+        if (L->partial[i] == NULL || L->scaleCount[i] == NULL) {
+            fprintf(stderr, "\nError: not enough memory for the likelihood calculations\n");
+            exit(1);
+        }
+    }
+
+    return L;
+}
+
+/************************* FreeLike ****************************/
+static void FreeLike(LikeSt *L)
+{
+    int i;
+
+    pthread_mutex_lock(&nativeLock);
+    partialUpdates += L->numPartials;
+    partialUpdatesAvoided += L->numAvoided;
+    pthread_mutex_unlock(&nativeLock);
+    if (L->numThreads > 1) {
+        pthread_mutex_lock(&L->lock);
+        L->quit = YES;
+        pthread_cond_broadcast(&L->start);
+        pthread_mutex_unlock(&L->lock);
+        for (i = 1; i < L->numThreads; i++) {
+            pthread_join(L->thread[i], NULL);
+        }
+        free(L->thread);
+        pthread_mutex_destroy(&L->lock);
+        pthread_cond_destroy(&L->start);
+        pthread_cond_destroy(&L->finished);
+    }
+    free(L->chunkSum);
+    for (i = 0; i < 3 * (tree->numNodes - tree->numTips); i++) {
+        free(L->partial[i]);
+        free(L->scaleCount[i]);
+    }
+    free(L->partial);
+    free(L->scaleCount);
+    free(L->partialValid);
+    free(L->stack);
+    free(L->sop);
+    free(L->sopScale);
+    free(L->pmat);
+    free(L->brlen);
+    free(L);
+}
+
+/************************* InitializeLike ****************************/
+/* Sets the starting values of the parameters for a model */
+static void InitializeLike(LikeSt *L, ModelSpecSt *spec)
+{
+    L->spec = spec;
+    StartParameters(L, 0.5);
+    L->eigenValid = NO;
+    L->pmatValid = NO;
+    L->numEvaluations = 0;
+    L->tolerance = LNL_TOLERANCE;
+    L->boundPart = -1;
+    L->numRounds = 0;
+    L->pruned = NO;
+    L->timedOut = NO;
+    L->secondStart = (spec->useInv == YES && spec->useGamma == YES) ? YES : NO;
+    L->holdShape = NO;
+    LnLikelihood(L);
+}
+
+/************************* StartParameters ****************************/
+/* Sets the parameters and branch lengths of L to their starting values, with
+   the gamma shape at the lattice point of OptimizeShape() nearest shape */
+static void StartParameters(LikeSt *L, double shape)
+{
+    ModelSpecSt *spec;
+    int i, p, numConst;
+
+    spec = L->spec;
+    for (i = 0; i < NUM_BASES; i++) {
+        L->pi[i] = (spec->estFreqs == YES) ? L->data->freq[i] : 0.25;
+    }
+    for (i = 0; i < 6; i++) {
+        L->rate[i] = 1.0;
+    }
+    if (spec->nst == 2) {
+        L->rate[1] = L->rate[4] = 2.0;
+    }
+    L->pinv = 0.0;
+    if (spec->useInv == YES) {
+        /* half the proportion of constant sites */
+        for (p = 0, numConst = 0; p < L->data->numPatterns; p++) {
+            if (L->data->constMask[p] != 0) {
+                numConst += L->data->weight[p];
+            }
+        }
+        L->pinv = 0.5 * numConst / L->data->numChars;
+    }
+    L->shapeInfinite = NO;
+    if (spec->useGamma == YES) {
+        L->numCats = NUM_GAMMA_CATS;
+        L->shape = exp(floor(log(shape) * SHAPE_GRID + 0.5) / SHAPE_GRID);
+        GammaRates(L->shape, L->catRate);
+    }
+    else {
+        L->numCats = 1;
+        L->shape = 0.0;
+        L->catRate[0] = 1.0;
+    }
+    for (i = 0; i < tree->numEdges; i++) {
+        if (tree->length[i] < 0) {
+            L->brlen[i] = 0.1;      /* no branch lengths in the tree */
+        }
+        else {
+            L->brlen[i] = MAX(MIN_BRLEN, MIN(MAX_BRLEN, tree->length[i]));
+        }
+    }
+    L->eigenValid = NO;
+    L->pmatValid = NO;
+}
+
+/************************* OptimizeModel ****************************/
+/* Maximizes the likelihood over the free parameters of the model and the
+   branch lengths. The likelihood of +I+G often has two maxima, one near the
+   nested +G (a small shape and pinv near 0), which the usual start leads to,
+   and one near the nested +I (a large shape). A new +I+G is therefore also
+   optimized from the +I end: first with the shape held at MAX_SHAPE, which is
+   the +I model, then with the shape free. The better of the two is kept. */
+static double OptimizeModel(LikeSt *L)
+{
+    CheckpointSt first;
+    int numRounds;
+
+    OptimizeRounds(L);
+    if (L->secondStart == YES && L->pruned == NO && L->timedOut == NO) {
+        L->secondStart = NO;
+        first.brlen = (double*) malloc(tree->numEdges * sizeof(double));
+        GetModelState(L, &first);
+        numRounds = L->numRounds;
+        StartParameters(L, MAX_SHAPE);
+        LnLikelihood(L);
+        L->holdShape = YES;
+        OptimizeRounds(L);
+        L->holdShape = NO;
+        if (L->pruned == NO && L->timedOut == NO) {
+            L->shapeInfinite = YES;
+            OptimizeRounds(L);
+        }
+        if (DEBUGLEVEL >= 2) {
+            fprintf(stderr, "\nINFO:   %s lnL = %.6f from the usual start, %.6f from the +I end", L->spec->name, first.lnL, L->lnL);
+        }
+        if (L->pruned == YES || L->timedOut == YES || L->lnL < first.lnL) {
+            SetModelState(L, &first);
+            L->pruned = L->timedOut = NO;
+        }
+        L->numRounds += numRounds;
+        free(first.brlen);
+    }
+
+    return L->lnL;
+}
+
+/************************* OptimizeRounds ****************************/
+/* Optimizes the parameters and branch lengths of a model in rounds, from
+   their values in L, until a round improves lnL less than L->tolerance */
+static double OptimizeRounds(LikeSt *L)
+{
+    int i, round;
+    double prev;
+
+    for (round = 0; round < MAX_ITER; round++) {
+        if (L->boundPart >= 0 && boundRecheck == NO && BoundExceeded(L) == YES) {
+            L->pruned = YES;
+            break;
+        }
+        if (deadline > 0 && time(NULL) >= deadline) {
+            deadlinePassed = YES;
+            L->timedOut = YES;
+            break;
+        }
+        prev = L->lnL;
+        if (L->spec->estFreqs == YES) {
+            for (i = 0; i < 3; i++) {
+                BrentOptimize(L, PAR_FREQ + i, -10.0, 10.0);
+            }
+        }
+        if (L->spec->nst == 2) {
+            BrentOptimize(L, PAR_KAPPA, log(0.0001), log(10000.0));
+        }
+        else if (L->spec->nst == 6) {
+            for (i = 0; i < 5; i++) {
+                BrentOptimize(L, PAR_RATE + i, log(0.0001), log(10000.0));
+            }
+        }
+        if (L->spec->useInv == YES) {
+            BrentOptimize(L, PAR_PINV, 0.0, MAX_PINV);
+        }
+        if (L->spec->useGamma == YES && L->holdShape == NO) {
+            OptimizeShape(L);
+        }
+        OptimizeBranchLengths(L);
+        L->numRounds++;
+        if (DEBUGLEVEL >= 3) {
+            fprintf(stderr, "\nINFO:   round %d: lnL = %.6f", round + 1, L->lnL);
+        }
+        if (L->record >= 0) {
+            UpdateCheckpoint(L, NO);
+        }
+        if (L->lnL - prev < L->tolerance) {
+            break;
+        }
+    }
+    if (L->spec->useGamma == YES && L->holdShape == NO && L->pruned == NO && L->timedOut == NO) {
+        RefineShape(L);
+    }
+
+    return L->lnL;
+}
+
+/************************* StoreScores ****************************/
+/* Stores -lnL and the estimates in L->score as PAUP* writes them in the scorefile */
+static void StoreScores(LikeSt *L)
+{
+    int i, k;
+    double titv;
+
+    k = L->spec->scoreIndex;
+    L->score[k++] = 1;
+    L->score[k++] = -L->lnL;
+    if (L->spec->estFreqs == YES) {
+        for (i = 0; i < NUM_BASES; i++) {
+            L->score[k++] = L->pi[i];
+        }
+    }
+    if (L->spec->nst == 2) {
+        /* ti/tv ratio, not the rate ratio kappa */
+        titv = L->rate[1] * (L->pi[0] * L->pi[2] + L->pi[1] * L->pi[3]) / ((L->pi[0] + L->pi[2]) * (L->pi[1] + L->pi[3]));
+        L->score[k++] = titv;
+    }
+    else if (L->spec->nst == 6) {
+        for (i = 0; i < 6; i++) {
+            L->score[k++] = L->rate[i] / L->rate[5];
+        }
+    }
+    if (L->spec->useInv == YES) {
+        L->score[k++] = L->pinv;
+    }
+    if (L->spec->useGamma == YES) {
+        L->score[k++] = (L->shapeInfinite == YES) ? SHAPE_INFINITY : L->shape;
+    }
+}
+
+/************************* LnLikelihood ****************************/
+/* Calculates the log likelihood of the alignment on the tree (Felsenstein
+   pruning), evaluated on the first edge of the root. Only invalid partials
+   are recalculated, so a change of pinv costs no pruning at all. */
+static double LnLikelihood(LikeSt *L)
+{
+    int e, i;
+    double d1, d2;
+
+    if (L->eigenValid == NO) {
+        SetupEigen(L);
+        L->pmatValid = NO;
+    }
+    if (L->pmatValid == NO) {
+        for (e = 0; e < tree->numEdges; e++) {
+            TransitionMatrices(L, e);
+        }
+        for (i = 0; i < 3 * (tree->numNodes - tree->numTips); i++) {
+            L->partialValid[i] = NO;
+        }
+        L->pmatValid = YES;
+    }
+    EdgeSumOfProducts(L, tree->root, 0);
+    L->lnL = EdgeLnL(L, L->brlen[tree->edge[tree->root][0]], &d1, &d2);
+
+    return L->lnL;
+}
+
+/************************* SetupEigen ****************************/
+/* Eigensystem of the rate matrix, scaled to one substitution per site */
+static void SetupEigen(LikeSt *L)
+{
+    double q[NUM_BASES][NUM_BASES], a[NUM_BASES][NUM_BASES], v[NUM_BASES][NUM_BASES], sq[NUM_BASES], mu;
+    int i, j, k;
+
+    k = 0;
+    for (i = 0; i < NUM_BASES; i++) {
+        for (j = i + 1; j < NUM_BASES; j++) {
+            q[i][j] = L->rate[k] * L->pi[j];
+            q[j][i] = L->rate[k] * L->pi[i];
+            k++;
+        }
+    }
+    mu = 0.0;
+    for (i = 0; i < NUM_BASES; i++) {
+        q[i][i] = 0.0;
+        for (j = 0; j < NUM_BASES; j++) {
+            if (j != i) {
+                q[i][i] -= q[i][j];
+            }
+        }
+        mu -= L->pi[i] * q[i][i];
+        sq[i] = sqrt(L->pi[i]);
+    }
+    /* symmetric matrix with the same eigenvalues: a = diag(sq) q diag(1/sq) */
+    for (i = 0; i < NUM_BASES; i++) {
+        for (j = 0; j < NUM_BASES; j++) {
+            a[i][j] = q[i][j] / mu * sq[i] / sq[j];
+        }
+    }
+    EigenSymmetric(a, L->eval, v);
+    for (i = 0; i < NUM_BASES; i++) {
+        for (k = 0; k < NUM_BASES; k++) {
+            L->evec[i][k] = v[i][k] / sq[i];
+            L->ivec[k][i] = v[i][k] * sq[i];
+        }
+    }
+    L->eigenValid = YES;
+}
+
+/************************* EigenSymmetric ****************************/
+/* Eigenvalues d and eigenvectors (columns of v) of a symmetric matrix (Jacobi rotations) */
+static void EigenSymmetric(double a[NUM_BASES][NUM_BASES], double d[NUM_BASES], double v[NUM_BASES][NUM_BASES])
+{
+    int i, k, p, q, sweep;
+    double off, theta, t, c, s, x, y;
+
+    for (i = 0; i < NUM_BASES; i++) {
+        for (k = 0; k < NUM_BASES; k++) {
+            v[i][k] = (i == k) ? 1.0 : 0.0;
+        }
+    }
+    for (sweep = 0; sweep < 50; sweep++) {
+        off = 0.0;
+        for (p = 0; p < NUM_BASES; p++) {
+            for (q = p + 1; q < NUM_BASES; q++) {
+                off += a[p][q] * a[p][q];
+            }
+        }
+        if (off < 1.0e-30) {
+            break;
+        }
+        for (p = 0; p < NUM_BASES; p++) {
+            for (q = p + 1; q < NUM_BASES; q++) {
+                if (fabs(a[p][q]) < 1.0e-300) {
+                    continue;
+                }
+                theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                c = 1.0 / sqrt(t * t + 1.0);
+                s = t * c;
+                for (k = 0; k < NUM_BASES; k++) {
+                    x = a[k][p];
+                    y = a[k][q];
+                    a[k][p] = c * x - s * y;
+                    a[k][q] = s * x + c * y;
+                }
+                for (k = 0; k < NUM_BASES; k++) {
+                    x = a[p][k];
+                    y = a[q][k];
+                    a[p][k] = c * x - s * y;
+                    a[q][k] = s * x + c * y;
+                }
+                for (k = 0; k < NUM_BASES; k++) {
+                    x = v[k][p];
+                    y = v[k][q];
+                    v[k][p] = c * x - s * y;
+                    v[k][q] = s * x + c * y;
+                }
+            }
+        }
+    }
+    for (i = 0; i < NUM_BASES; i++) {
+        d[i] = a[i][i];
+    }
+}
+
+/************************* TransitionMatrices ****************************/
+/* Transition probabilities along edge e for each rate category. Only the
+   exponentials depend on the category; the eigensystem is shared. */
+static void TransitionMatrices(LikeSt *L, int e)
+{
+    int c, i, j, k;
+    double *P, ex[NUM_BASES], sum;
+
+    for (c = 0; c < L->numCats; c++) {
+        P = L->pmat + (e * NUM_GAMMA_CATS + c) * NUM_BASES * NUM_BASES;
+        for (k = 0; k < NUM_BASES; k++) {
+            ex[k] = exp(L->eval[k] * L->brlen[e] * L->catRate[c]);
+        }
+        for (i = 0; i < NUM_BASES; i++) {
+            for (j = 0; j < NUM_BASES; j++) {
+                sum = 0.0;
+                for (k = 0; k < NUM_BASES; k++) {
+                    sum += L->evec[i][k] * ex[k] * L->ivec[k][j];
+                }
+                P[i * NUM_BASES + j] = (sum < 0.0) ? 0.0 : sum;
+            }
+        }
+    }
+}
+
+/************************* NodePartial ****************************/
+/* Conditional likelihoods at internal node u for the subtree that is seen
+   from its neighbour in slot k. The partials of the other two neighbours
+   must be valid. Patterns whose partials all fall below SCALE_LIMIT are
+   multiplied by SCALE_FACTOR, which is exact, and counted in scaleCount
+   together with the scalings of the subtrees. Only patterns start to end-1
+   are calculated. */
+static void NodePartial(LikeSt *L, int u, int k, int start, int end)
+{
+    int j, v, p, c, x, s, first, numCats, *count, *childCount;
+    double *dst, *d, *src, *P, *Pc, tipP[NUM_GAMMA_CATS][16][NUM_BASES], val, max;
+    unsigned char state[CHUNK_SIZE];
+
+    numCats = L->numCats;
+    dst = L->partial[3 * (u - tree->numTips) + k];
+    count = L->scaleCount[3 * (u - tree->numTips) + k];
+    for (p = start; p < end; p++) {
+        count[p] = 0;
+    }
+    first = YES;
+    for (j = 0; j < 3; j++) {
+        v = tree->nb[u][j];
+        if (j == k) {
+            continue;
+        }
+        P = L->pmat + tree->edge[u][j] * NUM_GAMMA_CATS * NUM_BASES * NUM_BASES;
+        if (v < tree->numTips) {
+            /* a tip: sum the transition probabilities over its possible states */
+            for (c = 0; c < numCats; c++) {
+                Pc = P + c * NUM_BASES * NUM_BASES;
+                for (s = 1; s < 16; s++) {
+                    for (x = 0; x < NUM_BASES; x++) {
+                        tipP[c][s][x] = ((s & 1) ? Pc[x*4] : 0) + ((s & 2) ? Pc[x*4+1] : 0) + ((s & 4) ? Pc[x*4+2] : 0) + ((s & 8) ? Pc[x*4+3] : 0);
+                    }
+                }
+            }
+            TipStates(L->data, v, start, end, state);
+            for (p = start; p < end; p++) {
+                for (c = 0; c < numCats; c++) {
+                    d = dst + (p * numCats + c) * NUM_BASES;
+                    for (x = 0; x < NUM_BASES; x++) {
+                        val = tipP[c][state[p - start]][x];
+                        d[x] = first ? val : d[x] * val;
+                    }
+                }
+            }
+        }
+        else {
+            src = L->partial[3 * (v - tree->numTips) + tree->back[u][j]];
+            childCount = L->scaleCount[3 * (v - tree->numTips) + tree->back[u][j]];
+            for (p = start; p < end; p++) {
+                count[p] += childCount[p];
+            }
+            for (p = start; p < end; p++) {
+                for (c = 0; c < numCats; c++) {
+                    Pc = P + c * NUM_BASES * NUM_BASES;
+                    d = dst + (p * numCats + c) * NUM_BASES;
+                    s = (p * numCats + c) * NUM_BASES;
+                    for (x = 0; x < NUM_BASES; x++) {
+                        val = Pc[x*4] * src[s] + Pc[x*4+1] * src[s+1] + Pc[x*4+2] * src[s+2] + Pc[x*4+3] * src[s+3];
+                        d[x] = first ? val : d[x] * val;
+                    }
+                }
+            }
+        }
+        first = NO;
+    }
+    for (p = start; p < end; p++) {
+        d = dst + p * numCats * NUM_BASES;
+        max = 0.0;
+        for (x = 0; x < numCats * NUM_BASES; x++) {
+            max = MAX(max, d[x]);
+        }
+        if (max < SCALE_LIMIT && max > 0.0) {
+            for (x = 0; x < numCats * NUM_BASES; x++) {
+                d[x] *= SCALE_FACTOR;
+            }
+            count[p]++;
+        }
+    }
+}
+
+/************************* Partial ****************************/
+/* Returns the partials of internal node u seen from its neighbour in slot k,
+   first recalculating those that are invalid on the way to the tips */
+static double *Partial(LikeSt *L, int u, int k)
+{
+    int depth, idx, x, slot, j, v, w, ready, numTips;
+
+    numTips = tree->numTips;
+    idx = 3 * (u - numTips) + k;
+    if (L->partialValid[idx] == YES) {
+        return L->partial[idx];
+    }
+    L->stack[0] = idx;
+    depth = 1;
+    while (depth > 0) {
+        idx = L->stack[depth - 1];
+        x = idx / 3 + numTips;
+        slot = idx % 3;
+        ready = YES;
+        for (j = 0; j < 3; j++) {
+            v = tree->nb[x][j];
+            if (j == slot || v < numTips) {
+                continue;
+            }
+            w = 3 * (v - numTips) + tree->back[x][j];
+            if (L->partialValid[w] == NO) {
+                L->stack[depth++] = w;
+                ready = NO;
+            }
+        }
+        if (ready == YES) {
+            L->jobNode = x;
+            L->jobSlot = slot;
+            RunJob(L, JOB_PARTIAL);
+            L->partialValid[idx] = YES;
+            L->numPartials++;
+            depth--;
+        }
+    }
+
+    return L->partial[3 * (u - numTips) + k];
+}
+
+/************************* InvalidatePartials ****************************/
+/* Marks the partials that include the edge between node u and its neighbour
+   in slot k as invalid. A partial that is already invalid has only invalid
+   partials depending on it, so the search stops there. */
+static void InvalidatePartials(LikeSt *L, int u, int k)
+{
+    int depth, x, from, j, idx;
+
+    L->stack[0] = u;
+    L->stack[1] = k;
+    L->stack[2] = tree->nb[u][k];
+    L->stack[3] = tree->back[u][k];
+    depth = 4;
+    while (depth > 0) {
+        from = L->stack[--depth];
+        x = L->stack[--depth];
+        if (x < tree->numTips) {
+            continue;
+        }
+        for (j = 0; j < 3; j++) {
+            idx = 3 * (x - tree->numTips) + j;
+            if (j != from && L->partialValid[idx] == YES) {
+                L->partialValid[idx] = NO;
+                L->stack[depth++] = tree->nb[x][j];
+                L->stack[depth++] = tree->back[x][j];
+            }
+        }
+    }
+}
+
+/************************* EdgeSumOfProducts ****************************/
+/* Combines the partials at both ends of the edge between internal node u
+   and its neighbour in slot k into one term per pattern, category and
+   eigenvalue, so that the likelihood for any length of this edge is a sum of
+   exponentials. The partial updates that a full traversal would have made
+   and that were not needed are counted as avoided. */
+static void EdgeSumOfProducts(LikeSt *L, int u, int k)
+{
+    int v, p, *countA, *countB;
+    long before;
+
+    before = L->numPartials;
+    v = tree->nb[u][k];
+    L->jobA = Partial(L, u, k);
+    L->jobB = (v < tree->numTips) ? NULL : Partial(L, v, tree->back[u][k]);
+    L->jobTip = (v < tree->numTips) ? v : -1;
+    L->numAvoided += tree->numNodes - tree->numTips - (L->numPartials - before);
+    countA = L->scaleCount[3 * (u - tree->numTips) + k];
+    countB = (L->jobB == NULL) ? NULL : L->scaleCount[3 * (v - tree->numTips) + tree->back[u][k]];
+    for (p = 0; p < L->data->numPatterns; p++) {
+        L->sopScale[p] = countA[p] + ((countB == NULL) ? 0 : countB[p]);
+    }
+    RunJob(L, JOB_SUMS);
+}
+
+/************************* SumOfProducts ****************************/
+/* Sum-of-products terms of patterns start to end-1 for the edge set up by EdgeSumOfProducts() */
+static void SumOfProducts(LikeSt *L, int start, int end)
+{
+    int p, c, m, x, numCats;
+    double *A, *B, *a, *b, *s, left, tipRight[16][NUM_BASES];
+    unsigned char state[CHUNK_SIZE];
+
+    numCats = L->numCats;
+    A = L->jobA;
+    B = L->jobB;
+    if (B == NULL) {
+        TipStates(L->data, L->jobTip, start, end, state);
+        for (x = 1; x < 16; x++) {
+            for (m = 0; m < NUM_BASES; m++) {
+                tipRight[x][m] = ((x & 1) ? L->ivec[m][0] : 0) + ((x & 2) ? L->ivec[m][1] : 0) + ((x & 4) ? L->ivec[m][2] : 0) + ((x & 8) ? L->ivec[m][3] : 0);
+            }
+        }
+    }
+    for (p = start; p < end; p++) {
+        for (c = 0; c < numCats; c++) {
+            a = A + (p * numCats + c) * NUM_BASES;
+            b = (B == NULL) ? NULL : B + (p * numCats + c) * NUM_BASES;
+            s = L->sop + (p * numCats + c) * NUM_BASES;
+            for (m = 0; m < NUM_BASES; m++) {
+                left = 0.0;
+                for (x = 0; x < NUM_BASES; x++) {
+                    left += L->pi[x] * a[x] * L->evec[x][m];
+                }
+                if (b == NULL) {
+                    s[m] = left * tipRight[state[p - start]][m];
+                }
+                else {
+                    s[m] = left * (L->ivec[m][0] * b[0] + L->ivec[m][1] * b[1] + L->ivec[m][2] * b[2] + L->ivec[m][3] * b[3]);
+                }
+            }
+        }
+    }
+}
+
+/************************* EdgeLnL ****************************/
+/* Log likelihood, and its first (d1) and second (d2) derivatives, for length
+   t of the edge last prepared by EdgeSumOfProducts(). The scalings of the
+   partials are summed over patterns and taken out of the log likelihood at
+   the end, except at constant sites that also have an invariable-sites term,
+   where the scaled terms are small compared to it and are simply scaled back.
+   The sums of the chunks are added in chunk order, so the result does not
+   depend on the number of threads. */
+static double EdgeLnL(LikeSt *L, double t, double *d1, double *d2)
+{
+    int i;
+    double lnL, numScalings;
+
+    L->jobT = t;
+    RunJob(L, JOB_LNL);
+    lnL = *d1 = *d2 = numScalings = 0.0;
+    for (i = 0; i < L->numChunks; i++) {
+        lnL += L->chunkSum[i][0];
+        *d1 += L->chunkSum[i][1];
+        *d2 += L->chunkSum[i][2];
+        numScalings += L->chunkSum[i][3];
+    }
+    L->numEvaluations++;
+
+    return lnL - numScalings * LN_SCALE;
+}
+
+/************************* ChunkLnL ****************************/
+/* Log likelihood sums over patterns start to end-1 for EdgeLnL() */
+static void ChunkLnL(LikeSt *L, int chunk, int start, int end)
+{
+    int p, c, m, numCats;
+    long numScalings;
+    double ex[NUM_GAMMA_CATS][NUM_BASES], lr[NUM_GAMMA_CATS][NUM_BASES], *s, f0, f1, f2, term, scale, siteL, inv, r, g, lnL, d1, d2, t;
+
+    t = L->jobT;
+    numCats = L->numCats;
+    for (c = 0; c < numCats; c++) {
+        for (m = 0; m < NUM_BASES; m++) {
+            lr[c][m] = L->eval[m] * L->catRate[c];
+            ex[c][m] = exp(lr[c][m] * t);
+        }
+    }
+    scale = (1.0 - L->pinv) / numCats;
+    lnL = d1 = d2 = 0.0;
+    numScalings = 0;
+    for (p = start; p < end; p++) {
+        f0 = f1 = f2 = 0.0;
+        for (c = 0; c < numCats; c++) {
+            s = L->sop + (p * numCats + c) * NUM_BASES;
+            for (m = 0; m < NUM_BASES; m++) {
+                term = s[m] * ex[c][m];
+                f0 += term;
+                f1 += term * lr[c][m];
+                f2 += term * lr[c][m] * lr[c][m];
+            }
+        }
+        inv = 0.0;
+        if (L->pinv > 0 && L->data->constMask[p] != 0) {
+            for (m = 0; m < NUM_BASES; m++) {
+                if (L->data->constMask[p] & (1 << m)) {
+                    inv += L->pinv * L->pi[m];
+                }
+            }
+        }
+        if (L->sopScale[p] > 0) {
+            if (inv > 0) {
+                r = ldexp(1.0, -SCALE_BITS * L->sopScale[p]);
+                f0 *= r;
+                f1 *= r;
+                f2 *= r;
+            }
+            else {
+                numScalings += (long) L->data->weight[p] * L->sopScale[p];
+            }
+        }
+        siteL = scale * f0 + inv;
+        g = scale * f1 / siteL;
+        lnL += L->data->weight[p] * log(siteL);
+        d1 += L->data->weight[p] * g;
+        d2 += L->data->weight[p] * (scale * f2 / siteL - g * g);
+    }
+    L->chunkSum[chunk][0] = lnL;
+    L->chunkSum[chunk][1] = d1;
+    L->chunkSum[chunk][2] = d2;
+    L->chunkSum[chunk][3] = (double) numScalings;
+}
+
+/************************* RunJob ****************************/
+/* Runs a job over all chunks of patterns, with the site-level threads of
+   this model if there are any (the calling thread takes chunks as well) */
+static void RunJob(LikeSt *L, int job)
+{
+    L->job = job;
+    if (L->numThreads == 1) {
+        L->nextChunk = 0;
+        WorkChunks(L);
+        return;
+    }
+    pthread_mutex_lock(&L->lock);
+    L->nextChunk = 0;
+    L->numBusy = L->numThreads - 1;
+    L->generation++;
+    pthread_cond_broadcast(&L->start);
+    pthread_mutex_unlock(&L->lock);
+    WorkChunks(L);
+    pthread_mutex_lock(&L->lock);
+    while (L->numBusy > 0) {
+        pthread_cond_wait(&L->finished, &L->lock);
+    }
+    pthread_mutex_unlock(&L->lock);
+}
+
+/************************* SiteWorker ****************************/
+static void *SiteWorker(void *arg)
+{
+    LikeSt *L;
+    int generation;
+
+    L = (LikeSt*) arg;
+    generation = 0;
+    for (;;) {
+        pthread_mutex_lock(&L->lock);
+        while (L->generation == generation && L->quit == NO) {
+            pthread_cond_wait(&L->start, &L->lock);
+        }
+        if (L->quit == YES) {
+            pthread_mutex_unlock(&L->lock);
+            break;
+        }
+        generation = L->generation;
+        pthread_mutex_unlock(&L->lock);
+        WorkChunks(L);
+        pthread_mutex_lock(&L->lock);
+        if (--L->numBusy == 0) {
+            pthread_cond_signal(&L->finished);
+        }
+        pthread_mutex_unlock(&L->lock);
+    }
+
+    return NULL;
+}
+
+/************************* WorkChunks ****************************/
+/* Takes chunks of the current job until none are left */
+static void WorkChunks(LikeSt *L)
+{
+    ProfileSt snapshot;
+    int chunk, start, end;
+
+    for (;;) {
+        if (L->numThreads > 1) {
+            pthread_mutex_lock(&L->lock);
+            chunk = L->nextChunk++;
+            pthread_mutex_unlock(&L->lock);
+        }
+        else {
+            chunk = L->nextChunk++;
+        }
+        if (chunk >= L->numChunks) {
+            break;
+        }
+        start = chunk * CHUNK_SIZE;
+        end = MIN(start + CHUNK_SIZE, L->data->numPatterns);
+        if (useProfile == YES) {
+            ProfileBegin(&snapshot);
+        }
+        if (L->job == JOB_PARTIAL) {
+            NodePartial(L, L->jobNode, L->jobSlot, start, end);
+        }
+        else if (L->job == JOB_SUMS) {
+            SumOfProducts(L, start, end);
+        }
+        else {
+            ChunkLnL(L, chunk, start, end);
+        }
+        if (useProfile == YES) {
+            ProfileEnd((L->job == JOB_PARTIAL) ? PROFILE_PARTIAL : (L->job == JOB_SUMS) ? PROFILE_SUMS : PROFILE_LNL,
+                &snapshot, end - start);
+        }
+    }
+}
+
+/************************* OptimizeBranchLengths ****************************/
+/* One Newton-Raphson pass over all edges. The edges are visited in preorder,
+   so that mostly only the partial at the node shared with the previous edge
+   needs to be recalculated. */
+static void OptimizeBranchLengths(LikeSt *L)
+{
+    int i, k, x;
+
+    for (i = tree->numNodes - tree->numTips - 1; i >= 0; i--) {
+        x = tree->postorder[i];
+        for (k = 0; k < 3; k++) {
+            if (tree->nb[x][k] != tree->parent[x]) {
+                OptimizeBranch(L, x, k);
+            }
+        }
+    }
+}
+
+/************************* OptimizeBranch ****************************/
+/* Maximizes the likelihood over the length of the edge between internal
+   node u and its neighbour in slot k with Newton-Raphson steps, halving steps
+   that decrease the likelihood */
+static void OptimizeBranch(LikeSt *L, int u, int k)
+{
+    int e, iter, converged;
+    double t, f, d1, d2, tNew, fNew, n1, n2;
+
+    e = tree->edge[u][k];
+    EdgeSumOfProducts(L, u, k);
+    t = L->brlen[e];
+    f = EdgeLnL(L, t, &d1, &d2);
+    for (iter = 0; iter < MAX_ITER; iter++) {
+        if (d2 < 0.0) {
+            tNew = t - d1 / d2;
+        }
+        else {
+            tNew = (d1 > 0.0) ? 4.0 * t : 0.25 * t;
+        }
+        tNew = MAX(MIN_BRLEN, MIN(MAX_BRLEN, tNew));
+        fNew = EdgeLnL(L, tNew, &n1, &n2);
+        while (fNew < f && fabs(tNew - t) > BRLEN_TOL * t) {
+            tNew = 0.5 * (t + tNew);
+            fNew = EdgeLnL(L, tNew, &n1, &n2);
+        }
+        if (fNew < f) {
+            break;
+        }
+        converged = (fabs(tNew - t) <= BRLEN_TOL * t);
+        t = tNew;
+        f = fNew;
+        d1 = n1;
+        d2 = n2;
+        if (converged == YES) {
+            break;
+        }
+    }
+    L->lnL = f;
+    if (t != L->brlen[e]) {
+        L->brlen[e] = t;
+        TransitionMatrices(L, e);
+        InvalidatePartials(L, u, k);
+    }
+}
+
+/************************* GetParameter ****************************/
+static double GetParameter(LikeSt *L, int par)
+{
+    if (par == PAR_PINV) {
+        return L->pinv;
+    }
+    else if (par == PAR_KAPPA) {
+        return log(L->rate[1]);
+    }
+    else if (par >= PAR_RATE) {
+        return log(L->rate[par - PAR_RATE]);
+    }
+    else {
+        return log(L->pi[par - PAR_FREQ] / L->pi[3]);
+    }
+}
+
+/************************* SetParameter ****************************/
+static void SetParameter(LikeSt *L, int par, double x)
+{
+    double r[NUM_BASES], sum;
+    int i;
+
+    if (par == PAR_PINV) {
+        L->pinv = x;
+    }
+    else if (par == PAR_KAPPA) {
+        L->rate[1] = L->rate[4] = exp(x);
+        L->eigenValid = NO;
+    }
+    else if (par >= PAR_RATE) {
+        L->rate[par - PAR_RATE] = exp(x);
+        L->eigenValid = NO;
+    }
+    else {
+        sum = 0.0;
+        for (i = 0; i < NUM_BASES; i++) {
+            r[i] = L->pi[i] / L->pi[3];
+        }
+        r[par - PAR_FREQ] = exp(x);
+        for (i = 0; i < NUM_BASES; i++) {
+            sum += r[i];
+        }
+        for (i = 0; i < NUM_BASES; i++) {
+            L->pi[i] = r[i] / sum;
+        }
+        L->eigenValid = NO;
+    }
+}
+
+/************************* BrentOptimize ****************************/
+/* Maximizes the likelihood over one parameter in [lower, upper] with Brent's
+   method, searching a window around the current value */
+static double BrentOptimize(LikeSt *L, int par, double lower, double upper)
+{
+    const double golden = 0.3819660;
+    double a, b, x, w, v, u, fx, fw, fv, fu, d, e, m, tol1, tol2, p, q, r;
+    int iter;
+
+    x = w = v = GetParameter(L, par);
+    if (par == PAR_PINV) {
+        a = lower;
+        b = upper;
+    }
+    else {
+        a = MAX(lower, x - 2.0);
+        b = MIN(upper, x + 2.0);
+    }
+    if (x < a || x > b) {
+        x = w = v = MAX(a, MIN(b, x));
+        SetParameter(L, par, x);
+        LnLikelihood(L);
+    }
+    fx = fw = fv = -L->lnL;
+    u = x;
+    d = e = 0.0;
+    for (iter = 0; iter < MAX_ITER; iter++) {
+        m = 0.5 * (a + b);
+        tol1 = BRENT_TOL * fabs(x) + 1.0e-10;
+        tol2 = 2.0 * tol1;
+        if (fabs(x - m) <= tol2 - 0.5 * (b - a)) {
+            break;
+        }
+        if (fabs(e) > tol1) {
+            /* parabolic step */
+            r = (x - w) * (fx - fv);
+            q = (x - v) * (fx - fw);
+            p = (x - v) * q - (x - w) * r;
+            q = 2.0 * (q - r);
+            if (q > 0.0) {
+                p = -p;
+            }
+            else {
+                q = -q;
+            }
+            r = e;
+            e = d;
+            if (fabs(p) >= fabs(0.5 * q * r) || p <= q * (a - x) || p >= q * (b - x)) {
+                e = (x >= m) ? a - x : b - x;
+                d = golden * e;
+            }
+            else {
+                d = p / q;
+                u = x + d;
+                if (u - a < tol2 || b - u < tol2) {
+                    d = (x < m) ? tol1 : -tol1;
+                }
+            }
+        }
+        else {
+            e = (x >= m) ? a - x : b - x;
+            d = golden * e;
+        }
+        u = (fabs(d) >= tol1) ? x + d : x + ((d > 0) ? tol1 : -tol1);
+        SetParameter(L, par, u);
+        fu = -LnLikelihood(L);
+        if (fu <= fx) {
+            if (u >= x) {
+                a = x;
+            }
+            else {
+                b = x;
+            }
+            v = w; fv = fw;
+            w = x; fw = fx;
+            x = u; fx = fu;
+        }
+        else {
+            if (u < x) {
+                a = u;
+            }
+            else {
+                b = u;
+            }
+            if (fu <= fw || w == x) {
+                v = w; fv = fw;
+                w = u; fw = fu;
+            }
+            else if (fu <= fv || v == x || v == w) {
+                v = u; fv = fu;
+            }
+        }
+    }
+    if (u != x) {
+        SetParameter(L, par, x);
+        LnLikelihood(L);
+    }
+
+    return L->lnL;
+}
+
+/************************* OptimizeShape ****************************/
+/* Maximizes the likelihood over the gamma shape with Newton steps on
+   log(shape), using finite difference derivatives. The iterates are taken
+   from a lattice in log(shape) whose spacing is the difference step, so that
+   the points of each derivative are lattice neighbours of the iterate and
+   GammaRates() reuses the discrete gamma rates of the points of the previous
+   iterations (and of the earlier calls, which start from the last optimum).
+   The optimum found on the lattice is refined by one Newton step off it. If
+   the likelihood keeps increasing towards MAX_SHAPE the upper bound is
+   checked directly, and an optimum there is reported as infinity (as PAUP*
+   does) without further iterations. */
+static double OptimizeShape(LikeSt *L)
+{
+    ShapeMemoSt memo;
+    double x, f, xl, xu, fl, fu, g, h, step, xnew, fnew, xmin, xmax;
+    int iter, probed;
+
+    xmin = floor(log(MIN_SHAPE) * SHAPE_GRID + 0.5) / SHAPE_GRID;
+    xmax = floor(log(MAX_SHAPE) * SHAPE_GRID + 0.5) / SHAPE_GRID;
+    x = floor(log(L->shape) * SHAPE_GRID + 0.5) / SHAPE_GRID;
+    f = (exp(x) == L->shape) ? L->lnL : LnLShape(L, x);
+    memo.n = 0;
+    ShapeRemember(&memo, x, f);
+    L->shapeInfinite = NO;
+    probed = NO;
+    for (iter = 0; iter < MAX_ITER; iter++) {
+        xl = MAX(xmin, x - SHAPE_STEP);
+        xu = MIN(xmax, x + SHAPE_STEP);
+        fl = ShapePoint(L, &memo, xl);
+        fu = (xu > x) ? ShapePoint(L, &memo, xu) : f;
+        g = (fu - fl) / (xu - xl);
+        if (x >= xmax && g >= 0.0) {
+            L->shapeInfinite = YES;
+            break;
+        }
+        h = (xu > x && xl < x) ? ((fu - f) / (xu - x) - (f - fl) / (x - xl)) / (0.5 * (xu - xl)) : 0.0;
+        if (g > 0.0 && h >= 0.0 && probed == NO) {
+            /* no maximum ahead: try the upper bound before walking towards it */
+            probed = YES;
+            fnew = ShapePoint(L, &memo, xmax);
+            fl = ShapePoint(L, &memo, xmax - SHAPE_STEP);
+            if (fnew >= fl && fnew > f) {
+                x = xmax;
+                f = fnew;
+                L->shapeInfinite = YES;
+                break;
+            }
+        }
+        step = (h < 0.0) ? -g / h : ((g > 0.0) ? 1.0 : -1.0);
+        step = MAX(-1.0, MIN(1.0, step));
+        xnew = MAX(xmin, MIN(xmax, floor((x + step) * SHAPE_GRID + 0.5) / SHAPE_GRID));
+        if (xnew == x) {
+            break;                  /* the optimum is within half a lattice step of x */
+        }
+        fnew = ShapePoint(L, &memo, xnew);
+        while (fnew < f && fabs(xnew - x) > SHAPE_STEP) {
+            step *= 0.5;
+            xnew = floor((x + step) * SHAPE_GRID + 0.5) / SHAPE_GRID;
+            fnew = ShapePoint(L, &memo, xnew);
+        }
+        if (fnew <= f) {
+            break;
+        }
+        step = xnew - x;
+        x = xnew;
+        f = fnew;
+        if (fabs(step) <= SHAPE_STEP) {
+            break;
+        }
+    }
+    if (L->shape != exp(x)) {
+        LnLShape(L, x);
+    }
+
+    return L->lnL;
+}
+
+/************************* RefineShape ****************************/
+/* Takes the shape found by OptimizeShape() on its lattice to the optimum
+   between the lattice points next to it, by one Newton step, once the other
+   parameters have converged */
+static double RefineShape(LikeSt *L)
+{
+    double x, f, fl, fu, g, h;
+
+    x = floor(log(L->shape) * SHAPE_GRID + 0.5) / SHAPE_GRID;
+    if (L->shapeInfinite == YES || x - SHAPE_STEP < log(MIN_SHAPE) || x + SHAPE_STEP > log(MAX_SHAPE)) {
+        return L->lnL;
+    }
+    f = (exp(x) == L->shape) ? L->lnL : LnLShape(L, x);
+    fl = LnLShape(L, x - SHAPE_STEP);
+    fu = LnLShape(L, x + SHAPE_STEP);
+    g = (fu - fl) / (2.0 * SHAPE_STEP);
+    h = (fu - 2.0 * f + fl) / (SHAPE_STEP * SHAPE_STEP);
+    if (h < 0.0 && fabs(g / h) < SHAPE_STEP && LnLShape(L, x - g / h) >= f) {
+        return L->lnL;
+    }
+
+    return LnLShape(L, x);
+}
+
+/************************* ShapePoint ****************************/
+/* LnLShape() at a point x of the log(shape) lattice, or its value from earlier
+   in the same OptimizeShape(). The parameters of L are then those of the last
+   point calculated, which OptimizeShape() sets right at the end. */
+static double ShapePoint(LikeSt *L, ShapeMemoSt *memo, double x)
+{
+    double f;
+    int i;
+
+    for (i = 0; i < memo->n; i++) {
+        if (memo->x[i] == x) {
+            pthread_mutex_lock(&nativeLock);
+            shapePointsReused++;
+            pthread_mutex_unlock(&nativeLock);
+            return memo->f[i];
+        }
+    }
+    f = LnLShape(L, x);
+    ShapeRemember(memo, x, f);
+
+    return f;
+}
+
+/************************* ShapeRemember ****************************/
+static void ShapeRemember(ShapeMemoSt *memo, double x, double f)
+{
+    if (memo->n < SHAPE_MEMO) {
+        memo->x[memo->n] = x;
+        memo->f[memo->n] = f;
+        memo->n++;
+    }
+}
+
+/************************* LnLShape ****************************/
+/* Log likelihood with the gamma shape set to exp(x). With +I+G it is the
+   likelihood maximized over pinv, as shape and pinv are strongly correlated
+   and alternating between them converges very slowly. */
+static double LnLShape(LikeSt *L, double x)
+{
+    L->shape = exp(x);
+    GammaRates(L->shape, L->catRate);
+    L->pmatValid = NO;
+    LnLikelihood(L);
+    if (L->spec->useInv == YES) {
+        BrentOptimize(L, PAR_PINV, 0.0, MAX_PINV);
+    }
+
+    return L->lnL;
+}
+
+/************************* GammaRates ****************************/
+/* Mean rates of the discrete gamma categories, memoized for the shapes of the
+   log(shape) lattice of OptimizeShape(). The point of MAX_SHAPE, reported as
+   infinity, is an infinite shape: all rates one, so that +G and +I+G there
+   are their nested models without rate variation. */
+static void GammaRates(double shape, double *rates)
+{
+    long key;
+    int i, slot;
+
+    key = (long) floor(log(shape) * SHAPE_GRID + 0.5);
+    if (key >= (long) floor(log(MAX_SHAPE) * SHAPE_GRID + 0.5)) {
+        for (i = 0; i < NUM_GAMMA_CATS; i++) {
+            rates[i] = 1.0;
+        }
+        return;
+    }
+    if (exp(key / SHAPE_GRID) != shape) {
+        DiscreteGamma(shape, NUM_GAMMA_CATS, rates);
+        pthread_mutex_lock(&nativeLock);
+        gammaCacheMisses++;
+        pthread_mutex_unlock(&nativeLock);
+        return;
+    }
+    slot = (int) (((unsigned long) key) % GAMMA_CACHE);
+    pthread_mutex_lock(&nativeLock);
+    if (gammaCache[slot].used == NO || gammaCache[slot].key != key) {
+        DiscreteGamma(exp(key / SHAPE_GRID), NUM_GAMMA_CATS, gammaCache[slot].rate);
+        gammaCache[slot].key = key;
+        gammaCache[slot].used = YES;
+        gammaCacheMisses++;
+    }
+    else {
+        gammaCacheHits++;
+    }
+    for (i = 0; i < NUM_GAMMA_CATS; i++) {
+        rates[i] = gammaCache[slot].rate[i];
+    }
+    pthread_mutex_unlock(&nativeLock);
+}
+
+/************************* DiscreteGamma ****************************/
+/* Mean rates of K equally probable categories of a gamma distribution with
+   mean one (Yang 1994. J. Mol. Evol. 39:306-314) */
+static void DiscreteGamma(double shape, int K, double *rates)
+{
+    int i;
+    double cut[NUM_GAMMA_CATS], lnGamma1;
+
+    lnGamma1 = LnGamma(shape + 1.0);
+    for (i = 0; i < K - 1; i++) {
+        cut[i] = PointChi2((i + 1.0) / K, 2.0 * shape) / (2.0 * shape);
+    }
+    for (i = 0; i < K - 1; i++) {
+        cut[i] = IncompleteGamma(cut[i] * shape, shape + 1.0, lnGamma1);
+    }
+    rates[0] = cut[0] * K;
+    rates[K-1] = (1.0 - cut[K-2]) * K;
+    for (i = 1; i < K - 1; i++) {
+        rates[i] = (cut[i] - cut[i-1]) * K;
+    }
+}
+
+/************************* LnGamma ****************************/
+/* log(gamma(x)) for x > 0 (Stirling's formula) */
+static double LnGamma(double x)
+{
+    double f, z;
+
+    f = 0.0;
+    if (x < 7.0) {
+        f = 1.0;
+        z = x - 1.0;
+        while (++z < 7.0) {
+            f *= z;
+        }
+        x = z;
+        f = -log(f);
+    }
+    z = 1.0 / (x * x);
+
+    return f + (x - 0.5) * log(x) - x + 0.918938533204673
+        + (((-0.000595238095238 * z + 0.000793650793651) * z - 0.002777777777778) * z + 0.083333333333333) / x;
+}
+
+/************************* IncompleteGamma ****************************/
+/* Incomplete gamma ratio I(x, alpha). Algorithm AS 239 (Bhattacharjee 1970. Appl. Stat. 19:285-287) */
+static double IncompleteGamma(double x, double alpha, double lnGammaAlpha)
+{
+    int i;
+    double factor, gin, rn, a, b, an, dif, term, pn[6];
+    const double accurate = 1.0e-10, overflow = 1.0e60;
+
+    if (x <= 0.0) {
+        return 0.0;
+    }
+    factor = exp(alpha * log(x) - x - lnGammaAlpha);
+    if (x <= 1.0 || x < alpha) {
+        /* series expansion */
+        gin = term = 1.0;
+        rn = alpha;
+        do {
+            rn++;
+            term *= x / rn;
+            gin += term;
+        } while (term > accurate);
+
+        return gin * factor / alpha;
+    }
+    /* continued fraction */
+    a = 1.0 - alpha;
+    b = a + x + 1.0;
+    term = 0.0;
+    pn[0] = 1.0;
+    pn[1] = x;
+    pn[2] = x + 1.0;
+    pn[3] = x * b;
+    gin = pn[2] / pn[3];
+    for (;;) {
+        a++;
+        b += 2.0;
+        term++;
+        an = a * term;
+        for (i = 0; i < 2; i++) {
+            pn[i+4] = b * pn[i+2] - an * pn[i];
+        }
+        if (pn[5] != 0.0) {
+            rn = pn[4] / pn[5];
+            dif = fabs(gin - rn);
+            if (dif <= accurate && dif <= accurate * rn) {
+                break;
+            }
+            gin = rn;
+        }
+        for (i = 0; i < 4; i++) {
+            pn[i] = pn[i+2];
+        }
+        if (fabs(pn[4]) >= overflow) {
+            for (i = 0; i < 4; i++) {
+                pn[i] /= overflow;
+            }
+        }
+    }
+
+    return 1.0 - factor * gin;
+}
+
+/************************* PointNormal ****************************/
+/* Percentage point of the standard normal distribution. Algorithm AS 111 (Odeh & Evans 1974) */
+static double PointNormal(double prob)
+{
+    double y, z, p1;
+
+    p1 = (prob < 0.5) ? prob : 1.0 - prob;
+    if (p1 < 1.0e-20) {
+        z = 999.0;
+    }
+    else {
+        y = sqrt(log(1.0 / (p1 * p1)));
+        z = y + ((((y * -0.453642210148e-4 - 0.0204231210245) * y - 0.342242088547) * y - 1.0) * y - 0.322232431088)
+            / ((((y * 0.0038560700634 + 0.103537752850) * y + 0.531103462366) * y + 0.588581570495) * y + 0.0993484626060);
+    }
+
+    return (prob < 0.5) ? -z : z;
+}
+
+/************************* PointChi2 ****************************/
+/* Percentage point of the chi-square distribution with v degrees of freedom.
+   Algorithm AS 91 (Best & Roberts 1975. Appl. Stat. 24:385-388) */
+static double PointChi2(double prob, double v)
+{
+    const double e = 0.5e-6, aa = 0.6931471805;
+    double g, xx, c, ch, a, q, p1, p2, t, x, b, s1, s2, s3, s4, s5, s6;
+
+    if (prob < 1.0e-6) {
+        return 0.0;
+    }
+    if (prob > 1.0 - 1.0e-6) {
+        return 9999.0;
+    }
+    g = LnGamma(v / 2.0);
+    xx = v / 2.0;
+    c = xx - 1.0;
+    if (v < -1.24 * log(prob)) {
+        ch = pow(prob * xx * exp(g + xx * aa), 1.0 / xx);
+        if (ch - e < 0) {
+            return ch;
+        }
+    }
+    else if (v <= 0.32) {
+        ch = 0.4;
+        a = log(1.0 - prob);
+        do {
+            q = ch;
+            p1 = 1.0 + ch * (4.67 + ch);
+            p2 = ch * (6.73 + ch * (6.66 + ch));
+            t = -0.5 + (4.67 + 2.0 * ch) / p1 - (6.73 + ch * (13.32 + 3.0 * ch)) / p2;
+            ch -= (1.0 - exp(a + g + 0.5 * ch + c * aa) * p2 / p1) / t;
+        } while (fabs(q / ch - 1.0) > 0.01);
+    }
+    else {
+        x = PointNormal(prob);
+        p1 = 0.222222 / v;
+        ch = v * pow((x * sqrt(p1) + 1.0 - p1), 3.0);
+        if (ch > 2.2 * v + 6.0) {
+            ch = -2.0 * (log(1.0 - prob) - c * log(0.5 * ch) + g);
+        }
+    }
+    do {
+        q = ch;
+        p1 = 0.5 * ch;
+        t = IncompleteGamma(p1, xx, g);
+        p2 = prob - t;
+        t = p2 * exp(xx * aa + g + p1 - c * log(ch));
+        b = t / ch;
+        a = 0.5 * t - b * c;
+        s1 = (210.0 + a * (140.0 + a * (105.0 + a * (84.0 + a * (70.0 + 60.0 * a))))) / 420.0;
+        s2 = (420.0 + a * (735.0 + a * (966.0 + a * (1141.0 + 1278.0 * a)))) / 2520.0;
+        s3 = (210.0 + a * (462.0 + a * (707.0 + 932.0 * a))) / 2520.0;
+        s4 = (252.0 + a * (672.0 + 1182.0 * a) + c * (294.0 + a * (889.0 + 1740.0 * a))) / 5040.0;
+        s5 = (84.0 + 264.0 * a + c * (175.0 + 606.0 * a)) / 2520.0;
+        s6 = (120.0 + c * (346.0 + 127.0 * c)) / 5040.0;
+        ch += t * (1.0 + 0.5 * t * s1 - b * c * (s1 - b * (s2 - b * (s3 - b * (s4 - b * (s5 - b * s6))))));
+    } while (fabs(q / ch - 1.0) > e);
+
+    return ch;
+}
+
+
 /********************* PrintTitle **********************/
 static void PrintTitle (FILE *fp)
 {
@@ -2332,14 +10874,48 @@ static void PrintUsage()
     fprintf(stderr, "\n         -a : alpha level (e.g. -a0.01)");
     fprintf(stderr, "\n         -d : debug level (e.g. -d2)");
     fprintf(stderr, "\n         -f : input from a file for obtaining AIC values");
+    fprintf(stderr, "\n         -g : with -m, greedy search for the best scheme of merged charsets by AIC (default), AICc or BIC (e.g. -gbic)");
     fprintf(stderr, "\n         -h : help");
     fprintf(stderr, "\n         -i : AIC calculator mode");
+    fprintf(stderr, "\n         -k : use K80 instead of JC distances for the neighbor-joining tree (-s without -u)");
     fprintf(stderr, "\n         -l : LRT calculator mode");
+    fprintf(stderr, "\n         -m : select a model for each charset of the alignment with -s (or of a NEXUS file, e.g. -msets.nex)");
     fprintf(stderr, "\n         -n : sample size or number of characters (all or just variable). Forces the use of AICc");
+    fprintf(stderr, "\n         -p : number of threads for calculating likelihood scores with -s, or of PAUP* processes with --lazy and --split (e.g. -p4)");
+    fprintf(stderr, "\n         -r : directory for caching the likelihood scores calculated with -s (e.g. -rcache)");
+    fprintf(stderr, "\n         -s : calculate the likelihood scores from an alignment (NEXUS, PHYLIP or FASTA; e.g. -sdata.nex)");
     fprintf(stderr, "\n         -t : number of taxa. Forces to include branch lengths as parameters");
+    fprintf(stderr, "\n         -u : tree for calculating likelihood scores with -s (Newick or NEXUS; e.g. -utree.tre). By default a neighbor-joining tree");
     fprintf(stderr, "\n         -v : prints version number");
     fprintf(stderr, "\n         -w : confidence interval for averaging (e.g., -w0.95) (default is w=1.0)");
-    fprintf(stderr, "\n\nUNIX/MACOSX/WIN usage: mrmodeltest2 [-d -a -c -t -2 -3 -4 -l -i -f -w -? -h] < mrmodel.scores > outfile\n\n");
+    fprintf(stderr, "\n --lazy=F : run PAUP* on the NEXUS data file F for only the models the hLRTs need (e.g. --lazy=data.nex)");
+    fprintf(stderr, "\n--split=F : run PAUP* on the NEXUS data file F for the 24 models, -p processes at a time (e.g. --split=data.nex -p8)");
+    fprintf(stderr, "\n --paup=C : command that runs PAUP* on a file of commands, with --lazy or --split (default \"paup -n\")");
+    fprintf(stderr, "\n   --stream : read the scorefile from the standard input as PAUP* writes it, printing the hLRTs as soon as their models are in");
+    fprintf(stderr, "\n--follow=F : as --stream, from the scorefile F that PAUP* is writing (e.g. --follow=mrmodel.scores)");
+    fprintf(stderr, "\n--queue=DIR : work through the PAUP* scorefiles in DIR/todo with other workers sharing DIR, one locus at a time");
+    fprintf(stderr, "\n--reduce=DIR : print the models selected for the loci of --queue=DIR as one table");
+    fprintf(stderr, "\n--batch : select the models of each scorefile named on the standard input, -p at a time, reports in order");
+    fprintf(stderr, "\n  --store=F : with --batch, also write the results of all loci to a columnar file F");
+    fprintf(stderr, "\n  --metrics=F : with --batch, keep Prometheus metrics of the run in F, rewritten every 5 seconds (--metrics-interval=N)");
+    fprintf(stderr, "\n--profile : count cycles, instructions, cache and branch misses of the numeric kernels (Linux perf events), or time them");
+    fprintf(stderr, "\n  --summary[=F] : with --batch, end with a summary of all loci (and save it to F)");
+    fprintf(stderr, "\n--merge=F,F... : print the summary of the loci of several --summary=F runs");
+    fprintf(stderr, "\n--query=F : list the loci of the results store F that meet --where=C,C... (e.g. hLRT1!=AIC,alphaG>1)");
+    fprintf(stderr, "\n  with the columns --show=C,C... (default name); --stats=C,C... summarizes the columns over them");
+    fprintf(stderr, "\n--watch=DIR : select the models of each PAUP* scorefile (*.scores) written to DIR, -p at a time, until stopped");
+    fprintf(stderr, "\n  --lease=S : with --queue, seconds after which the claim of a worker that died is run again (default %d)", QUEUE_LEASE);
+    fprintf(stderr, "\n--retries=N : with --lazy or --split, times a failed PAUP* run is run again (default 2)");
+    fprintf(stderr, "\n  --aic=A : with --lazy, compare by AIC the models scored for the hLRTs (scored, the default), all models (all) or none (none)");
+    fprintf(stderr, "\n   --resume : continue a run with -s that was stopped, from its checkpoint file (alignment file name + .ckpt)");
+    fprintf(stderr, "\n--deadline=N : with -s, stop optimizing after N seconds and select from the models as they are then");
+    fprintf(stderr, "\n    --bound : with -s, stop optimizing the models that cannot have the smallest AIC");
+    fprintf(stderr, "\n --screen=D : with -s, fully optimize only the models within D AIC units of the best after a quick screening (e.g. --screen=10)");
+    fprintf(stderr, "\n--checkpoint=N : with -s, save a checkpoint every N seconds (--checkpoint: every %d)", CHECKPOINT_INTERVAL);
+    fprintf(stderr, "\n\nUNIX/MACOSX/WIN usage: mrmodeltest2 [-d -a -c -t -2 -3 -4 -l -i -f -w -? -h] < mrmodel.scores > outfile");
+    fprintf(stderr, "\n                       mrmodeltest2 -sdata.nex [-utree.tre -m -g -k -p -r -d -a -c -t -2 -3 -4 -w] > outfile");
+    fprintf(stderr, "\n                       mrmodeltest2 --lazy=data.nex [--paup=command --aic=scored -p -d -a -c -t -2 -3 -4 -w] > outfile");
+    fprintf(stderr, "\n                       mrmodeltest2 --split=data.nex [--paup=command --retries=2 -p -d -a -c -t -2 -3 -4 -w] > outfile\n\n");
     if (WIN == 1) {
         fprintf(stderr, "\n\nHit return to close this window!\n\n");    /*For windows.*/
     }
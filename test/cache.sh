@@ -0,0 +1,17 @@
+#!/bin/sh
+# Case of test/check for the cache of results (-r): the options are run with
+# an empty cache and then again, and the second run, which must take the
+# packed alignment and the scores from the cache, is printed
+#
+#   sh cache.sh path/to/mrmodeltest2 -sdata.nex options...
+
+program=$1
+shift
+
+rm -rf cache
+$program "$@" -rcache > /dev/null 2>&1
+$program "$@" -rcache -d2 2> cache.err
+echo
+echo "Alignments read from the cache: $(grep -c 'alignment read from cache/' cache.err)"
+echo "Scores taken from the cache: $(grep -c 'taken from cache/' cache.err)"
+rm -rf cache cache.err
@@ -0,0 +1,73 @@
+# Compares an output of test/check with its golden (awk -v golden=F -v tol=T):
+# numbers must agree to a relative tol (or to 1e-6, the last digit printed),
+# anything else exactly. The date and the times of the run are skipped.
+# Prints the first differences and exits 1 if there are any.
+
+function ignored(line) {
+    return line ~ /^(Mon|Tue|Wed|Thu|Fri|Sat|Sun) [A-Z][a-z][a-z] +[0-9]+ [0-9:]+ [0-9]+$/ \
+        || line ~ /^Time processing:/ || line ~ /^Decompressed input:/
+}
+
+function number(s) {
+    return s ~ /^[-+]?([0-9]+\.?[0-9]*|\.[0-9]+)([eE][-+]?[0-9]+)?$/
+}
+
+function differ(a, b,    d, m) {
+    if (a == b) {
+        return 0
+    }
+    if (!number(a) || !number(b)) {
+        return 1
+    }
+    d = a - b
+    d = (d < 0) ? -d : d
+    m = (a < 0) ? -a : a
+    m = (b < 0 && -b > m) ? -b : (b > m) ? b : m
+
+    return d > tol * m + 1e-6
+}
+
+function report(text) {
+    if (++numDiffs <= 5) {
+        print text
+    }
+}
+
+function nextGolden() {
+    while ((status = (getline expected < golden)) > 0 && ignored(expected)) {
+        ;
+    }
+    return status > 0
+}
+
+ignored($0) {
+    next
+}
+
+{
+    if (!nextGolden()) {
+        report("line " FNR ": output longer than the golden: " $0)
+        exit 1
+    }
+    n = split($0, got, /[ \t()=,;:<>\[\]]+/)
+    if (n != split(expected, want, /[ \t()=,;:<>\[\]]+/)) {
+        report("line " FNR ": expected \"" expected "\", got \"" $0 "\"")
+        next
+    }
+    for (i = 1; i <= n; i++) {
+        if (differ(got[i], want[i])) {
+            report("line " FNR ": expected " want[i] ", got " got[i] " (" $0 ")")
+            break
+        }
+    }
+}
+
+END {
+    if (numDiffs == 0 && nextGolden()) {
+        report("output shorter than the golden, which goes on: " expected)
+    }
+    if (numDiffs > 5) {
+        print "... " numDiffs " lines differ"
+    }
+    exit numDiffs > 0
+}
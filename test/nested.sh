@@ -0,0 +1,19 @@
+#!/bin/sh
+# Case of test/check for the nesting of the scores calculated: in each table
+# of -lnL printed, +I+G must be at least as likely as the +I and +G it nests
+# (the hLRTs and the AIC rely on it), and each model at least as likely as
+# the one without +I or +G
+#
+#   sh nested.sh path/to/mrmodeltest2 -sdata.nex options...
+
+program=$1
+shift
+
+$program "$@" 2> /dev/null | awk '
+    /Log Likelihood scores/ { scores = 1; next }
+    scores && NF == 0 { scores = 0 }
+    scores && $2 == "=" {
+        ok = ($4 <= $3 && $5 <= $3 && $6 <= $4 && $6 <= $5)
+        print $1 ": -lnL " $3 ", +I " $4 ", +G " $5 ", +I+G " $6 " nested: " (ok ? "yes" : "NO")
+    }
+'
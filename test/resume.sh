@@ -0,0 +1,55 @@
+#!/bin/sh
+# Case of test/check for --resume: the options are run once to the end, and
+# once more with --checkpoint=1, killed as soon as the first checkpoint is
+# written and then continued with --resume. The models selected by the
+# continued run are printed, and whether its -lnL are those of the run that
+# was not stopped (within 0.1: a model stopped in its optimization goes on from
+# where it was, not the same way). The run must take more than a second.
+#
+#   sh resume.sh path/to/mrmodeltest2 -sdata.nex options...
+
+program=$1
+shift
+for option in "$@"; do
+    case "$option" in
+    -s*) checkpoint=${option#-s}.ckpt ;;
+    esac
+done
+
+rm -f "$checkpoint"
+$program "$@" > fresh.out 2> /dev/null
+$program "$@" --checkpoint=1 > /dev/null 2>&1 &
+pid=$!
+while [ ! -s "$checkpoint" ] && kill -0 "$pid" 2> /dev/null; do
+    sleep 0.1
+done
+kill -9 "$pid" 2> /dev/null
+wait "$pid" 2> /dev/null
+if [ -s "$checkpoint" ]; then
+    echo "Stopped after its first checkpoint"
+else
+    echo "Ended before its first checkpoint"
+fi
+
+$program "$@" --resume > resumed.out 2> resumed.err
+grep -c '^\*\* Resuming from' resumed.err | sed 's/^/Resumed: /'
+grep 'Model selected' resumed.out
+awk '
+    # the tables of -lnL, in the order printed
+    /Log Likelihood scores/ { scores = 1; next }
+    scores && NF == 0 { scores = 0 }
+    scores && $2 == "=" {
+        for (i = 3; i <= NF; i++) {
+            lnL[FILENAME, ++n[FILENAME]] = $i + 0
+        }
+    }
+    END {
+        same = (n["fresh.out"] > 0 && n["fresh.out"] == n["resumed.out"])
+        for (i = 1; same && i <= n["fresh.out"]; i++) {
+            d = lnL["fresh.out", i] - lnL["resumed.out", i]
+            same = (d < 0.1 && d > -0.1)
+        }
+        print "-lnL as in the run not stopped: " (same ? "yes" : "no") " (" n["resumed.out"] " scores)"
+    }
+' fresh.out resumed.out
+rm -f "$checkpoint" "$checkpoint.tmp" fresh.out resumed.out resumed.err